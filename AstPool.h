@@ -0,0 +1,248 @@
+#pragma once
+
+// Compact form of a parsed program. Nodes are 32-bit ids into parallel arrays,
+// the children of a list are a contiguous range of ChildIds, and source
+// positions are kept in a side table that walks over the tree do not touch.
+// Each symbol's text is stored once. The evaluators run on OExpr trees,
+// which MaterializeAst builds from a pool. Passes that only read structure
+// walk the pool itself: FindSharedNodes for --hash-cons, AstPoolValid, and
+// the module loader, which caches the pool and builds only the forms it runs.
+
+#include <unordered_map>
+
+typedef unsigned int OAstId;
+
+enum class EAstKind : uint8_t {
+    List,
+    Atom
+};
+
+struct OSourcePos {
+    int Line = 0;
+    int Indent = 0;
+};
+
+struct OAstPool {
+    // Per node.
+    vector<EAstKind> Kinds{};
+    // For a list, its first entry in ChildIds. For an atom, its text id.
+    vector<OAstId> Firsts{};
+    vector<OAstId> Counts{};
+    vector<OSourcePos> Positions{};
+    vector<OAstId> ChildIds{};
+    // Per text: the text is Chars[ TextStarts[ Id ], TextStarts[ Id + 1 ] ).
+    string Chars{};
+    vector<OAstId> TextStarts{ 0 };
+    vector<int> TextSymbols{};
+    OAstId Root = 0;
+
+    int NodeCount() const {
+        return static_cast<int>( Kinds.size() );
+    }
+
+    string_view Text( const OAstId Node ) const {
+        const OAstId Id = Firsts[ Node ];
+        return string_view( Chars ).substr( TextStarts[ Id ], TextStarts[ Id + 1 ] - TextStarts[ Id ] );
+    }
+
+    size_t Bytes() const {
+        return Kinds.capacity() * sizeof( EAstKind ) + ( Firsts.capacity() + Counts.capacity() + ChildIds.capacity() + TextStarts.capacity() ) * sizeof( OAstId )
+            + Positions.capacity() * sizeof( OSourcePos ) + Chars.capacity() + TextSymbols.capacity() * sizeof( int );
+    }
+};
+
+struct OAstBuilder {
+    OAstPool& Pool;
+    // Text id per symbol id plus one, so symbols share their text. Other
+    // tokens, mostly numbers and literals, are stored as they come.
+    vector<OAstId> SymbolTexts{};
+    // The children of every list still open, innermost last.
+    vector<OAstId> Pending{};
+
+    OAstId AddNode( const EAstKind Kind, const OAstId First, const OAstId Count, const OSourcePos Position ) {
+        Pool.Kinds.push_back( Kind );
+        Pool.Firsts.push_back( First );
+        Pool.Counts.push_back( Count );
+        Pool.Positions.push_back( Position );
+        return static_cast<OAstId>( Pool.Kinds.size() - 1 );
+    }
+
+    OAstId AddText( const OToken& Token ) {
+        Pool.Chars += Token.Token;
+        Pool.TextStarts.push_back( static_cast<OAstId>( Pool.Chars.size() ) );
+        Pool.TextSymbols.push_back( Token.Symbol );
+        return static_cast<OAstId>( Pool.TextSymbols.size() - 1 );
+    }
+
+    OAstId AddAtom( const OToken& Token ) {
+        OAstId Text = 0;
+        if ( Token.Symbol < 0 ) {
+            Text = AddText( Token );
+        } else {
+            if ( Token.Symbol >= static_cast<int>( SymbolTexts.size() ) ) {
+                SymbolTexts.resize( Token.Symbol + 1 );
+            }
+            if ( SymbolTexts[ Token.Symbol ] == 0 ) {
+                SymbolTexts[ Token.Symbol ] = AddText( Token ) + 1;
+            }
+            Text = SymbolTexts[ Token.Symbol ] - 1;
+        }
+        return AddNode( EAstKind::Atom, Text, 0, OSourcePos{ Token.Line, Token.Indent } );
+    }
+
+    // Closes the list whose children start at Pending[ Start ].
+    OAstId AddList( const size_t Start ) {
+        const OAstId First = static_cast<OAstId>( Pool.ChildIds.size() );
+        Pool.ChildIds.insert( Pool.ChildIds.end(), Pending.begin() + Start, Pending.end() );
+        Pending.resize( Start );
+        return AddNode( EAstKind::List, First, static_cast<OAstId>( Pool.ChildIds.size() - First ), {} );
+    }
+};
+
+// Builds the same tree as ConstructRootExpr in one pass, including its rule
+// that a range of exactly one token is that token rather than a list of it.
+// Returns false when the parens do not nest, which ConstructRootExpr reports.
+bool BuildAstPool( const TokenList& Tokens, OAstPool& Pool ) {
+    OAstBuilder Builder{ Pool };
+    // Per open paren: where its children start in Pending, and its token index.
+    vector<pair<size_t, int>> Open{};
+    for ( int i = 0; i < Tokens.Length(); i++ ) {
+        const OToken& Token = Tokens[ i ];
+        if ( Token.Token == ExpStart ) {
+            Open.emplace_back( Builder.Pending.size(), i );
+        } else if ( Token.Token == ExpEnd ) {
+            if ( Open.empty() ) {
+                return false;
+            }
+            const auto [ Start, OpenIndex ] = Open.back();
+            Open.pop_back();
+            if ( i - OpenIndex == 2 ) {
+                // Leave the lone atom in Pending as the group's value.
+                continue;
+            }
+            const OAstId List = Builder.AddList( Start );
+            Builder.Pending.push_back( List );
+        } else {
+            Builder.Pending.push_back( Builder.AddAtom( Token ) );
+        }
+    }
+    if ( !Open.empty() ) {
+        return false;
+    }
+    Pool.Root = Tokens.Length() == 1 ? Builder.Pending[ 0 ] : Builder.AddList( 0 );
+    return true;
+}
+
+// Whether every id in Pool is in range, as it is for a pool BuildAstPool made:
+// per node arrays agree in size, children come before their list, so walks
+// end, and texts lie within Chars. Pools read from outside are checked before
+// anything walks them.
+bool AstPoolValid( const OAstPool& Pool ) {
+    const size_t Nodes = Pool.Kinds.size();
+    const size_t Texts = Pool.TextSymbols.size();
+    if ( Pool.Firsts.size() != Nodes || Pool.Counts.size() != Nodes || Pool.Positions.size() != Nodes || Pool.Root >= Nodes
+        || Pool.TextStarts.size() != Texts + 1 || Pool.TextStarts[ 0 ] != 0 || Pool.TextStarts.back() != Pool.Chars.size() ) {
+        return false;
+    }
+    for ( size_t i = 0; i < Texts; i++ ) {
+        if ( Pool.TextStarts[ i ] > Pool.TextStarts[ i + 1 ] ) {
+            return false;
+        }
+    }
+    for ( size_t Node = 0; Node < Nodes; Node++ ) {
+        if ( Pool.Kinds[ Node ] == EAstKind::Atom ) {
+            if ( Pool.Firsts[ Node ] >= Texts ) {
+                return false;
+            }
+            continue;
+        }
+        const size_t First = Pool.Firsts[ Node ];
+        if ( Pool.Kinds[ Node ] != EAstKind::List || First > Pool.ChildIds.size() || Pool.Counts[ Node ] > Pool.ChildIds.size() - First ) {
+            return false;
+        }
+        for ( size_t i = First; i < First + Pool.Counts[ Node ]; i++ ) {
+            if ( Pool.ChildIds[ i ] >= Node ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Shared nodes for --hash-cons. Only literal atoms and lists made of nothing
+// else are shared. Evaluating those writes back the same atoms every time,
+// while a name can be rebound and a list holding one can have its children
+// overwritten with their values. A shared node keeps the source position of
+// its first occurrence.
+//
+// Sharing is found on the pool before any node is built. Children come before
+// their list, so one pass in id order sees every child's class before the
+// list, and a list is keyed by the classes of its children.
+struct OConsTable {
+    // Per node, the class of constants equal to it, or AST_NOT_SHARED for a
+    // node that is not a constant.
+    vector<OAstId> Classes{};
+    // Per class, the tree built for it once one of its nodes is reached.
+    vector<OExprPtr> Built{};
+    uint64 SharedNodes = 0;
+};
+
+const OAstId AST_NOT_SHARED = ~0u;
+
+void FindSharedNodes( const OAstPool& Pool, OConsTable& Cons ) {
+    const int Nodes = Pool.NodeCount();
+    Cons.Classes.assign( Nodes, AST_NOT_SHARED );
+    unordered_map<string_view, OAstId> Atoms{};
+    unordered_map<string, OAstId> Lists{};
+    string Key{};
+    for ( int Node = 0; Node < Nodes; Node++ ) {
+        if ( Pool.Kinds[ Node ] == EAstKind::Atom ) {
+            const string_view Text = Pool.Text( Node );
+            if ( !IsSymbolToken( Text ) ) {
+                Cons.Classes[ Node ] = Atoms.emplace( Text, static_cast<OAstId>( Atoms.size() + Lists.size() ) ).first->second;
+            }
+            continue;
+        }
+        const OAstId First = Pool.Firsts[ Node ];
+        const OAstId Count = Pool.Counts[ Node ];
+        Key.assign( Count * sizeof( OAstId ), '\0' );
+        OAstId i = 0;
+        for ( ; i < Count; i++ ) {
+            const OAstId Child = Cons.Classes[ Pool.ChildIds[ First + i ] ];
+            if ( Child == AST_NOT_SHARED ) {
+                break;
+            }
+            memcpy( Key.data() + i * sizeof( OAstId ), &Child, sizeof( OAstId ) );
+        }
+        if ( i == Count ) {
+            Cons.Classes[ Node ] = Lists.emplace( Key, static_cast<OAstId>( Atoms.size() + Lists.size() ) ).first->second;
+        }
+    }
+    Cons.Built.assign( Atoms.size() + Lists.size(), nullptr );
+}
+
+// Cons is null for a plain tree with a node per occurrence. Otherwise it
+// holds what FindSharedNodes found for Pool.
+OExprPtr MaterializeAst( const OAstPool& Pool, const OAstId Node, OConsTable* Cons = nullptr ) {
+    const OAstId Class = Cons != nullptr ? Cons->Classes[ Node ] : AST_NOT_SHARED;
+    if ( Class != AST_NOT_SHARED && Cons->Built[ Class ] != nullptr ) {
+        Cons->SharedNodes++;
+        return Cons->Built[ Class ];
+    }
+    OExprPtr Expr{};
+    if ( Pool.Kinds[ Node ] == EAstKind::Atom ) {
+        const OSourcePos Position = Pool.Positions[ Node ];
+        Expr = Make_OExprPtr_Data( OToken{ Position.Line, Position.Indent, string( Pool.Text( Node ) ), Pool.TextSymbols[ Pool.Firsts[ Node ] ] } );
+    } else {
+        Expr = Make_OExprPtr( OExprType::Expr );
+        const OAstId First = Pool.Firsts[ Node ];
+        Expr->Children.Arr.reserve( Pool.Counts[ Node ] );
+        for ( OAstId i = 0; i < Pool.Counts[ Node ]; i++ ) {
+            Expr->Children.Add( MaterializeAst( Pool, Pool.ChildIds[ First + i ], Cons ) );
+        }
+    }
+    if ( Class != AST_NOT_SHARED ) {
+        Cons->Built[ Class ] = Expr;
+    }
+    return Expr;
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+// Columnar batch calls. CallOwlBatch runs a function once per row of its input
+// columns and writes each result to an output column, with no argument trees
+// built or result text parsed on the way:
+//
+//     vector<int> Ids( Rows );
+//     vector<double> Prices( Rows );
+//     vector<float> Scores( Rows );
+//     RunOwl( Machine, "(defunc Score Id Price (* Price (+ 1 (modi Id 7))))" );
+//     CallOwlBatch( Machine, "Score", { Make_OBatchColumn( Ids.data() ), Make_OBatchColumn( Prices.data() ) }, Make_OBatchOutput( Scores.data() ), Rows );
+//
+// When the function specializes for the column types, its specialized body is
+// run a block of rows at a time. Every node computes its value for all rows of
+// the block in one loop over unboxed columns before its parent runs. A ? picks
+// per row, and only the rows that take a branch run it. Rows that bail out,
+// such as those dividing by zero, and functions that do not specialize are
+// called generically one row at a time, so every row gets the result a single
+// call would. A float or double row runs specialized only when the text it
+// would be boxed as reads back as the same unboxed number, as a single call
+// checks its arguments. Other rows, such as 1234567.0, which boxes as int text,
+// or a double with more digits than a float prints, are called generically.
+
+#include "OwlEmbed.h"
+
+const int BATCH_BLOCK_ROWS = 256;
+// Bodies nested deeper than this run one row at a time, as each level of the
+// block evaluator keeps a few columns on the native stack.
+const int BATCH_MAX_DEPTH = 64;
+
+enum class EBatchType : char {
+    Int,
+    Float,
+    Double
+};
+
+struct OBatchColumn {
+    EBatchType Type = EBatchType::Int;
+    const void* Data = nullptr;
+};
+
+struct OBatchOutput {
+    EBatchType Type = EBatchType::Int;
+    void* Data = nullptr;
+};
+
+OBatchColumn Make_OBatchColumn( const int* Data ) {
+    return { EBatchType::Int, Data };
+}
+
+OBatchColumn Make_OBatchColumn( const float* Data ) {
+    return { EBatchType::Float, Data };
+}
+
+OBatchColumn Make_OBatchColumn( const double* Data ) {
+    return { EBatchType::Double, Data };
+}
+
+OBatchOutput Make_OBatchOutput( int* Data ) {
+    return { EBatchType::Int, Data };
+}
+
+OBatchOutput Make_OBatchOutput( float* Data ) {
+    return { EBatchType::Float, Data };
+}
+
+OBatchOutput Make_OBatchOutput( double* Data ) {
+    return { EBatchType::Double, Data };
+}
+
+OExprPtr BatchBox( const OBatchColumn& Column, const size_t Row ) {
+    switch ( Column.Type ) {
+    case EBatchType::Int:
+        return OMarshal<int>::ToOwl( static_cast<const int*>( Column.Data )[ Row ] );
+    case EBatchType::Float:
+        return OMarshal<float>::ToOwl( static_cast<const float*>( Column.Data )[ Row ] );
+    case EBatchType::Double:
+        return OMarshal<double>::ToOwl( static_cast<const double*>( Column.Data )[ Row ] );
+    }
+    return Make_OExprPtr_Empty();
+}
+
+void BatchStoreOwl( const OBatchOutput& Output, const size_t Row, const OExprPtr& Value ) {
+    switch ( Output.Type ) {
+    case EBatchType::Int:
+        static_cast<int*>( Output.Data )[ Row ] = OMarshal<int>::FromOwl( Value );
+        break;
+    case EBatchType::Float:
+        static_cast<float*>( Output.Data )[ Row ] = OMarshal<float>::FromOwl( Value );
+        break;
+    case EBatchType::Double:
+        static_cast<double*>( Output.Data )[ Row ] = OMarshal<double>::FromOwl( Value );
+        break;
+    }
+}
+
+// Writes the Live rows of Values, of Type, to Output from row First on.
+void BatchStore( const OBatchOutput& Output, const size_t First, const int Rows, const OSpecValue* Values, const ESpecType Type, const bool* Live ) {
+    if ( Output.Type == EBatchType::Int ) {
+        int* Out = static_cast<int*>( Output.Data ) + First;
+        for ( int r = 0; r < Rows; r++ ) {
+            Out[ r ] = Live[ r ] ? SpecToInt( Values[ r ], Type ) : Out[ r ];
+        }
+        return;
+    }
+    for ( int r = 0; r < Rows; r++ ) {
+        if ( !Live[ r ] ) {
+            continue;
+        }
+        if ( Output.Type == EBatchType::Float ) {
+            static_cast<float*>( Output.Data )[ First + r ] = SpecToFloat( Values[ r ], Type );
+        } else {
+            static_cast<double*>( Output.Data )[ First + r ] = SpecToDouble( Values[ r ], Type );
+        }
+    }
+}
+
+// Whether a float or double boxes to text that reads back as an unboxed number
+// of Type, as SpecTypeOf would read the boxed argument. Int text is taken as a
+// float when the param is declared one.
+template<typename T>
+bool BatchReadFloat( const T Value, const ESpecType Type, const bool IntAsFloat, OSpecValue& Out ) {
+    char Text[ 32 ];
+    const to_chars_result Result = to_chars( Text, Text + sizeof( Text ), Value );
+    const ESpecType Read = SpecTextType( string_view( Text, Result.ptr - Text ), Out );
+    if ( Read == ESpecType::Int && IntAsFloat ) {
+        Out.Float = static_cast<float>( Out.Int );
+        return Type == ESpecType::Float;
+    }
+    return Read == Type;
+}
+
+// Reads Rows values of Column from First on as unboxed values of Type. Live is
+// cleared for rows a single call would not run specialized with Type.
+void BatchLoad( const OBatchColumn& Column, const size_t First, const int Rows, const ESpecType Type, const bool IntAsFloat, OSpecValue* Out, bool* Live ) {
+    if ( Column.Type == EBatchType::Int ) {
+        const int* In = static_cast<const int*>( Column.Data ) + First;
+        if ( Type == ESpecType::Int ) {
+            for ( int r = 0; r < Rows; r++ ) {
+                Out[ r ].Int = In[ r ];
+            }
+        } else {
+            for ( int r = 0; r < Rows; r++ ) {
+                Out[ r ].Float = static_cast<float>( In[ r ] );
+            }
+        }
+    } else if ( Column.Type == EBatchType::Float ) {
+        const float* In = static_cast<const float*>( Column.Data ) + First;
+        for ( int r = 0; r < Rows; r++ ) {
+            Live[ r ] = Live[ r ] && BatchReadFloat( In[ r ], Type, IntAsFloat, Out[ r ] );
+        }
+    } else {
+        const double* In = static_cast<const double*>( Column.Data ) + First;
+        for ( int r = 0; r < Rows; r++ ) {
+            Live[ r ] = Live[ r ] && BatchReadFloat( In[ r ], Type, IntAsFloat, Out[ r ] );
+        }
+    }
+}
+
+int SpecNodeDepth( const OSpecNode& Node ) {
+    int Depth = 0;
+    for ( const OSpecNode& Arg : Node.Args ) {
+        Depth = max( Depth, SpecNodeDepth( Arg ) );
+    }
+    return Depth + 1;
+}
+
+// One block of rows. Live is cleared for rows that bail out, and for rows a
+// ? did not send down the branch being run.
+struct OBatchRun {
+    OMachinePtr Machine;
+    const OSpecValue* Params[ SPEC_MAX_PARAMS ];
+    int Rows = 0;
+};
+
+void RunBatch( const OSpecNode& Node, const OBatchRun& Run, OSpecValue* Out, bool* Live );
+
+void RunBatchInt( const OSpecNode& Node, const OBatchRun& Run, OSpecValue* Out, bool* Live ) {
+    RunBatch( Node, Run, Out, Live );
+    if ( Node.Type != ESpecType::Int ) {
+        for ( int r = 0; r < Run.Rows; r++ ) {
+            Out[ r ].Int = Live[ r ] ? SpecToInt( Out[ r ], Node.Type ) : 0;
+        }
+    }
+}
+
+void RunBatchFloat( const OSpecNode& Node, const OBatchRun& Run, OSpecValue* Out, bool* Live ) {
+    RunBatch( Node, Run, Out, Live );
+    if ( Node.Type != ESpecType::Float ) {
+        for ( int r = 0; r < Run.Rows; r++ ) {
+            Out[ r ].Float = static_cast<float>( Out[ r ].Int );
+        }
+    }
+}
+
+// The same operations as RunSpecialized, a column at a time.
+void RunBatch( const OSpecNode& Node, const OBatchRun& Run, OSpecValue* Out, bool* Live ) {
+    const int Rows = Run.Rows;
+    const int ArgCount = static_cast<int>( Node.Args.size() );
+    OSpecValue Arg[ BATCH_BLOCK_ROWS ];
+    switch ( Node.Op ) {
+    case ESpecOp::Int:
+    case ESpecOp::Float:
+        fill( Out, Out + Rows, Node.Value );
+        return;
+    case ESpecOp::Param:
+        copy( Run.Params[ Node.Param ], Run.Params[ Node.Param ] + Rows, Out );
+        return;
+    case ESpecOp::Add:
+    case ESpecOp::Sub:
+        // Wraps like the generic int arithmetic rather than overflowing.
+        RunBatchInt( Node.Args[ 0 ], Run, Out, Live );
+        for ( int i = 1; i < ArgCount; i++ ) {
+            RunBatchInt( Node.Args[ i ], Run, Arg, Live );
+            if ( Node.Op == ESpecOp::Add ) {
+                for ( int r = 0; r < Rows; r++ ) {
+                    Out[ r ].Int = static_cast<int>( static_cast<unsigned int>( Out[ r ].Int ) + static_cast<unsigned int>( Arg[ r ].Int ) );
+                }
+            } else {
+                for ( int r = 0; r < Rows; r++ ) {
+                    Out[ r ].Int = static_cast<int>( static_cast<unsigned int>( Out[ r ].Int ) - static_cast<unsigned int>( Arg[ r ].Int ) );
+                }
+            }
+        }
+        return;
+    case ESpecOp::Mul:
+    case ESpecOp::Div:
+        RunBatchFloat( Node.Args[ 0 ], Run, Out, Live );
+        for ( int i = 1; i < ArgCount; i++ ) {
+            RunBatchFloat( Node.Args[ i ], Run, Arg, Live );
+            if ( Node.Op == ESpecOp::Mul ) {
+                for ( int r = 0; r < Rows; r++ ) {
+                    Out[ r ].Float *= Arg[ r ].Float;
+                }
+            } else {
+                for ( int r = 0; r < Rows; r++ ) {
+                    Out[ r ].Float /= Arg[ r ].Float;
+                }
+            }
+        }
+        for ( int r = 0; r < Rows; r++ ) {
+            Live[ r ] = Live[ r ] && SpecRoundFloat( Out[ r ].Float, Out[ r ].Float );
+        }
+        return;
+    case ESpecOp::IntDiv:
+    case ESpecOp::Mod:
+        RunBatchInt( Node.Args[ 0 ], Run, Out, Live );
+        for ( int i = 1; i < ArgCount; i++ ) {
+            RunBatchInt( Node.Args[ i ], Run, Arg, Live );
+            for ( int r = 0; r < Rows; r++ ) {
+                if ( !Live[ r ] ) {
+                    continue;
+                }
+                if ( Arg[ r ].Int == 0 || ( Out[ r ].Int == INT_MIN && Arg[ r ].Int == -1 ) ) {
+                    Live[ r ] = false;
+                    continue;
+                }
+                Out[ r ].Int = Node.Op == ESpecOp::IntDiv ? Out[ r ].Int / Arg[ r ].Int : Out[ r ].Int % Arg[ r ].Int;
+            }
+        }
+        return;
+    case ESpecOp::Sqrt:
+        RunBatchFloat( Node.Args[ 0 ], Run, Out, Live );
+        for ( int r = 0; r < Rows; r++ ) {
+            Live[ r ] = Live[ r ] && SpecRoundFloat( sqrtf( Out[ r ].Float ), Out[ r ].Float );
+        }
+        return;
+    case ESpecOp::Equal:
+    case ESpecOp::Less:
+    case ESpecOp::Greater: {
+        const ESpecType Type = Node.Args[ 0 ].Type;
+        const ESpecType RHSType = Node.Args[ 1 ].Type;
+        OSpecValue LHS[ BATCH_BLOCK_ROWS ];
+        RunBatch( Node.Args[ 0 ], Run, LHS, Live );
+        RunBatch( Node.Args[ 1 ], Run, Arg, Live );
+        if ( Type == ESpecType::Int && RHSType == ESpecType::Int ) {
+            for ( int r = 0; r < Rows; r++ ) {
+                const int L = LHS[ r ].Int;
+                const int R = Arg[ r ].Int;
+                Out[ r ].Int = Node.Op == ESpecOp::Equal ? L == R : Node.Op == ESpecOp::Less ? L < R : L > R;
+            }
+            return;
+        }
+        for ( int r = 0; r < Rows; r++ ) {
+            if ( Node.Op != ESpecOp::Equal ) {
+                const float L = SpecToFloat( LHS[ r ], Type );
+                const float R = SpecToFloat( Arg[ r ], RHSType );
+                Out[ r ].Int = Node.Op == ESpecOp::Less ? L < R : L > R;
+            } else if ( Live[ r ] ) {
+                char LHSText[ 32 ];
+                char RHSText[ 32 ];
+                const int LHSLength = SpecText( LHS[ r ], Type, LHSText, sizeof( LHSText ) );
+                const int RHSLength = SpecText( Arg[ r ], RHSType, RHSText, sizeof( RHSText ) );
+                Out[ r ].Int = string_view( LHSText, LHSLength ) == string_view( RHSText, RHSLength );
+            }
+        }
+        return;
+    }
+    case ESpecOp::Branch: {
+        const ESpecType Type = Node.Args[ 0 ].Type;
+        RunBatch( Node.Args[ 0 ], Run, Arg, Live );
+        bool Taken[ BATCH_BLOCK_ROWS ];
+        bool NotTaken[ BATCH_BLOCK_ROWS ];
+        for ( int r = 0; r < Rows; r++ ) {
+            // False is exactly the text 0, so a float -0 is true.
+            const bool IsFalse = Type == ESpecType::Int ? Arg[ r ].Int == 0 : ( Arg[ r ].Float == 0 && !signbit( Arg[ r ].Float ) );
+            Taken[ r ] = Live[ r ] && !IsFalse;
+            NotTaken[ r ] = Live[ r ] && IsFalse;
+        }
+        RunBatch( Node.Args[ 1 ], Run, Out, Taken );
+        RunBatch( Node.Args[ 2 ], Run, Arg, NotTaken );
+        for ( int r = 0; r < Rows; r++ ) {
+            if ( !Taken[ r ] ) {
+                Out[ r ] = Arg[ r ];
+            }
+            Live[ r ] = Taken[ r ] || NotTaken[ r ];
+        }
+        return;
+    }
+    case ESpecOp::Call: {
+        // Arguments are computed a column at a time, and the calls made row by row.
+        OSpecValue Args[ SPEC_MAX_PARAMS ][ BATCH_BLOCK_ROWS ];
+        OBatchRun ArgRun = Run;
+        size_t Rebind = 0;
+        for ( int i = 0; i < ArgCount; i++ ) {
+            RunBatch( Node.Args[ i ], ArgRun, Args[ i ], Live );
+            for ( ; Rebind < Node.Rebinds.size() && Node.Rebinds[ Rebind ].second == i; Rebind++ ) {
+                ArgRun.Params[ Node.Rebinds[ Rebind ].first ] = Args[ i ];
+            }
+        }
+        for ( int r = 0; r < Rows; r++ ) {
+            if ( !Live[ r ] ) {
+                continue;
+            }
+            OSpecValue RowArgs[ SPEC_MAX_PARAMS ];
+            for ( int i = 0; i < ArgCount; i++ ) {
+                RowArgs[ i ] = Args[ i ][ r ];
+            }
+            GStats.Calls++;
+            OSpecRun RowRun{ Run.Machine };
+            Out[ r ] = RunSpecialized( Node.Callee->Body, RowArgs, RowRun );
+            Live[ r ] = !RowRun.Bailed;
+        }
+        return;
+    }
+    case ESpecOp::Sequence:
+        for ( int i = 0; i < ArgCount; i++ ) {
+            RunBatch( Node.Args[ i ], Run, Out, Live );
+        }
+        return;
+    }
+}
+
+// Calls the Owl function bound to Name once per row, with argument i read from
+// Inputs[ i ], and writes the results to Output. Returns false and raises an
+// eval error if Name is not a function taking one argument per column, and
+// false if any row raised an eval error.
+bool CallOwlBatch( OMachinePtr Machine, const string& Name, const vector<OBatchColumn>& Inputs, const OBatchOutput& Output, const size_t Rows ) {
+    uint64 ScanLength = 0;
+    const int Slot = Machine->Stack.Find( GSymbols.Intern( Name ), ScanLength );
+    OClosurePtr Closure{};
+    const OExprPtr Function = Slot >= 0 ? CalleeOf( Machine->Stack.Slots[ Slot ].Value, Closure ) : nullptr;
+    const int Count = static_cast<int>( Inputs.size() );
+    if ( Function == nullptr || Function->Children.Length() - 2 != Count ) {
+        RaiseEvalError( Machine, Name + " is not a function of " + to_string( Count ) + " arguments." );
+        return false;
+    }
+    // The specialization a call with these column types would run, if any.
+    OSpecialization* Spec = nullptr;
+    vector<OSpecValue> Captured{};
+    vector<bool> IntAsFloat( Count );
+    if ( Machine->Specialize && Machine->Profiler == nullptr && !TraceEnabled() && Count <= SPEC_MAX_PARAMS ) {
+        OFunctionInfo& Info = GetFunctionInfo( Function );
+        vector<ESpecType> Signature{};
+        for ( int i = 0; i < Count && Info.Specializable; i++ ) {
+            IntAsFloat[ i ] = Info.Declared[ i ] == ESpecType::Float;
+            const bool IsInt = Inputs[ i ].Type == EBatchType::Int && !IntAsFloat[ i ];
+            Signature.push_back( IsInt ? ESpecType::Int : ESpecType::Float );
+        }
+        // A closure's captured numbers follow the params, as in TrySpecializedCall.
+        vector<int> CapturedSymbols{};
+        for ( int i = 0; Closure != nullptr && i < Closure->Captured.Length(); i++ ) {
+            const OBinding& Binding = Closure->Captured[ i ];
+            OSpecValue Value{};
+            const ESpecType Type = SpecTypeOf( Binding.Value, Value );
+            if ( Type == ESpecType::Other || find( Info.ParamSymbols.begin(), Info.ParamSymbols.end(), Binding.Symbol ) != Info.ParamSymbols.end() ) {
+                continue;
+            }
+            Signature.push_back( Type );
+            CapturedSymbols.push_back( Binding.Symbol );
+            Captured.push_back( Value );
+        }
+        if ( Info.Specializable && static_cast<int>( Signature.size() ) <= SPEC_MAX_PARAMS ) {
+            Spec = GetSpecialization( Machine, Function, Signature, CapturedSymbols );
+        }
+        if ( Spec != nullptr && ( Spec->Bailouts >= SPEC_MAX_BAILOUTS || !SpecDependenciesHold( Machine, *Spec ) ) ) {
+            Spec = nullptr;
+        }
+    }
+    const bool Blocks = Spec != nullptr && SpecNodeDepth( Spec->Body ) <= BATCH_MAX_DEPTH;
+    bool Succeeded = true;
+    vector<OExprPtr> Values( Count );
+    vector<OSpecValue> Columns( Spec != nullptr ? Spec->Params.size() * BATCH_BLOCK_ROWS : 0 );
+    for ( size_t First = 0; First < Rows; First += BATCH_BLOCK_ROWS ) {
+        const int BlockRows = static_cast<int>( min<size_t>( BATCH_BLOCK_ROWS, Rows - First ) );
+        bool Live[ BATCH_BLOCK_ROWS ];
+        fill( Live, Live + BlockRows, Spec != nullptr );
+        if ( Spec != nullptr ) {
+            OBatchRun Run{ Machine, {}, BlockRows };
+            for ( int i = 0; i < static_cast<int>( Spec->Params.size() ); i++ ) {
+                OSpecValue* Column = &Columns[ i * BATCH_BLOCK_ROWS ];
+                if ( i < Count ) {
+                    BatchLoad( Inputs[ i ], First, BlockRows, Spec->Params[ i ], IntAsFloat[ i ], Column, Live );
+                } else {
+                    fill( Column, Column + BlockRows, Captured[ i - Count ] );
+                }
+                Run.Params[ i ] = Column;
+            }
+            OSpecValue Out[ BATCH_BLOCK_ROWS ];
+            if ( Blocks ) {
+                RunBatch( Spec->Body, Run, Out, Live );
+            } else {
+                for ( int r = 0; r < BlockRows; r++ ) {
+                    OSpecValue Args[ SPEC_MAX_PARAMS ];
+                    for ( int i = 0; i < static_cast<int>( Spec->Params.size() ); i++ ) {
+                        Args[ i ] = Run.Params[ i ][ r ];
+                    }
+                    OSpecRun RowRun{ Machine };
+                    Out[ r ] = RunSpecialized( Spec->Body, Args, RowRun );
+                    Live[ r ] = !RowRun.Bailed;
+                }
+            }
+            BatchStore( Output, First, BlockRows, Out, Spec->Result, Live );
+            const int Specialized = static_cast<int>( count( Live, Live + BlockRows, true ) );
+            GStats.Calls += Specialized;
+            GStats.SpecializedCalls += Specialized;
+        }
+        for ( int r = 0; r < BlockRows; r++ ) {
+            if ( Live[ r ] ) {
+                continue;
+            }
+            for ( int i = 0; i < Count; i++ ) {
+                Values[ i ] = BatchBox( Inputs[ i ], First + r );
+            }
+            Machine->EvalError = false;
+            BatchStoreOwl( Output, First + r, CallOwlFunction( Machine, Name, Values.data(), Count ) );
+            Succeeded = Succeeded && !Machine->EvalError;
+        }
+    }
+    return Succeeded;
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+// Immutable hash map. Every entry keeps the hash of its key, computed once
+// when it is put. The map is a trie on those hashes, 5 bits per level: a node
+// holds a 32-bit bitmap of the slots in use and only those slots, each an
+// entry or a child node. Lookups follow one slot per level and compare keys
+// only when the full hashes match. put and del copy the nodes on the path to
+// the key and share everything else with the map they were given.
+
+#include "Persistent.h"
+
+#include <bit>
+
+const int HMAP_BITS = 5;
+const int HMAP_MASK = ( 1 << HMAP_BITS ) - 1;
+const int HMAP_HASH_BITS = 64;
+
+// Text of a key without enclosing quotes.
+string_view MapKeyText( const OExprPtr& Key ) {
+    return TrimEnclosingQuotesView( AtomView( TopAtom( Key ) ) );
+}
+
+// FNV-1a, so maps walk in the same order on every platform.
+uint64 MapKeyHash( string_view Text ) {
+    uint64 Hash = 14695981039346656037ull;
+    for ( const char c : Text ) {
+        Hash = ( Hash ^ static_cast<unsigned char>( c ) ) * 1099511628211ull;
+    }
+    return Hash;
+}
+
+// Keys compare like ==: strings and literals by text, other objects such as
+// closures by identity. Those hash their address, so their walk order is not
+// the same from run to run.
+struct OMapKey {
+    uint64 Hash = 0;
+    string_view Text{};
+    const OObject* Identity = nullptr;
+};
+
+OMapKey Make_OMapKey( const OExprPtr& Key ) {
+    OMapKey Out{};
+    const OObject* Object = TopAtom( Key ).Object.get();
+    if ( Object != nullptr && !IsTextObject( Object ) ) {
+        Out.Identity = Object;
+        Out.Hash = MapKeyHash( string_view( reinterpret_cast<const char*>( &Out.Identity ), sizeof( Out.Identity ) ) );
+        return Out;
+    }
+    Out.Text = MapKeyText( Key );
+    Out.Hash = MapKeyHash( Out.Text );
+    return Out;
+}
+
+struct OMapEntry {
+    uint64 Hash = 0;
+    string Text{};
+    // The object of a key compared by identity, kept alive by Key.
+    const OObject* Identity = nullptr;
+    OExprPtr Key{};
+    OExprPtr Value{};
+
+    bool Matches( const OMapKey& Other ) const {
+        return Hash == Other.Hash && Identity == Other.Identity && Text == Other.Text;
+    }
+};
+
+typedef shared_ptr<const OMapEntry> OMapEntryPtr;
+
+struct OMapNode;
+typedef shared_ptr<const OMapNode> OMapNodePtr;
+
+struct OMapSlot {
+    OMapEntryPtr Entry{};
+    OMapNodePtr Child{};
+};
+
+struct OMapNode {
+    unsigned int Bitmap = 0;
+    vector<OMapSlot> Slots{};
+    // Below the last level, entries whose whole hashes are equal.
+    vector<OMapEntryPtr> Collisions{};
+
+    bool IsEmpty() const {
+        return Slots.empty() && Collisions.empty();
+    }
+
+    // The one entry left in a node, which its parent keeps in place of the node.
+    OMapEntryPtr Single() const {
+        if ( Collisions.size() == 1 ) {
+            return Collisions[ 0 ];
+        }
+        if ( Collisions.empty() && Slots.size() == 1 ) {
+            return Slots[ 0 ].Entry;
+        }
+        return nullptr;
+    }
+};
+
+OMapEntryPtr MapFind( const OMapNode& Node, const OMapKey& Key, const int Shift ) {
+    if ( Shift >= HMAP_HASH_BITS ) {
+        for ( const OMapEntryPtr& Entry : Node.Collisions ) {
+            if ( Entry->Matches( Key ) ) {
+                return Entry;
+            }
+        }
+        return nullptr;
+    }
+    const unsigned int Bit = 1u << ( ( Key.Hash >> Shift ) & HMAP_MASK );
+    if ( ( Node.Bitmap & Bit ) == 0 ) {
+        return nullptr;
+    }
+    const OMapSlot& Slot = Node.Slots[ popcount( Node.Bitmap & ( Bit - 1 ) ) ];
+    if ( Slot.Child != nullptr ) {
+        return MapFind( *Slot.Child, Key, Shift + HMAP_BITS );
+    }
+    return Slot.Entry->Matches( Key ) ? Slot.Entry : nullptr;
+}
+
+// A copy of Node with Entry put in. Added is false when it replaced an entry with the same key.
+OMapNodePtr MapPut( const OMapNode& Node, const OMapEntryPtr& Entry, const int Shift, bool& Added ) {
+    shared_ptr<OMapNode> Copy = make_shared<OMapNode>( Node );
+    if ( Shift >= HMAP_HASH_BITS ) {
+        for ( OMapEntryPtr& Existing : Copy->Collisions ) {
+            if ( Existing->Text == Entry->Text && Existing->Identity == Entry->Identity ) {
+                Existing = Entry;
+                Added = false;
+                return Copy;
+            }
+        }
+        Copy->Collisions.push_back( Entry );
+        Added = true;
+        return Copy;
+    }
+    const unsigned int Bit = 1u << ( ( Entry->Hash >> Shift ) & HMAP_MASK );
+    const int Index = popcount( Node.Bitmap & ( Bit - 1 ) );
+    if ( ( Node.Bitmap & Bit ) == 0 ) {
+        Copy->Bitmap |= Bit;
+        Copy->Slots.insert( Copy->Slots.begin() + Index, OMapSlot{ Entry, nullptr } );
+        Added = true;
+        return Copy;
+    }
+    OMapSlot& Slot = Copy->Slots[ Index ];
+    if ( Slot.Child != nullptr ) {
+        Slot.Child = MapPut( *Slot.Child, Entry, Shift + HMAP_BITS, Added );
+    } else if ( Slot.Entry->Hash == Entry->Hash && Slot.Entry->Text == Entry->Text && Slot.Entry->Identity == Entry->Identity ) {
+        Slot.Entry = Entry;
+        Added = false;
+    } else {
+        // Two keys share this slot: they move one level down.
+        bool Ignored = false;
+        const OMapNodePtr Child = MapPut( OMapNode{}, Slot.Entry, Shift + HMAP_BITS, Ignored );
+        Slot.Child = MapPut( *Child, Entry, Shift + HMAP_BITS, Added );
+        Slot.Entry = nullptr;
+    }
+    return Copy;
+}
+
+// A copy of Node without the key, or Node itself when the key is not there.
+OMapNodePtr MapDelete( const OMapNodePtr& Node, const OMapKey& Key, const int Shift, bool& Removed ) {
+    if ( Shift >= HMAP_HASH_BITS ) {
+        for ( size_t i = 0; i < Node->Collisions.size(); i++ ) {
+            if ( Node->Collisions[ i ]->Matches( Key ) ) {
+                shared_ptr<OMapNode> Copy = make_shared<OMapNode>( *Node );
+                Copy->Collisions.erase( Copy->Collisions.begin() + i );
+                Removed = true;
+                return Copy;
+            }
+        }
+        return Node;
+    }
+    const unsigned int Bit = 1u << ( ( Key.Hash >> Shift ) & HMAP_MASK );
+    if ( ( Node->Bitmap & Bit ) == 0 ) {
+        return Node;
+    }
+    const int Index = popcount( Node->Bitmap & ( Bit - 1 ) );
+    const OMapSlot& Slot = Node->Slots[ Index ];
+    OMapNodePtr Child{};
+    if ( Slot.Child != nullptr ) {
+        Child = MapDelete( Slot.Child, Key, Shift + HMAP_BITS, Removed );
+    } else {
+        Removed = Slot.Entry->Matches( Key );
+    }
+    if ( !Removed ) {
+        return Node;
+    }
+    shared_ptr<OMapNode> Copy = make_shared<OMapNode>( *Node );
+    if ( Child == nullptr || Child->IsEmpty() ) {
+        Copy->Bitmap &= ~Bit;
+        Copy->Slots.erase( Copy->Slots.begin() + Index );
+    } else if ( OMapEntryPtr Single = Child->Single() ) {
+        Copy->Slots[ Index ] = OMapSlot{ Single, nullptr };
+    } else {
+        Copy->Slots[ Index ].Child = Child;
+    }
+    return Copy;
+}
+
+// Walks the entries of a map in hash order, yielding keys or values.
+struct OMapWalk : OSequence {
+    OMapNodePtr Root{};
+    bool Values = false;
+    // The nodes being walked, outermost first, with the index of the next slot in each.
+    vector<pair<const OMapNode*, size_t>> Path{};
+
+    void Reset() {
+        Path.clear();
+        if ( Root != nullptr ) {
+            Path.emplace_back( Root.get(), 0 );
+        }
+    }
+
+    bool NextEntry( OMapEntryPtr& Out ) {
+        while ( !Path.empty() ) {
+            auto& [ Node, Index ] = Path.back();
+            if ( !Node->Collisions.empty() ) {
+                if ( Index < Node->Collisions.size() ) {
+                    Out = Node->Collisions[ Index++ ];
+                    return true;
+                }
+                Path.pop_back();
+                continue;
+            }
+            if ( Index >= Node->Slots.size() ) {
+                Path.pop_back();
+                continue;
+            }
+            const OMapSlot& Slot = Node->Slots[ Index++ ];
+            if ( Slot.Child != nullptr ) {
+                Path.emplace_back( Slot.Child.get(), 0 );
+                continue;
+            }
+            Out = Slot.Entry;
+            return true;
+        }
+        return false;
+    }
+
+    bool Next( OExprPtr& Out ) override {
+        OMapEntryPtr Entry{};
+        if ( !NextEntry( Entry ) ) {
+            return false;
+        }
+        Out = Values ? Entry->Value : Entry->Key;
+        return true;
+    }
+
+    OSequencePtr Fresh() const override;
+
+    string_view View() const override {
+        return Values ? "<vals>" : "<keys>";
+    }
+};
+
+shared_ptr<OMapWalk> Make_OMapWalk( const OMapNodePtr& Root, const bool Values ) {
+    shared_ptr<OMapWalk> Walk = make_shared<OMapWalk>();
+    Walk->Root = Root;
+    Walk->Values = Values;
+    Walk->Reset();
+    return Walk;
+}
+
+OSequencePtr OMapWalk::Fresh() const {
+    return Make_OMapWalk( Root, Values );
+}
+
+// (hmap K V ...), (put Map K V) and (del Map K). Walking a map yields its keys.
+struct OHashMap : OSequence {
+    OMapNodePtr Root = make_shared<OMapNode>();
+    int Count = 0;
+    OMapWalk Walk{};
+    mutable string Text{};
+    mutable bool HasText = false;
+
+    OExprPtr Get( const OExprPtr& Key ) const {
+        const OMapEntryPtr Entry = MapFind( *Root, Make_OMapKey( Key ), 0 );
+        return Entry != nullptr ? Entry->Value : nullptr;
+    }
+
+    bool Next( OExprPtr& Out ) override {
+        return Walk.Next( Out );
+    }
+
+    OSequencePtr Fresh() const override;
+
+    string_view View() const override {
+        if ( !HasText ) {
+            OMapWalk Entries{};
+            Entries.Root = Root;
+            Entries.Reset();
+            Text = CollectionText( '{', '}', [&Entries]( auto Add ) {
+                OMapEntryPtr Entry{};
+                while ( Entries.NextEntry( Entry ) ) {
+                    Add( Entry->Key );
+                    Add( Entry->Value );
+                }
+            } );
+            HasText = true;
+        }
+        return Text;
+    }
+};
+
+typedef shared_ptr<OHashMap> OHashMapPtr;
+
+OHashMapPtr Make_OHashMap( const OMapNodePtr& Root, const int Count ) {
+    OHashMapPtr Map = make_shared<OHashMap>();
+    Map->Root = Root;
+    Map->Count = Count;
+    Map->Walk.Root = Root;
+    Map->Walk.Reset();
+    return Map;
+}
+
+OSequencePtr OHashMap::Fresh() const {
+    return Make_OHashMap( Root, Count );
+}
+
+OHashMapPtr MapWith( const OHashMap& From, const OExprPtr& Key, const OExprPtr& Value ) {
+    shared_ptr<OMapEntry> Entry = make_shared<OMapEntry>();
+    const OMapKey MapKey = Make_OMapKey( Key );
+    Entry->Hash = MapKey.Hash;
+    Entry->Text = MapKey.Text;
+    Entry->Identity = MapKey.Identity;
+    Entry->Key = Key;
+    Entry->Value = Value;
+    bool Added = false;
+    const OMapNodePtr Root = MapPut( *From.Root, Entry, 0, Added );
+    return Make_OHashMap( Root, From.Count + Added );
+}
+
+OHashMapPtr MapWithout( const OHashMap& From, const OExprPtr& Key ) {
+    bool Removed = false;
+    const OMapNodePtr Root = MapDelete( From.Root, Make_OMapKey( Key ), 0, Removed );
+    return Make_OHashMap( Root, From.Count - Removed );
+}
+
+OHashMapPtr AsHashMap( const OExprPtr& Value ) {
+    return dynamic_pointer_cast<OHashMap>( Value->Atom.Object );
+}
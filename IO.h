@@ -8,8 +8,20 @@
 #include <functional>
 #include <sstream>
 #include <fstream>
+#include <string_view>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "Containers.h"
+#include "Values.h"
 
 Return<std::string, std::string> ReadFileIntoString( const std::string& FileName ) {
     std::ifstream inFile{ FileName };
@@ -23,3 +35,160 @@ Return<std::string, std::string> ReadFileIntoString( const std::string& FileName
 
     return { strStream.str() };
 }
+
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+// Collects output and hands it to the File, or to Sink when one is set, in large chunks.
+// Flushes when full, on Flush(), or after every write when Unbuffered.
+struct OBufferedWriter {
+    FILE* File = stdout;
+    std::function<void( std::string_view )> Sink{};
+    bool Unbuffered = false;
+    std::vector<char> Buffer = std::vector<char>( OUTPUT_BUFFER_SIZE );
+    size_t Used = 0;
+
+    void Write( std::string_view Str ) {
+        if ( Unbuffered ) {
+            Emit( Str );
+            Sync();
+            return;
+        }
+        if ( Used + Str.size() > Buffer.size() ) {
+            Flush();
+            // Too large to be worth copying, send it straight through.
+            if ( Str.size() >= Buffer.size() ) {
+                Emit( Str );
+                return;
+            }
+        }
+        std::memcpy( Buffer.data() + Used, Str.data(), Str.size() );
+        Used += Str.size();
+    }
+
+    void Write( char C ) {
+        Write( std::string_view{ &C, 1 } );
+    }
+
+    void Flush() {
+        if ( Used > 0 ) {
+            Emit( std::string_view{ Buffer.data(), Used } );
+            Used = 0;
+        }
+        Sync();
+    }
+
+    void Emit( std::string_view Str ) {
+        if ( Sink ) {
+            Sink( Str );
+        } else {
+            std::fwrite( Str.data(), 1, Str.size(), File );
+        }
+    }
+
+    void Sync() {
+        if ( !Sink ) {
+            std::fflush( File );
+        }
+    }
+};
+
+// A file mapped read-only into memory. Views into Data stay valid while the mapping is referenced.
+// Without mmap the file is read into Contents instead.
+struct OMappedFile {
+    const char* Data = nullptr;
+    size_t Size = 0;
+    std::string Contents;
+
+    std::string_view View() const {
+        return std::string_view{ Data, Size };
+    }
+
+    ~OMappedFile() {
+#if !defined(_WIN32)
+        if ( Data != nullptr ) {
+            munmap( const_cast<char*>( Data ), Size );
+        }
+#endif
+    }
+};
+
+typedef std::shared_ptr<OMappedFile> OMappedFilePtr;
+
+Return<OMappedFilePtr, std::string> MapFile( const std::string& FileName ) {
+#if defined(_WIN32)
+    std::ifstream In{ FileName, std::ios::binary };
+    if ( !In ) {
+        return { nullptr, "Error: Cannot open " + FileName + ": " + strerror( errno ) };
+    }
+    OMappedFilePtr File = std::make_shared<OMappedFile>();
+    std::stringstream Stream;
+    Stream << In.rdbuf();
+    File->Contents = Stream.str();
+    File->Data = File->Contents.data();
+    File->Size = File->Contents.size();
+    return { File };
+#else
+    const int Fd = open( FileName.c_str(), O_RDONLY );
+    if ( Fd < 0 ) {
+        return { nullptr, "Error: Cannot open " + FileName + ": " + strerror( errno ) };
+    }
+    struct stat Info {};
+    if ( fstat( Fd, &Info ) != 0 ) {
+        close( Fd );
+        return { nullptr, "Error: Cannot stat " + FileName + ": " + strerror( errno ) };
+    }
+    OMappedFilePtr File = std::make_shared<OMappedFile>();
+    File->Size = static_cast<size_t>( Info.st_size );
+    // mmap rejects empty mappings, an empty file is just an empty view.
+    if ( File->Size > 0 ) {
+        void* Data = mmap( nullptr, File->Size, PROT_READ, MAP_PRIVATE, Fd, 0 );
+        if ( Data == MAP_FAILED ) {
+            close( Fd );
+            return { nullptr, "Error: Cannot map " + FileName + ": " + strerror( errno ) };
+        }
+        madvise( Data, File->Size, MADV_SEQUENTIAL );
+        File->Data = static_cast<const char*>( Data );
+    }
+    close( Fd );
+    return { File };
+#endif
+}
+
+// A buffered output file, flushed when full, by (close), when dropped, or at exit.
+struct OFileWriter : OObject {
+    std::string Path;
+    OBufferedWriter Writer;
+
+    std::string_view View() const override {
+        return Path;
+    }
+
+    bool IsOpen() const {
+        return Writer.File != nullptr;
+    }
+
+    void Close() {
+        if ( Writer.File != nullptr ) {
+            Writer.Flush();
+            std::fclose( Writer.File );
+            Writer.File = nullptr;
+        }
+    }
+
+    ~OFileWriter() {
+        Close();
+    }
+};
+
+typedef std::shared_ptr<OFileWriter> OFileWriterPtr;
+
+Return<OFileWriterPtr, std::string> OpenFileWriter( const std::string& FileName ) {
+    FILE* File = std::fopen( FileName.c_str(), "wb" );
+    if ( File == nullptr ) {
+        return { nullptr, "Error: Cannot open " + FileName + " for writing: " + strerror( errno ) };
+    }
+    OFileWriterPtr Writer = std::make_shared<OFileWriter>();
+    Writer->Path = FileName;
+    Writer->Writer.File = File;
+    return { Writer };
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+// Modules. (import `lib/Geometry.owl` Area Perimeter) loads a file once per
+// machine as the module Geometry. Importing a second file with the same stem
+// is an error, since both would be Geometry. A relative path starts from the directory of
+// the importing script or module, and the file is known by its canonical path,
+// so lib/Geometry.owl and ./lib/Geometry.owl are the same module. Every name the module binds at top level is
+// renamed into its namespace, as Geometry.Area, so the module's own calls find
+// its own definitions whatever the importer binds. Each listed name is then
+// bound in the importer to the module's value, and only the forms that value
+// needs are run: the forms binding it, the forms binding the module names
+// those name, and so on, plus the forms that bind nothing. Later imports of
+// the same module run only what the earlier ones did not. Without names the
+// whole module runs, and its names are reached qualified.
+//
+// The parsed module is cached in .owlcache next to its file, keyed by a hash
+// of the file's text. Writing an entry removes those of earlier versions. The cache holds the module's AST pool and what each form
+// binds and names, so a later process reads it back instead of tokenizing,
+// parsing and scanning the module again, and materializes only the forms it
+// runs.
+
+#include "Watch.h"
+
+#include <filesystem>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+const char MODULE_CACHE_MAGIC[ 4 ] = { 'O', 'W', 'L', 'M' };
+const uint32_t MODULE_CACHE_VERSION = 2;
+const string MODULE_CACHE_DIR = ".owlcache";
+
+struct OModuleForm {
+    OAstId Node = 0;
+    // Qualified names the form binds.
+    vector<int> Defines{};
+    // Qualified names of the module the form names.
+    vector<int> Uses{};
+    bool Ran = false;
+};
+
+struct OModule {
+    string Namespace{};
+    OAstPool Pool{};
+    vector<OModuleForm> Forms{};
+    // Forms binding each qualified name.
+    unordered_map<int, vector<int>> Binders{};
+};
+
+typedef shared_ptr<OModule> OModulePtr;
+
+// lib/Geometry.owl is the module Geometry.
+string ModuleNamespace( const string& Path ) {
+    const size_t Slash = Path.find_last_of( "/\\" );
+    const string Name = Path.substr( Slash == string::npos ? 0 : Slash + 1 );
+    const size_t Dot = Name.rfind( '.' );
+    return Dot == string::npos || Dot == 0 ? Name : Name.substr( 0, Dot );
+}
+
+// Directory of a script or module, for resolving the imports it makes.
+string ImportBaseOf( const string& Path ) {
+    return filesystem::path( Path ).parent_path().string();
+}
+
+// Written resolved against Base, without . or .. parts and with links followed
+// as far as the path exists.
+string ResolveModulePath( const string& Base, const string& Written ) {
+    const filesystem::path Joined = filesystem::path( Base ) / Written;
+    error_code Code{};
+    const filesystem::path Canonical = filesystem::weakly_canonical( Joined, Code );
+    return Code ? Joined.lexically_normal().string() : Canonical.string();
+}
+
+string ModuleCacheDir( const string& Path ) {
+    const size_t Slash = Path.find_last_of( "/\\" );
+    return ( Slash == string::npos ? string{} : Path.substr( 0, Slash + 1 ) ) + MODULE_CACHE_DIR;
+}
+
+string ModuleCachePath( const string& Path, const string& Namespace, const uint64 Hash ) {
+    char Key[ 17 ];
+    snprintf( Key, sizeof( Key ), "%016llx", static_cast<unsigned long long>( Hash ) );
+    return ModuleCacheDir( Path ) + "/" + Namespace + "-" + Key;
+}
+
+// Removes the cache entries of earlier versions of the module, which end in a
+// different hash. Best effort, like writing the entry.
+void RemoveStaleModuleCaches( const string& Path, const string& Namespace, const string& Current ) {
+    const string Prefix = Namespace + "-";
+    error_code Code{};
+    for ( filesystem::directory_iterator It( ModuleCacheDir( Path ), Code ), End; !Code && It != End; It.increment( Code ) ) {
+        const filesystem::path Entry = It->path();
+        const string Name = Entry.filename().string();
+        if ( Name.size() != Prefix.size() + 16 || Name.compare( 0, Prefix.size(), Prefix ) != 0 || Entry == filesystem::path( Current )
+             || Name.find_first_not_of( "0123456789abcdef", Prefix.size() ) != string::npos ) {
+            continue;
+        }
+        error_code RemoveCode{};
+        filesystem::remove( Entry, RemoveCode );
+    }
+}
+
+// Tokenizes and parses Source into Module, with the names it binds moved into
+// its namespace. Returns false when the parens do not nest.
+bool BuildModule( OModule& Module, const string& Source ) {
+    TokenList Tokens = Tokenize( Source );
+    vector<int> Bound{};
+    vector<int> Names{};
+    bool DefinesFunction = false;
+    ScanBindings( Tokens, 0, Tokens.Length(), Bound, Names, DefinesFunction );
+    unordered_map<int, int> Qualified{};
+    unordered_set<int> Own{};
+    for ( const int Symbol : Bound ) {
+        Qualified.emplace( Symbol, GSymbols.Intern( Module.Namespace + "." + GSymbols.Name( Symbol ) ) );
+        Own.insert( Qualified[ Symbol ] );
+    }
+    for ( int i = 0; i < Tokens.Length(); i++ ) {
+        OToken& Token = Tokens[ i ];
+        const auto Found = Qualified.find( Token.Symbol );
+        if ( Found != Qualified.end() ) {
+            Token.Token = Module.Namespace + "." + Token.Token;
+            Token.Symbol = Found->second;
+        }
+    }
+    if ( !BuildAstPool( Tokens, Module.Pool ) ) {
+        return false;
+    }
+    // Each top-level list or atom is a child of the root, in order.
+    vector<pair<int, int>> Ranges{};
+    int Depth = 0;
+    for ( int i = 0; i < Tokens.Length(); i++ ) {
+        if ( Tokens[ i ].Token == ExpStart ) {
+            if ( Depth++ == 0 ) {
+                Ranges.emplace_back( i, i );
+            }
+        } else if ( Tokens[ i ].Token == ExpEnd ) {
+            if ( --Depth == 0 ) {
+                Ranges.back().second = i + 1;
+            }
+        } else if ( Depth == 0 ) {
+            Ranges.emplace_back( i, i + 1 );
+        }
+    }
+    const OModuleForm Empty{};
+    for ( size_t k = 0; k < Ranges.size(); k++ ) {
+        OModuleForm& Form = Module.Forms.emplace_back( Empty );
+        Form.Node = Tokens.Length() == 1 ? Module.Pool.Root : Module.Pool.ChildIds[ Module.Pool.Firsts[ Module.Pool.Root ] + k ];
+        vector<int> FormNames{};
+        ScanBindings( Tokens, Ranges[ k ].first, Ranges[ k ].second, Form.Defines, FormNames, DefinesFunction );
+        for ( const int Name : FormNames ) {
+            if ( Own.count( Name ) ) {
+                Form.Uses.push_back( Name );
+            }
+        }
+        for ( const int Name : Form.Defines ) {
+            Module.Binders[ Name ].push_back( static_cast<int>( k ) );
+        }
+    }
+    return true;
+}
+
+template<typename T>
+void ModuleCacheWrite( string& Out, const T& Value ) {
+    Out.append( reinterpret_cast<const char*>( &Value ), sizeof( T ) );
+}
+
+template<typename T>
+void ModuleCacheWrite( string& Out, const vector<T>& Values ) {
+    ModuleCacheWrite( Out, static_cast<uint32_t>( Values.size() ) );
+    Out.append( reinterpret_cast<const char*>( Values.data() ), Values.size() * sizeof( T ) );
+}
+
+struct OModuleCacheReader {
+    string_view Data{};
+    bool Good = true;
+
+    template<typename T>
+    void Read( T& Value ) {
+        Good = Good && Data.size() >= sizeof( T );
+        if ( Good ) {
+            memcpy( &Value, Data.data(), sizeof( T ) );
+            Data.remove_prefix( sizeof( T ) );
+        }
+    }
+
+    template<typename T>
+    void Read( vector<T>& Values ) {
+        uint32_t Count = 0;
+        Read( Count );
+        Good = Good && Data.size() / sizeof( T ) >= Count;
+        if ( Good ) {
+            Values.resize( Count );
+            memcpy( Values.data(), Data.data(), Count * sizeof( T ) );
+            Data.remove_prefix( Count * sizeof( T ) );
+        }
+    }
+};
+
+// File layout: magic, version, source hash, a hash of the rest of the file,
+// root, the pool's arrays as (u32 count, items), a symbol flag per text, then per form its node and the text
+// ids of the names it binds and uses. Symbols are stored as text since their
+// ids differ between processes.
+string WriteModuleCache( const OModule& Module, const uint64 Hash ) {
+    const OAstPool& Pool = Module.Pool;
+    unordered_map<int, OAstId> SymbolTexts{};
+    vector<uint8_t> IsSymbol( Pool.TextSymbols.size() );
+    for ( size_t i = 0; i < Pool.TextSymbols.size(); i++ ) {
+        IsSymbol[ i ] = Pool.TextSymbols[ i ] >= 0;
+        if ( IsSymbol[ i ] ) {
+            SymbolTexts.emplace( Pool.TextSymbols[ i ], static_cast<OAstId>( i ) );
+        }
+    }
+    const auto TextIds = [&SymbolTexts]( const vector<int>& Symbols ) {
+        vector<OAstId> Ids{};
+        for ( const int Symbol : Symbols ) {
+            Ids.push_back( SymbolTexts.at( Symbol ) );
+        }
+        return Ids;
+    };
+    string Out{};
+    ModuleCacheWrite( Out, Pool.Root );
+    ModuleCacheWrite( Out, Pool.Kinds );
+    ModuleCacheWrite( Out, Pool.Firsts );
+    ModuleCacheWrite( Out, Pool.Counts );
+    ModuleCacheWrite( Out, Pool.Positions );
+    ModuleCacheWrite( Out, Pool.ChildIds );
+    ModuleCacheWrite( Out, vector<char>( Pool.Chars.begin(), Pool.Chars.end() ) );
+    ModuleCacheWrite( Out, Pool.TextStarts );
+    ModuleCacheWrite( Out, IsSymbol );
+    ModuleCacheWrite( Out, static_cast<uint32_t>( Module.Forms.size() ) );
+    for ( const OModuleForm& Form : Module.Forms ) {
+        ModuleCacheWrite( Out, Form.Node );
+        ModuleCacheWrite( Out, TextIds( Form.Defines ) );
+        ModuleCacheWrite( Out, TextIds( Form.Uses ) );
+    }
+    string Header( MODULE_CACHE_MAGIC, sizeof( MODULE_CACHE_MAGIC ) );
+    ModuleCacheWrite( Header, MODULE_CACHE_VERSION );
+    ModuleCacheWrite( Header, Hash );
+    ModuleCacheWrite( Header, MapKeyHash( Out ) );
+    return Header + Out;
+}
+
+// Reads a cache written for the same source into Module. Returns false on a
+// stale, foreign or damaged cache. Damage is caught by the checksum, and ids
+// are still checked before use, so a file that passes it cannot crash a walk.
+bool ReadModuleCache( string_view Data, const uint64 Hash, OModule& Module ) {
+    OModuleCacheReader Reader{ Data };
+    char Magic[ sizeof( MODULE_CACHE_MAGIC ) ]{};
+    uint32_t Version = 0;
+    uint64 CachedHash = 0;
+    uint64 Checksum = 0;
+    Reader.Read( Magic );
+    Reader.Read( Version );
+    Reader.Read( CachedHash );
+    Reader.Read( Checksum );
+    if ( !Reader.Good || memcmp( Magic, MODULE_CACHE_MAGIC, sizeof( Magic ) ) != 0 || Version != MODULE_CACHE_VERSION || CachedHash != Hash
+        || MapKeyHash( Reader.Data ) != Checksum ) {
+        return false;
+    }
+    OAstPool& Pool = Module.Pool;
+    vector<char> Chars{};
+    vector<uint8_t> IsSymbol{};
+    Reader.Read( Pool.Root );
+    Reader.Read( Pool.Kinds );
+    Reader.Read( Pool.Firsts );
+    Reader.Read( Pool.Counts );
+    Reader.Read( Pool.Positions );
+    Reader.Read( Pool.ChildIds );
+    Reader.Read( Chars );
+    Reader.Read( Pool.TextStarts );
+    Reader.Read( IsSymbol );
+    uint32_t FormCount = 0;
+    Reader.Read( FormCount );
+    // Each form takes at least its node and two counts.
+    if ( !Reader.Good || FormCount > Reader.Data.size() / ( sizeof( OAstId ) + 2 * sizeof( uint32_t ) ) ) {
+        return false;
+    }
+    Pool.Chars.assign( Chars.begin(), Chars.end() );
+    Pool.TextSymbols.assign( IsSymbol.size(), NOT_A_SYMBOL );
+    if ( !AstPoolValid( Pool ) ) {
+        return false;
+    }
+    for ( size_t i = 0; i < IsSymbol.size(); i++ ) {
+        const string_view Text = string_view( Pool.Chars ).substr( Pool.TextStarts[ i ], Pool.TextStarts[ i + 1 ] - Pool.TextStarts[ i ] );
+        Pool.TextSymbols[ i ] = IsSymbol[ i ] ? GSymbols.Intern( Text ) : NOT_A_SYMBOL;
+    }
+    // Names are ids of symbol texts.
+    const auto Symbols = [&Pool]( const vector<OAstId>& Ids, vector<int>& Out ) {
+        for ( const OAstId Id : Ids ) {
+            if ( Id >= Pool.TextSymbols.size() || Pool.TextSymbols[ Id ] < 0 ) {
+                return false;
+            }
+            Out.push_back( Pool.TextSymbols[ Id ] );
+        }
+        return true;
+    };
+    Module.Forms.resize( FormCount );
+    for ( uint32_t k = 0; k < FormCount && Reader.Good; k++ ) {
+        OModuleForm& Form = Module.Forms[ k ];
+        vector<OAstId> Defines{};
+        vector<OAstId> Uses{};
+        Reader.Read( Form.Node );
+        Reader.Read( Defines );
+        Reader.Read( Uses );
+        if ( Form.Node >= Pool.Kinds.size() || !Symbols( Defines, Form.Defines ) || !Symbols( Uses, Form.Uses ) ) {
+            return false;
+        }
+        for ( const int Name : Form.Defines ) {
+            Module.Binders[ Name ].push_back( static_cast<int>( k ) );
+        }
+    }
+    return Reader.Good;
+}
+
+// Loads the module at Path from its cache, or parses it and writes the cache.
+bool LoadModule( const string& Path, OModule& Module, string& Error ) {
+    auto SourceRet = ReadFileIntoString( Path );
+    if ( SourceRet.ErrorOccured ) {
+        Error = "Cannot read module " + Path + ".";
+        return false;
+    }
+    const string& Source = SourceRet.Out;
+    const uint64 Hash = MapKeyHash( Source );
+    Module.Namespace = ModuleNamespace( Path );
+    const string CachePath = ModuleCachePath( Path, Module.Namespace, Hash );
+    std::ifstream CacheFile{ CachePath, std::ios::binary };
+    if ( CacheFile ) {
+        std::stringstream Cached{};
+        Cached << CacheFile.rdbuf();
+        if ( ReadModuleCache( Cached.str(), Hash, Module ) ) {
+            return true;
+        }
+        Module = OModule{};
+        Module.Namespace = ModuleNamespace( Path );
+    }
+    if ( !BuildModule( Module, Source ) ) {
+        Error = "The parens of module " + Path + " do not nest.";
+        return false;
+    }
+    // Best effort: written under a temporary name and renamed, so a reader never sees part of it.
+    error_code Code{};
+    filesystem::create_directory( ModuleCacheDir( Path ), Code );
+#if defined(_WIN32)
+    const string Temporary = CachePath + "." + to_string( _getpid() );
+#else
+    const string Temporary = CachePath + "." + to_string( getpid() );
+#endif
+    std::ofstream Out{ Temporary, std::ios::binary };
+    const string Bytes = WriteModuleCache( Module, Hash );
+    if ( Out.write( Bytes.data(), Bytes.size() ) ) {
+        Out.close();
+        if ( rename( Temporary.c_str(), CachePath.c_str() ) == 0 ) {
+            RemoveStaleModuleCaches( Path, Module.Namespace, CachePath );
+        }
+    } else {
+        Out.close();
+        remove( Temporary.c_str() );
+    }
+    return true;
+}
+
+// (import `Path` Name ...). A listed name that is qualified, such as one the
+// module being loaded imports for itself, is looked up by its last part.
+void ImportModule( OMachinePtr Machine, const OExprPtr Expr ) {
+    if ( Expr->Children.Length() < 2 ) {
+        RaiseEvalError( Machine, "import expects a module path and the names to link." );
+        return;
+    }
+    if ( Machine->Stack.Depth() != 1 ) {
+        RaiseEvalError( Machine, "import is only allowed at the top level." );
+        return;
+    }
+    const string Written = TrimEnclosingQuotes( string( AtomView( TopAtom( Expr->Children[ 1 ] ) ) ) );
+    const string Path = ResolveModulePath( Machine->ImportBase, Written );
+    // Held here, as running the module's forms can import more modules.
+    OModulePtr Module = Machine->Modules[ Path ];
+    if ( Module == nullptr ) {
+        // Two files with one stem would rename their names onto each other.
+        const string Namespace = ModuleNamespace( Path );
+        for ( const auto& [ LoadedPath, Loaded ] : Machine->Modules ) {
+            if ( Loaded != nullptr && Loaded->Namespace == Namespace ) {
+                Machine->Modules.erase( Path );
+                RaiseEvalError( Machine, "Module " + Path + " and the loaded module " + LoadedPath + " share the namespace " + Namespace + "." );
+                return;
+            }
+        }
+        Module = make_shared<OModule>();
+        string Error{};
+        if ( !LoadModule( Path, *Module, Error ) ) {
+            Machine->Modules.erase( Path );
+            RaiseEvalError( Machine, Error );
+            return;
+        }
+        Machine->Modules[ Path ] = Module;
+    }
+    // The importer's symbol and the module's, per listed name.
+    vector<pair<int, int>> Links{};
+    for ( int i = 2; i < Expr->Children.Length(); i++ ) {
+        const OToken& Token = TopAtom( Expr->Children[ i ] ).Token;
+        const size_t Dot = Token.Token.rfind( '.' );
+        const string Own = Module->Namespace + "." + ( Dot == string::npos ? Token.Token : Token.Token.substr( Dot + 1 ) );
+        const int Symbol = GSymbols.Find( Own );
+        if ( Symbol == INVALID_SYMBOL || !Module->Binders.count( Symbol ) ) {
+            RaiseEvalError( Machine, "Module " + Written + " does not bind " + Token.Token + "." );
+            return;
+        }
+        Links.emplace_back( TokenSymbol( Token, true ), Symbol );
+    }
+    vector<bool> Needed( Module->Forms.size(), false );
+    vector<int> Pending{};
+    const auto Need = [&Module, &Needed, &Pending]( const int Form ) {
+        if ( !Needed[ Form ] ) {
+            Needed[ Form ] = true;
+            Pending.insert( Pending.end(), Module->Forms[ Form ].Uses.begin(), Module->Forms[ Form ].Uses.end() );
+        }
+    };
+    for ( size_t k = 0; k < Module->Forms.size(); k++ ) {
+        if ( Links.empty() || Module->Forms[ k ].Defines.empty() ) {
+            Need( static_cast<int>( k ) );
+        }
+    }
+    for ( const auto& Link : Links ) {
+        Pending.push_back( Link.second );
+    }
+    unordered_set<int> Seen{};
+    while ( !Pending.empty() ) {
+        const int Name = Pending.back();
+        Pending.pop_back();
+        if ( !Seen.insert( Name ).second ) {
+            continue;
+        }
+        const auto Found = Module->Binders.find( Name );
+        if ( Found != Module->Binders.end() ) {
+            for ( const int Form : Found->second ) {
+                Need( Form );
+            }
+        }
+    }
+    const string ImporterBase = Machine->ImportBase;
+    Machine->ImportBase = ImportBaseOf( Path );
+    for ( size_t k = 0; k < Module->Forms.size() && !Machine->EvalError; k++ ) {
+        OModuleForm& Form = Module->Forms[ k ];
+        if ( Needed[ k ] && !Form.Ran ) {
+            Form.Ran = true;
+            EvalExpr( Machine, MaterializeAst( Module->Pool, Form.Node ), EEvalIntrinsicMode::Execute );
+        }
+    }
+    Machine->ImportBase = ImporterBase;
+    for ( const auto& [ Local, Own ] : Links ) {
+        uint64 ScanLength = 0;
+        const int Slot = Machine->Stack.Find( Own, ScanLength );
+        Machine->Stack.Set( Local, Slot >= 0 ? Machine->Stack.Slots[ Slot ].Value : Make_OExprPtr_Empty() );
+    }
+}
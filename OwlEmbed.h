@@ -0,0 +1,335 @@
+#pragma once
+
+// Embedding API. A host defines OWL_EMBEDDED and includes Owlisp.cpp in one
+// translation unit, then registers typed native functions and calls Owl
+// functions with typed arguments:
+//
+//     struct OVec2 { float X; float Y; };
+//     template<> struct OMarshal<OVec2> : OStructMarshal<OVec2> {
+//         static constexpr auto Fields = OwlFields( &OVec2::X, &OVec2::Y );
+//     };
+//
+//     OMachinePtr Machine = Make_OwlMachine();
+//     RegisterNative( Machine, "vec2", []( float X, float Y ) { return OVec2{ X, Y }; } );
+//     RunOwl( Machine, "(defunc Len2 V (+ (* (field V 0) (field V 0)) (* (field V 1) (field V 1))))" );
+//     const float Len2 = CallOwl<float>( Machine, "Len2", OVec2{ 3, 4 } );
+//
+// Marshalling is picked per parameter type at compile time, so a call does no
+// parsing or string building beyond what the value type itself needs.
+//
+// Eval errors set Machine->EvalError, make RunOwl return 1, and write their
+// message and backtrace to Machine->Err. Set Machine->Err.Sink to receive them
+// instead of stderr.
+
+#include <charconv>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Converts between a C++ type and an Owl value. Specialize it for host types.
+template<typename T>
+struct OMarshal;
+
+template<>
+struct OMarshal<int> {
+    static int FromOwl( const OExprPtr& Value ) {
+        return AtomToInt( TopAtom( Value ) );
+    }
+    static OExprPtr ToOwl( const int Value ) {
+        return Make_OExprPtr_Int( {}, Value );
+    }
+};
+
+template<>
+struct OMarshal<bool> {
+    static bool FromOwl( const OExprPtr& Value ) {
+        const string_view Text = AtomView( TopAtom( Value ) );
+        return !Text.empty() && Text != TOKEN_FALSE;
+    }
+    static OExprPtr ToOwl( const bool Value ) {
+        return Make_OExprPtr_Int( {}, Value ? 1 : 0 );
+    }
+};
+
+template<typename T>
+struct OFloatMarshal {
+    static T FromOwl( const OExprPtr& Value ) {
+        const OAtom& Atom = TopAtom( Value );
+        if ( IsIntAtom( Atom ) ) {
+            return static_cast<T>( Atom.PrimitiveData.Int );
+        }
+        return ParseTokenToPrimitive<T>( TrimEnclosingQuotesView( AtomView( Atom ) ) );
+    }
+    static OExprPtr ToOwl( const T Value ) {
+        char Buffer[ 32 ];
+        const auto Result = to_chars( Buffer, Buffer + sizeof( Buffer ), Value );
+        return Make_OExprPtr_Data( {}, string( Buffer, Result.ptr ) );
+    }
+};
+
+template<>
+struct OMarshal<float> : OFloatMarshal<float> {};
+
+template<>
+struct OMarshal<double> : OFloatMarshal<double> {};
+
+template<>
+struct OMarshal<string> {
+    static string FromOwl( const OExprPtr& Value ) {
+        return string( TrimEnclosingQuotesView( AtomView( TopAtom( Value ) ) ) );
+    }
+    static OExprPtr ToOwl( const string_view Value ) {
+        return Make_OExprPtr_Object( {}, Make_OStringBuilder( Value ) );
+    }
+};
+
+// Only valid for the duration of the native call that received it.
+template<>
+struct OMarshal<string_view> {
+    static string_view FromOwl( const OExprPtr& Value ) {
+        return TrimEnclosingQuotesView( AtomView( TopAtom( Value ) ) );
+    }
+    static OExprPtr ToOwl( const string_view Value ) {
+        return Make_OExprPtr_Object( {}, Make_OStringBuilder( Value ) );
+    }
+};
+
+template<>
+struct OMarshal<const char*> {
+    static OExprPtr ToOwl( const char* Value ) {
+        return Make_OExprPtr_Object( {}, Make_OStringBuilder( Value ) );
+    }
+};
+
+template<>
+struct OMarshal<OExprPtr> {
+    static OExprPtr FromOwl( const OExprPtr& Value ) {
+        return Value;
+    }
+    static OExprPtr ToOwl( const OExprPtr& Value ) {
+        return Value;
+    }
+};
+
+// Member pointers describing a struct, in field order.
+template<typename... M>
+constexpr auto OwlFields( M... Members ) {
+    return make_tuple( Members... );
+}
+
+template<typename C, typename F>
+F OwlMemberType( F C::* );
+
+// A native struct carried as an Owl value. (field Value N) reads member N.
+template<typename T>
+struct OStructValue : OTuple {
+    static constexpr auto& Fields = OMarshal<T>::Fields;
+    static constexpr int Count = static_cast<int>( tuple_size_v<remove_cvref_t<decltype( OMarshal<T>::Fields )>> );
+
+    T Value{};
+    mutable string Text{};
+
+    int FieldCount() const override {
+        return Count;
+    }
+
+    OExprPtr Field( const int N ) const override {
+        return FieldAt( N, make_index_sequence<Count>{} );
+    }
+
+    template<size_t... I>
+    OExprPtr FieldAt( const int N, index_sequence<I...> ) const {
+        OExprPtr Out{};
+        ( ( static_cast<int>( I ) == N ? ( Out = MarshalField<I>(), 0 ) : 0 ), ... );
+        return Out;
+    }
+
+    template<size_t I>
+    OExprPtr MarshalField() const {
+        using FieldType = decltype( OwlMemberType( get<I>( Fields ) ) );
+        return OMarshal<FieldType>::ToOwl( Value.*get<I>( Fields ) );
+    }
+
+    // Built on first use, since most struct values are never printed.
+    string_view View() const override {
+        if ( Text.empty() ) {
+            Text += '(';
+            for ( int i = 0; i < Count; i++ ) {
+                if ( i > 0 ) {
+                    Text += ' ';
+                }
+                Text += TrimEnclosingQuotesView( AtomView( TopAtom( Field( i ) ) ) );
+            }
+            Text += ')';
+        }
+        return Text;
+    }
+
+    OSequencePtr Fresh() const override {
+        shared_ptr<OStructValue> Copy = make_shared<OStructValue>();
+        Copy->Value = Value;
+        return Copy;
+    }
+};
+
+// Base for OMarshal<T> of a host struct. The specialization supplies Fields.
+// Any tuple value with enough fields, such as a record, converts as well.
+template<typename T>
+struct OStructMarshal {
+    static T FromOwl( const OExprPtr& Value ) {
+        const OObjectPtr& Object = TopAtom( Value ).Object;
+        if ( const auto Struct = dynamic_pointer_cast<OStructValue<T>>( Object ) ) {
+            return Struct->Value;
+        }
+        T Out{};
+        if ( const auto Tuple = dynamic_pointer_cast<OTuple>( Object ) ) {
+            if ( Tuple->FieldCount() >= OStructValue<T>::Count ) {
+                FromTuple( *Tuple, Out, make_index_sequence<OStructValue<T>::Count>{} );
+            }
+        }
+        return Out;
+    }
+
+    static OExprPtr ToOwl( const T& Value ) {
+        shared_ptr<OStructValue<T>> Struct = make_shared<OStructValue<T>>();
+        Struct->Value = Value;
+        return Make_OExprPtr_Object( {}, Struct );
+    }
+
+    template<size_t... I>
+    static void FromTuple( const OTuple& Tuple, T& Out, index_sequence<I...> ) {
+        const auto& Fields = OMarshal<T>::Fields;
+        ( ( Out.*get<I>( Fields ) = OMarshal<decltype( OwlMemberType( get<I>( Fields ) ) )>::FromOwl( Tuple.Field( I ) ) ), ... );
+    }
+};
+
+template<typename F>
+struct ONativeSignature : ONativeSignature<decltype( &F::operator() )> {};
+
+template<typename R, typename... A>
+struct ONativeSignature<R ( * )( A... )> {
+    using Return = R;
+    using Params = tuple<remove_cvref_t<A>...>;
+};
+
+template<typename C, typename R, typename... A>
+struct ONativeSignature<R ( C::* )( A... ) const> : ONativeSignature<R ( * )( A... )> {};
+
+template<typename C, typename R, typename... A>
+struct ONativeSignature<R ( C::* )( A... )> : ONativeSignature<R ( * )( A... )> {};
+
+template<typename R, typename F, typename... A, size_t... I>
+OExprPtr InvokeNative( F& Fn, const OArgs& Args, tuple<A...>*, index_sequence<I...> ) {
+    if constexpr ( is_void_v<R> ) {
+        Fn( OMarshal<A>::FromOwl( Args[ I ] )... );
+        return Make_OExprPtr_Empty();
+    } else {
+        return OMarshal<remove_cvref_t<R>>::ToOwl( Fn( OMarshal<A>::FromOwl( Args[ I ] )... ) );
+    }
+}
+
+// Makes Fn callable from Owl as (Name Args...). Arguments are evaluated first,
+// like the other strict intrinsics, and a wrong argument count is an eval error.
+// A registration replaces any intrinsic of the same name.
+template<typename F>
+void RegisterNative( OMachinePtr Machine, const string& Name, F Fn ) {
+    using Signature = ONativeSignature<F>;
+    using Params = typename Signature::Params;
+    constexpr int Arity = static_cast<int>( tuple_size_v<Params> );
+    OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+    Intrinsic->Token = Name;
+    Intrinsic->StrictFunction = [Name, Machine, Fn]( const OExprPtr Expr, const OArgs& Args ) mutable {
+        if ( Args.Length() != Arity ) {
+            RaiseEvalError( Machine, Name + " expects " + to_string( Arity ) + " arguments, got " + to_string( Args.Length() ) + "." );
+            return Make_OExprPtr_Empty();
+        }
+        return InvokeNative<typename Signature::Return>( Fn, Args, static_cast<Params*>( nullptr ), make_index_sequence<Arity>{} );
+    };
+    MakeStrict( Machine, Intrinsic );
+    for ( int i = 0; i < Machine->Intrinsics.Length(); i++ ) {
+        if ( Machine->Intrinsics[ i ]->Token == Name ) {
+            Machine->Intrinsics[ i ] = Intrinsic;
+            Machine->IndexedIntrinsics = -1;
+            return;
+        }
+    }
+    Machine->Intrinsics.Add( Intrinsic );
+}
+
+// Calls the Owl function bound to Name with already evaluated arguments.
+// Returns empty and raises an eval error if Name is not a function.
+OExprPtr CallOwlFunction( OMachinePtr Machine, const string& Name, const OExprPtr* Args, const int Count ) {
+    uint64 ScanLength = 0;
+    const int Symbol = GSymbols.Intern( Name );
+    const int Slot = Machine->Stack.Find( Symbol, ScanLength );
+    OClosurePtr Closure{};
+    const OExprPtr Function = Slot >= 0 ? CalleeOf( Machine->Stack.Slots[ Slot ].Value, Closure ) : nullptr;
+    if ( Function == nullptr ) {
+        RaiseEvalError( Machine, Name + " is not a function." );
+        return Make_OExprPtr_Empty();
+    }
+    GStats.Calls++;
+    if ( Machine->Profiler != nullptr ) {
+        const OAtom& FunctionName = TopAtom( Function );
+        Machine->Profiler->Enter( &*Function, FunctionName.Token.Token, FunctionName.Token.Line, false );
+    }
+    // Params are child [1, (N-2)], body is N-1. The arguments are bound directly
+    // rather than evaluated, since they are values already.
+    PushFrame( Machine );
+    for ( int i = 0; i < Count && i + 1 < Function->Children.Length() - 1; i++ ) {
+        Machine->Stack.Set( TokenSymbol( ParamAtom( Function->Children[ i + 1 ] ).Token, true ), Args[ i ] );
+    }
+    if ( Closure != nullptr ) {
+        BindCaptured( Machine, *Closure );
+    }
+    OExprPtr Out = TrySpecializedCall( Machine, Function );
+    if ( Out == nullptr ) {
+        Out = EvalExpr( Machine, Function->Children.Last(), EEvalIntrinsicMode::Execute );
+    }
+    PopFrame( Machine );
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Exit();
+    }
+    return Out;
+}
+
+// Typed form of CallOwlFunction. On an eval error the result is converted from
+// an empty value, so check Machine->EvalError when that matters.
+template<typename R, typename... A>
+R CallOwl( OMachinePtr Machine, const string& Name, const A&... Args ) {
+    const OExprPtr Values[ sizeof...( A ) + 1 ] = { OMarshal<remove_cvref_t<A>>::ToOwl( Args )..., nullptr };
+    Machine->EvalError = false;
+    const OExprPtr Out = CallOwlFunction( Machine, Name, Values, static_cast<int>( sizeof...( A ) ) );
+    if constexpr ( !is_void_v<R> ) {
+        return OMarshal<R>::FromOwl( Out );
+    }
+}
+
+// Runs Source in the machine's global frame, so its defuncs stay callable.
+// Returns 0, or 1 after an eval error, as a script run from the command line exits.
+int RunOwl( OMachinePtr Machine, const string& Source ) {
+    const OExprPtr Program = ParseProgram( Source, Machine->ParseThreads, Machine->HashCons );
+    Machine->EvalError = false;
+    if ( Program->Type != OExprType::Expr || !Program->Children.IsEmpty() ) {
+        Execute( Machine, Program );
+    }
+    Machine->Out.Flush();
+    return Machine->EvalError ? 1 : 0;
+}
+
+// A machine ready for RunOwl and CallOwl. The native stack guard covers the
+// creating thread's whole stack, so call into the machine from that thread.
+// Where the stack bounds are unknown, pass the address of a local in a frame
+// that outlives every call, such as the host's main.
+OMachinePtr Make_OwlMachine( const char* StackBase = nullptr ) {
+    OMachinePtr Machine = Make_OMachinePtr();
+    ResetMachine( Machine );
+    if ( StackBase != nullptr ) {
+        InitNativeStackGuard( Machine, StackBase );
+    } else if ( !InitThreadStackGuard( Machine ) ) {
+        // Close to the caller's frame, which is the best guess left.
+        const char Here{};
+        InitNativeStackGuard( Machine, &Here );
+    }
+    return Machine;
+}
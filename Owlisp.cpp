@@ -1,66 +1,194 @@
 #define MANAGE_EXPR_MEM 1
 #define PRINT_TOKENS 0
-#define PRINT_EVAL 0
 
 #include "Owlisp.h"
+#include "Sequences.h"
+#include "Persistent.h"
+#include "HashMap.h"
+#include "Sort.h"
+#include "Specialize.h"
+#include "Parse.h"
+#include "OwlEmbed.h"
+#include "Batch.h"
+#include "Serve.h"
+#include "Watch.h"
+#include "Module.h"
 #include <iostream>
 #include <math.h> 
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
 
+// Hosts embedding the interpreter define OWL_EMBEDDED and provide their own main.
+#ifndef OWL_EMBEDDED
 int main( int argc, char* argv[] ) {
     OMachinePtr Machine = Make_OMachinePtr();
     ResetMachine( Machine );
-    if ( argc > 1 ) {
-        const string arg1{ argv[ 1 ] };
-        if ( arg1 == "-i" ) {
-            InterpreterLoop( Machine );
-            return 0;
-        }
-        // Compile the file arg1
-        auto InputRet = ReadFileIntoString( arg1 );
+    const char StackBase{};
+    InitNativeStackGuard( Machine, &StackBase );
+    bool Interactive = false;
+    bool Watching = false;
+    string FileName{};
+    string ServePath{};
+    string ClientPath{};
+    string PreludePath{};
+    int Workers = SERVE_DEFAULT_WORKERS;
+    int ClientTimeout = SERVE_CLIENT_TIMEOUT_SEC;
+    for ( int i = 1; i < argc; i++ ) {
+        const string Arg{ argv[ i ] };
+        if ( Arg == "-i" ) {
+            Interactive = true;
+        } else if ( Arg == "--watch" ) {
+            Watching = true;
+        } else if ( Arg == "--unbuffered" ) {
+            Machine->Out.Unbuffered = true;
+        } else if ( Arg == "--trace" || Arg.rfind( "--trace=", 0 ) == 0 ) {
+            if ( Arg.rfind( "--trace=", 0 ) == 0 ) {
+                GTracer.DumpPath = Arg.substr( strlen( "--trace=" ) );
+            }
+            Machine->DumpTraceOnExit = true;
+            TraceEnable( true );
+        } else if ( Arg == "--stats" ) {
+            Machine->PrintStats = true;
+            GStats.TimeLookups = true;
+        } else if ( Arg == "--engine=stack" ) {
+            Machine->Engine = EEvalEngine::Stack;
+        } else if ( Arg == "--engine=recursive" ) {
+            Machine->Engine = EEvalEngine::Recursive;
+        } else if ( Arg.rfind( "--eval-budget=", 0 ) == 0 ) {
+            Machine->EvalBudgetBytes = static_cast<size_t>( ParseTokenToPrimitive<int>( string_view( Arg ).substr( strlen( "--eval-budget=" ) ) ) ) << 20;
+        } else if ( Arg.rfind( "--serve=", 0 ) == 0 ) {
+            ServePath = Arg.substr( strlen( "--serve=" ) );
+        } else if ( Arg.rfind( "--client=", 0 ) == 0 ) {
+            ClientPath = Arg.substr( strlen( "--client=" ) );
+        } else if ( Arg.rfind( "--timeout=", 0 ) == 0 ) {
+            ClientTimeout = ParseTokenToPrimitive<int>( string_view( Arg ).substr( strlen( "--timeout=" ) ) );
+        } else if ( Arg.rfind( "--prelude=", 0 ) == 0 ) {
+            PreludePath = Arg.substr( strlen( "--prelude=" ) );
+        } else if ( Arg.rfind( "--workers=", 0 ) == 0 ) {
+            Workers = ParseTokenToPrimitive<int>( string_view( Arg ).substr( strlen( "--workers=" ) ) );
+        } else if ( Arg.rfind( "--parse-threads=", 0 ) == 0 ) {
+            Machine->ParseThreads = ParseTokenToPrimitive<int>( string_view( Arg ).substr( strlen( "--parse-threads=" ) ) );
+        } else if ( Arg == "--hash-cons" ) {
+            Machine->HashCons = true;
+        } else if ( Arg == "--no-specialize" ) {
+            Machine->Specialize = false;
+        } else if ( Arg == "--bench" ) {
+            Machine->Bench.Enabled = true;
+        } else if ( Arg == "--profile" || Arg.rfind( "--profile=", 0 ) == 0 ) {
+            Machine->Profiler = make_shared<OProfiler>();
+            if ( Arg.rfind( "--profile=", 0 ) == 0 ) {
+                Machine->Profiler->OutputBase = Arg.substr( strlen( "--profile=" ) );
+            }
+        } else {
+            FileName = Arg;
+        }
+    }
+    if ( !ClientPath.empty() ) {
+        auto InputRet = FileName.empty() ? Return<string, string>{ string( std::istreambuf_iterator<char>( std::cin ), {} ) } : ReadFileIntoString( FileName );
         if ( InputRet.ErrorOccured ) {
             std::cerr << InputRet.Error << std::endl;
             return 1;
         }
-        const TokenList Tokens = Tokenize( InputRet.Out );
-        const OExprPtr Program = ConstructRootExpr( Tokens );
-        Execute( Machine, Program );
+        return RunClient( ClientPath, InputRet.Out, ClientTimeout );
+    }
+    if ( !PreludePath.empty() ) {
+        Machine->ImportBase = ImportBaseOf( PreludePath );
+        auto PreludeRet = ReadFileIntoString( PreludePath );
+        if ( PreludeRet.ErrorOccured ) {
+            std::cerr << PreludeRet.Error << std::endl;
+            return 1;
+        }
+        if ( RunOwl( Machine, PreludeRet.Out ) != 0 ) {
+            return 1;
+        }
+    }
+    Machine->ImportBase = ImportBaseOf( FileName );
+    if ( !ServePath.empty() ) {
+        return Serve( Machine, ServePath, Workers );
+    }
+    if ( Interactive ) {
+        InterpreterLoop( Machine );
+        Shutdown( Machine );
         return 0;
     }
+    if ( Watching && !FileName.empty() ) {
+        return Watch( Machine, FileName );
+    }
+    if ( !FileName.empty() ) {
+        // Compile the file
+        auto InputRet = ReadFileIntoString( FileName );
+        if ( InputRet.ErrorOccured ) {
+            std::cerr << InputRet.Error << std::endl;
+            return 1;
+        }
+        const OExprPtr Program = ParseProgram( InputRet.Out, Machine->ParseThreads, Machine->HashCons, &Machine->Bench );
+        const uint64 StartNs = NowNs();
+        Execute( Machine, Program );
+        Machine->Bench.ExecuteNs = NowNs() - StartNs;
+        Shutdown( Machine );
+        return Machine->EvalError ? 1 : 0;
+    }
     std::cerr << "Please use -i for interpreter or a filename to run." << std::endl;
+    std::cerr << "Options: --serve=Socket [--workers=N], --client=Socket [--timeout=Seconds] [File], --prelude=File, --watch File, --unbuffered, --engine=stack|recursive, --eval-budget=MB, --parse-threads=N, --hash-cons, --no-specialize, --profile[=OutputBase], --bench, --stats, --trace[=DumpFile]" << std::endl;
     return 1;
 }
+#endif
 
-OExprPtr Make_OExprPtr_Empty() {
+OExprPtr Alloc_OExprPtr( const OExprType Type, const EAllocSite Site ) {
+    GStats.Allocations[ static_cast<int>( Site ) ]++;
     OExprPtr Ptr = OExprPtr( new OExpr{} );
     assert( Ptr != nullptr );
-    Ptr->Type = OExprType::Expr;
+    Ptr->Type = Type;
     return Ptr;
 }
 
+OExprPtr Make_OExprPtr_Empty() {
+    return Alloc_OExprPtr( OExprType::Expr, EAllocSite::Empty );
+}
+
 OExprPtr Make_OExprPtr( const OExprType Type ) {
-    OExprPtr Ptr = OExprPtr( new OExpr{} );
-    assert( Ptr != nullptr );
-    Ptr->Type = Type;
-    return Ptr;
+    return Alloc_OExprPtr( Type, EAllocSite::Typed );
 }
 
 OExprPtr Make_OExprPtr_Data( const OToken& Token ) {
-    OExprPtr AtomExpr = Make_OExprPtr( OExprType::Data );
+    OExprPtr AtomExpr = Alloc_OExprPtr( OExprType::Data, EAllocSite::DataToken );
     AtomExpr->Atom.Token = Token;
+    // Integer literals are unboxed once here rather than parsed at every use.
+    if ( ParseIntLiteral( Token.Token, AtomExpr->Atom.PrimitiveData.Int ) ) {
+        AtomExpr->Atom.PrimitiveType = OAtomDataPrimitiveType::Int;
+    }
     return AtomExpr;
 }
 
 OExprPtr Make_OExprPtr_Data( const OAtom& Atom, const string& Str ) {
-    OExprPtr AtomExpr = Make_OExprPtr( OExprType::Data );
+    OExprPtr AtomExpr = Alloc_OExprPtr( OExprType::Data, EAllocSite::DataAtom );
     AtomExpr->Atom.Token = Make_OToken( Atom, Str );
     return AtomExpr;
 }
 
+OExprPtr Make_OExprPtr_Object( const OAtom& Atom, const OObjectPtr& Object ) {
+    OExprPtr AtomExpr = Alloc_OExprPtr( OExprType::Data, EAllocSite::Object );
+    AtomExpr->Atom.Token = Make_OToken( Atom, {} );
+    AtomExpr->Atom.Object = Object;
+    return AtomExpr;
+}
+
+OExprPtr Make_OExprPtr_Int( const OAtom& Atom, const int Value ) {
+    OExprPtr AtomExpr = Alloc_OExprPtr( OExprType::Data, EAllocSite::Int );
+    AtomExpr->Atom.Token.Line = Atom.Token.Line;
+    AtomExpr->Atom.Token.Indent = Atom.Token.Indent;
+    SetAtomInt( AtomExpr->Atom, Value );
+    return AtomExpr;
+}
+
 OExprPtr Make_OExprPtr_DataExprCap( bool StartCap ) {
     return Make_OExprPtr_Data( Make_OToken( StartCap ? ExpStart : ExpEnd ) );
 }
 
 OIntrinsicPtr Make_OIntriniscPtr( const OExprType Type ) {
+    GStats.Allocations[ static_cast<int>( EAllocSite::Intrinsic ) ]++;
     OIntrinsicPtr Ptr = OIntrinsicPtr( new OIntrinsic{} );
     assert( Ptr != nullptr );
     Ptr->Type = Type;
@@ -68,11 +196,75 @@ OIntrinsicPtr Make_OIntriniscPtr( const OExprType Type ) {
 }
 
 OMachinePtr Make_OMachinePtr() {
+    GStats.Allocations[ static_cast<int>( EAllocSite::Machine ) ]++;
     OMachinePtr Ptr = OMachinePtr( new OMachine{} );
     assert( Ptr != nullptr );
     return Ptr;
 }
 
+void PushFrame( OMachinePtr Machine ) {
+    Machine->Stack.Push();
+    GStats.FramesPushed++;
+    if ( static_cast<uint64>( Machine->Stack.Depth() ) > GStats.PeakStackDepth ) {
+        GStats.PeakStackDepth = Machine->Stack.Depth();
+    }
+}
+
+void PopFrame( OMachinePtr Machine ) {
+    Machine->Stack.Pop();
+}
+
+void InitNativeStackGuard( OMachinePtr Machine, const char* StackBase ) {
+#if defined(_WIN32)
+    const size_t Size = NATIVE_STACK_WINDOWS_SIZE;
+#else
+    rlimit Limit{};
+    size_t Size = NATIVE_STACK_DEFAULT_SIZE;
+    if ( getrlimit( RLIMIT_STACK, &Limit ) == 0 && Limit.rlim_cur != RLIM_INFINITY ) {
+        Size = Limit.rlim_cur;
+    }
+#endif
+    Machine->NativeStackBase = StackBase;
+    Machine->NativeStackLimit = Size > NATIVE_STACK_MARGIN * 2 ? Size - NATIVE_STACK_MARGIN : Size / 2;
+}
+
+bool InitThreadStackGuard( OMachinePtr Machine ) {
+    char* Top = nullptr;
+    size_t Size = 0;
+#if defined(__APPLE__)
+    Top = static_cast<char*>( pthread_get_stackaddr_np( pthread_self() ) );
+    Size = pthread_get_stacksize_np( pthread_self() );
+#elif defined(__linux__)
+    pthread_attr_t Attr{};
+    if ( pthread_getattr_np( pthread_self(), &Attr ) != 0 ) {
+        return false;
+    }
+    void* Low = nullptr;
+    if ( pthread_attr_getstack( &Attr, &Low, &Size ) == 0 ) {
+        Top = static_cast<char*>( Low ) + Size;
+    }
+    pthread_attr_destroy( &Attr );
+#endif
+    if ( Top == nullptr || Size == 0 ) {
+        return false;
+    }
+    Machine->NativeStackBase = Top;
+    Machine->NativeStackLimit = Size > NATIVE_STACK_MARGIN * 2 ? Size - NATIVE_STACK_MARGIN : Size / 2;
+    return true;
+}
+
+size_t NativeStackUsed( const OMachinePtr Machine ) {
+    if ( Machine->NativeStackBase == nullptr ) {
+        return 0;
+    }
+    const char Marker{};
+    return Machine->NativeStackBase > &Marker ? Machine->NativeStackBase - &Marker : &Marker - Machine->NativeStackBase;
+}
+
+bool NativeStackExhausted( const OMachinePtr Machine ) {
+    return NativeStackUsed( Machine ) > Machine->NativeStackLimit;
+}
+
 OToken Make_OToken( const OAtom& Atom, const string& Str ) {
     return {Atom.Token.Line, Atom.Token.Indent, Str };
 }
@@ -89,6 +281,23 @@ OExprPtr ToOExpr_SingleNoEval( const TokenList& Tokens ) {
     return Expr;
 }
 
+// Strict intrinsics are run by the Stack engine with their arguments already evaluated.
+// Function evaluates them itself for the Recursive engine and native callers.
+void MakeStrict( OMachinePtr Machine, OIntrinsicPtr Intrinsic ) {
+    Intrinsic->Form = EIntrinsicForm::Strict;
+    const StrictIntrinsicFunction StrictFunction = Intrinsic->StrictFunction;
+    Intrinsic->Function = [StrictFunction, Machine]( const OExprPtr Expr ) {
+        OExprList& Args = Machine->Eval.Args;
+        const int ArgBase = Args.Length();
+        for ( int i = 1; i < Expr->Children.Length(); i++ ) {
+            Args.Add( EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute ) );
+        }
+        OExprPtr Out = StrictFunction( Expr, OArgs{ Args.Arr.data() + ArgBase, Args.Length() - ArgBase } );
+        Args.Arr.resize( ArgBase );
+        return Out;
+    };
+}
+
 void BuildIntrinsics( OMachinePtr Machine ) {
     { // Empty Intrinsic
         Machine->EmptyIntrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
@@ -114,7 +323,11 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token== Token_Print );
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
-                cout << FilterRawStringForPrinting( EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token);
+                OExprPtr Result = EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute );
+                if ( Machine->EvalError ) {
+                    break;
+                }
+                Machine->Out.Write( TrimEnclosingQuotesView( AtomView( Result->Atom ) ) );
             }
             return Make_OExprPtr_Empty();
         };
@@ -129,11 +342,70 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             assert( Expr->Children[ 0 ]->Atom.Token.Token== Token_Print );
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
                 OExprPtr Result = EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute );
-                cout << FilterRawStringForPrinting( Result->Atom.Token.Token) << endl;
+                if ( Machine->EvalError ) {
+                    break;
+                }
+                Machine->Out.Write( TrimEnclosingQuotesView( AtomView( Result->Atom ) ) );
+                Machine->Out.Write( '\n' );
             }
             if ( Expr->Children.Length() == 1 ) {
-                cout << endl;
+                Machine->Out.Write( '\n' );
+            }
+            return Make_OExprPtr_Empty();
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // stats
+        const string Token_Stats = "stats";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Stats;
+        Intrinsic->Function = [Token_Stats, Machine]( const OExprPtr Expr ) {
+            Machine->Out.Write( GStats.ToString() );
+            return Make_OExprPtr_Empty();
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // trace (trace 1) starts recording into the trace ring, (trace 0) stops.
+        const string Token_Trace = "trace";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Trace;
+        Intrinsic->StrictFunction = [Token_Trace]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Expr->Children.Length() == 2 );
+            TraceEnable( AtomView( Args[ 0 ]->Atom ) != TOKEN_FALSE );
+            return Make_OExprPtr_Empty();
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // tracedump (tracedump) or (tracedump `path`)
+        const string Token_TraceDump = "tracedump";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_TraceDump;
+        Intrinsic->Function = [Token_TraceDump, Machine]( const OExprPtr Expr ) {
+            string Path = GTracer.DumpPath;
+            if ( Expr->Children.Length() > 1 ) {
+                Path = string( TrimEnclosingQuotesView( AtomView( EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute )->Atom ) ) );
             }
+            return Make_OExprPtr_Data( TopAtom( Expr ), TraceDump( Path.c_str() ) ? TOKEN_TRUE : TOKEN_FALSE );
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // flush
+        const string Token_Flush = "flush";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Flush;
+        Intrinsic->Function = [Token_Flush, Machine]( const OExprPtr Expr ) {
+            Machine->Out.Flush();
+            return Make_OExprPtr_Empty();
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // backtrace (backtrace) prints the defunc calls in progress.
+        const string Token_Backtrace = "backtrace";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Backtrace;
+        Intrinsic->Function = [Token_Backtrace, Machine]( const OExprPtr Expr ) {
+            PrintBacktrace( Machine, -1, Machine->Out );
             return Make_OExprPtr_Empty();
         };
         Machine->Intrinsics.Add( Intrinsic );
@@ -142,35 +414,29 @@ void BuildIntrinsics( OMachinePtr Machine ) {
         const string Token_Addition = "+";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Addition;
-        Intrinsic->Function = [Token_Addition, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Addition]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token== Token_Addition );
             int sum = 0;
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
-                sum += ParseTokenToPrimitive<int>( EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token);
+                sum += AtomToInt( Args[ i - 1 ]->Atom );
             }
-            OExprPtr Result = Make_OExprPtr( OExprType::Data );
-            stringstream SS{};
-            SS << sum;
-            Result->Atom.Token = Make_OToken( Expr->Children[ 0 ]->Atom, SS.str() );
-            return Result;
+            return Make_OExprPtr_Int( Expr->Children[ 0 ]->Atom, sum );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // -
         const string Token_Sub = "-";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Sub;
-        Intrinsic->Function = [Token_Sub, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Sub]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_Sub );
             int sum = 0;
             bool set = false;
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
-                stringstream Stream;
-                Stream << EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
-                int a = 0;
-                Stream >> a;
+                const int a = AtomToInt( Args[ i - 1 ]->Atom );
                 if ( set ) {
                     sum -= a;
                 } else {
@@ -178,26 +444,23 @@ void BuildIntrinsics( OMachinePtr Machine ) {
                     sum = a;
                 }
             }
-            OExprPtr Result = Make_OExprPtr( OExprType::Data );
-            stringstream SS{};
-            SS << sum;
-            Result->Atom.Token = Make_OToken( SS.str() );
-            return Result;
+            return Make_OExprPtr_Int( {}, sum );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // * Multiplication
         const string Token_Mul = "*";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Mul;
-        Intrinsic->Function = [Token_Mul, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Mul]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_Mul );
             float sum = 0;
             bool set = false;
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
                 stringstream Stream;
-                Stream << EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+                Stream << AtomView( Args[ i - 1 ]->Atom );
                 float a = 0;
                 Stream >> a;
                 if ( set ) {
@@ -213,17 +476,18 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             Result->Atom.Token = Make_OToken( SS.str() );
             return Result;
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // sqrt
         const string Token_Sqrt = "sqrt";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Sqrt;
-        Intrinsic->Function = [Token_Sqrt, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Sqrt]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() == 2 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_Sqrt );
             stringstream Stream;
-            Stream << EvalExpr( Machine, Expr->Children[ 1 ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+            Stream << AtomView( Args[ 0 ]->Atom );
             float a = 0;
             Stream >> a;
             OExprPtr Result = Make_OExprPtr( OExprType::Data );
@@ -232,20 +496,21 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             Result->Atom.Token = Make_OToken( SS.str() );
             return Result;
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // / Floating Point Division
         const string Token_Div = "/";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Div;
-        Intrinsic->Function = [Token_Div, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Div]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_Div );
             float sum = 1;
             bool set = false;
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
                 stringstream Stream;
-                Stream << EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+                Stream << AtomView( Args[ i - 1 ]->Atom );
                 float a = 0;
                 Stream >> a;
                 if ( set ) {
@@ -264,20 +529,21 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             Result->Atom.Token = Make_OToken( SS.str() );
             return Result;
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // // Integer Division
         const string Token_IDiv = "//";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_IDiv;
-        Intrinsic->Function = [Token_IDiv, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_IDiv]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() > 0 );
             assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_IDiv );
             int sum = 1;
             bool set = false;
             for ( int i = 1; i < Expr->Children.Length(); i++ ) {
                 stringstream Stream;
-                Stream << EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+                Stream << AtomView( Args[ i - 1 ]->Atom );
                 int a = 0;
                 Stream >> a;
                 if ( set ) {
@@ -290,38 +556,31 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             if ( !set ) {
                 sum = 0;
             }
-            OExprPtr Result = Make_OExprPtr( OExprType::Data );
-            stringstream SS{};
-            SS << sum;
-            Result->Atom.Token = Make_OToken( SS.str() );
-            return Result;
+            return Make_OExprPtr_Int( {}, sum );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // // Integer Modulo
         const string Token_IMod = "modi";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_IMod;
-        Intrinsic->Function = [Token_IMod, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_IMod]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() == 3 );
 
             stringstream SS{};
-            SS << EvalExpr( Machine, Expr->Children[ 1 ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+            SS << AtomView( Args[ 0 ]->Atom );
             int I = 0;
             SS >> I;
 
             SS = {};
-            SS << EvalExpr( Machine, Expr->Children[ 2 ], EEvalIntrinsicMode::Execute )->Atom.Token.Token;
+            SS << AtomView( Args[ 1 ]->Atom );
             int M = 0;
             SS >> M;
 
-            int ResultI = ( I % M );
-            OExprPtr Result = Make_OExprPtr( OExprType::Data );
-            SS = {};
-            SS << ResultI;
-            Result->Atom.Token = Make_OToken( SS.str() );
-            return Result;
+            return Make_OExprPtr_Int( {}, I % M );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // Set
@@ -332,20 +591,11 @@ void BuildIntrinsics( OMachinePtr Machine ) {
             const int KeyIndex = 1;
             assert( Expr->Children[ 0 ]->Atom.Token.Token== Token_Set );
             assert( Expr->Children.Length() == KeyIndex + 2 );
-            OExprPtr NewExpr = Make_OExprPtr( OExprType::Expr );
-            NewExpr->Children.Add( Expr->Children[ KeyIndex ] );
-            NewExpr->Children.Add( EvalExpr( Machine, Expr->Children[ KeyIndex + 1 ], EEvalIntrinsicMode::Execute ) );
-            Machine->Stack.PeekStack().SetOrAdd( NewExpr, [&]( const OExprPtr& ExistingExpr ) {
-                if ( ExistingExpr->Children.Length() == 2 ) {
-                    if ( ExistingExpr->Children[ 0 ]->Atom.Token.Token== NewExpr->Children[ 0 ]->Atom.Token.Token) {
-                        return true;
-                    }
-                }
-                return false;
-            } );
-
-            return NewExpr;
+            const int Symbol = TokenSymbol( TopAtom( Expr->Children[ KeyIndex ] ).Token, true );
+            Machine->Stack.Set( Symbol, EvalExpr( Machine, Expr->Children[ KeyIndex + 1 ], EEvalIntrinsicMode::Execute ) );
+            return Make_OExprPtr_Empty();
         };
+        Intrinsic->Form = EIntrinsicForm::Set;
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // defunc
@@ -363,19 +613,34 @@ void BuildIntrinsics( OMachinePtr Machine ) {
                 NewExpr->Children.Add( Expr->Children[ i ] ); // EvalExpr( Machine, Expr->Children[ i ], EEvalIntrinsicMode::NoExecute ) );
             }
             NewExpr->Children.Add( Expr->Children.Last() );// EvalExpr( Machine, Expr->Children.Last(), EEvalIntrinsicMode::NoExecute ) );
-            Machine->Stack.PeekStack().SetOrAdd( NewExpr, [&]( const OExprPtr& ExistingExpr ) {
-                if ( ExistingExpr->Type == OExprType::ExprFunc ) {
-                    if ( ExistingExpr->Children[ 0 ]->Atom.Token.Token== NewExpr->Children[ 0 ]->Atom.Token.Token) {
-                        return true;
-                    }
-                }
-                return false;
-            } );
+            Machine->Stack.Set( TokenSymbol( TopAtom( NewExpr ).Token, true ), NewExpr );
 
             return NewExpr;
         };
         Machine->Intrinsics.Add( Intrinsic );
     }
+    { // import Module
+        const string Token_Import = TOKEN_IMPORT;
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Import;
+        Intrinsic->Function = [Machine]( const OExprPtr Expr ) {
+            ImportModule( Machine, Expr );
+            return Make_OExprPtr_Empty();
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // fn Closure
+        const string Token_Fn = "fn";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Fn;
+        Intrinsic->Function = [Token_Fn, Machine]( const OExprPtr Expr ) {
+            assert( Expr->Children.Length() >= 2 ); // fn Param* Body
+            assert( Expr->Children[ 0 ]->Atom.Token.Token == Token_Fn );
+            const OExprPtr Function = LambdaFunction( Expr, Expr->Children[ 0 ], 1 );
+            return Make_OExprPtr_Object( Expr->Atom, Make_OClosure( Machine, Function ) );
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
     { // ? Pick branch
         const string Token_BranchPick = "?";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
@@ -383,7 +648,7 @@ void BuildIntrinsics( OMachinePtr Machine ) {
         Intrinsic->Function = [Token_BranchPick, Machine]( const OExprPtr Expr ) {
             assert( Expr->Children.Length() >= 3 ); //
             auto Res = EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute );
-            if ( Res->Atom.Token.Token == "0" ) {
+            if ( AtomView( Res->Atom ) == TOKEN_FALSE ) {
                 if ( Expr->Children.Length() > 3 ) {
                     return EvalExpr( Machine, Expr->Get( 3 ), EEvalIntrinsicMode::Execute );
                 } else {
@@ -393,98 +658,171 @@ void BuildIntrinsics( OMachinePtr Machine ) {
                 return EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute );
             }
         };
+        Intrinsic->Form = EIntrinsicForm::Branch;
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // ==
         const string Token_Equality = "==";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Equality;
-        Intrinsic->Function = [Token_Equality, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Equality]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() == 3 );
-            OExprPtr LHS = EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute );
-            OExprPtr RHS = EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute );
-            return Make_OExprPtr_Data( Expr->Atom, TopAtom( LHS ).Token.Token == TopAtom( RHS ).Token.Token ? TOKEN_TRUE : TOKEN_FALSE );
+            const OExprPtr& LHS = Args[ 0 ];
+            const OExprPtr& RHS = Args[ 1 ];
+            // Shared constants, see --hash-cons, are equal without looking at their text.
+            if ( LHS == RHS ) {
+                return Make_OExprPtr_Int( Expr->Atom, 1 );
+            }
+            if ( IsIntAtom( TopAtom( LHS ) ) && IsIntAtom( TopAtom( RHS ) ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, TopAtom( LHS ).PrimitiveData.Int == TopAtom( RHS ).PrimitiveData.Int );
+            }
+            return Make_OExprPtr_Int( Expr->Atom, AtomsEqual( TopAtom( LHS ), TopAtom( RHS ) ) );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // <
         const string Token_LessThan = "<";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_LessThan;
-        Intrinsic->Function = [Token_LessThan, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_LessThan]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() == 3 );
-            OExprPtr LHS = EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute );
-            OExprPtr RHS = EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute );
-            return Make_OExprPtr_Data( Expr->Atom, ( CompareTo( TopAtom( LHS ).Token.Token, TopAtom( RHS ).Token.Token ) < 0 ) ? TOKEN_TRUE : TOKEN_FALSE );
+            const OExprPtr& LHS = Args[ 0 ];
+            const OExprPtr& RHS = Args[ 1 ];
+            int L = 0;
+            int R = 0;
+            if ( AtomIntValue( TopAtom( LHS ), L ) && AtomIntValue( TopAtom( RHS ), R ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, L < R );
+            }
+            return Make_OExprPtr_Int( Expr->Atom, CompareTo( AtomView( TopAtom( LHS ) ), AtomView( TopAtom( RHS ) ) ) < 0 );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
     { // >
         const string Token_GreaterThan = ">";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_GreaterThan;
-        Intrinsic->Function = [Token_GreaterThan, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_GreaterThan]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() == 3 );
-            OExprPtr LHS = EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute );
-            OExprPtr RHS = EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute );
-            return Make_OExprPtr_Data( Expr->Atom, ( CompareTo( TopAtom( LHS ).Token.Token, TopAtom( RHS ).Token.Token ) > 0 ) ? TOKEN_TRUE : TOKEN_FALSE );
+            const OExprPtr& LHS = Args[ 0 ];
+            const OExprPtr& RHS = Args[ 1 ];
+            int L = 0;
+            int R = 0;
+            if ( AtomIntValue( TopAtom( LHS ), L ) && AtomIntValue( TopAtom( RHS ), R ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, L > R );
+            }
+            return Make_OExprPtr_Int( Expr->Atom, CompareTo( AtomView( TopAtom( LHS ) ), AtomView( TopAtom( RHS ) ) ) > 0 );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
-    { //join
+    { // strjoin
         const string Token_StrJoin = "strjoin";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_StrJoin;
         Intrinsic->Function = [Token_StrJoin, Machine]( const OExprPtr Expr ) {
             assert( Expr->Children.Length() == 3 );
-            stringstream OutStream{};
-            const string Delim = FilterRawStringForPrinting( TopAtom( EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute ) ).Token.Token );
+            const OExprPtr DelimExpr = EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute );
+            const string Delim{ TrimEnclosingQuotesView( AtomView( TopAtom( DelimExpr ) ) ) };
             const auto Child = EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::TopExpr );
-            for ( int i = 0; i < Child->Children.Length(); i++ ) {
-                OutStream << FilterRawStringForPrinting( TopAtom( EvalExpr( Machine, Child->Children[ i ], EEvalIntrinsicMode::Execute ) ).Token.Token );
-                if ( i != ( Child->Children.Length() - 1 ) ) {
-                    OutStream << Delim;
+            OStringBuilderPtr Builder = Make_OStringBuilder( {} );
+            string& Buffer = *Builder->Buffer;
+            OSequenceCursor Cursor = Make_OSequenceCursor( Child );
+            OExprPtr Element{};
+            for ( int i = 0; Cursor.Next( Element ) && !Machine->EvalError; i++ ) {
+                if ( i != 0 ) {
+                    Buffer.append( Delim );
+                }
+                // Sequence values are already evaluated.
+                if ( !Cursor.IsLazy() ) {
+                    Element = EvalExpr( Machine, Element, EEvalIntrinsicMode::Execute );
                 }
+                Buffer.append( TrimEnclosingQuotesView( AtomView( TopAtom( Element ) ) ) );
+            }
+            Builder->Length = Buffer.size();
+            return Make_OExprPtr_Object( Expr->Atom, Builder );
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // strcat (strcat A B ...) Appends onto A without copying it when A is the newest string built from its buffer.
+        const string Token_StrCat = "strcat";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_StrCat;
+        Intrinsic->StrictFunction = [Token_StrCat]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Expr->Children.Length() >= 2 );
+            const OExprPtr& First = Args[ 0 ];
+            OStringBuilderPtr Builder = dynamic_pointer_cast<OStringBuilder>( TopAtom( First ).Object );
+            if ( Builder == nullptr ) {
+                Builder = Make_OStringBuilder( TrimEnclosingQuotesView( AtomView( TopAtom( First ) ) ) );
+            }
+            for ( int i = 2; i < Expr->Children.Length(); i++ ) {
+                const OExprPtr& Next = Args[ i - 1 ];
+                Builder = StringBuilderAppend( Builder, TrimEnclosingQuotesView( AtomView( TopAtom( Next ) ) ) );
             }
-            OExprPtr RHS = EvalExpr( Machine, Expr->Get( 2 ), EEvalIntrinsicMode::Execute );
-            return Make_OExprPtr_Data( Expr->Atom, OutStream.str() );
+            return Make_OExprPtr_Object( Expr->Atom, Builder );
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
-    { // map
+    { // map (map F List) is computed eagerly. Over a lazy sequence it returns a lazy sequence.
         const string Token_Map = "map";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Map;
         Intrinsic->Function = [Token_Map, Machine]( const OExprPtr Expr ) {
             assert( Expr->Children.Length() == 3 );
             // 0: Name, 1: mapfunc, 2: (array)
-            // Goal, build 2-node tuples of each. A zip of func and data, then execute.
-            if ( Expr->Get( 1 )->Children.Length() == 2 ) {
-                Machine->Stack.PushStack();
-                OExprPtr Func = Make_OExprPtr( OExprType::ExprFunc );
-                const string MapFuncName = "_MapFunc";
-                Func->Children.Add( Make_OExprPtr_Data(Expr->Atom, MapFuncName ) );
-                Func->Children.Add( Expr->Get( 1 )->Children[ 0 ] );
-                Func->Children.Add( Expr->Get( 1 )->Children[ 1 ] );
-                OExprPtr Out = Make_OExprPtr( OExprType::Expr );
-                for ( int i = 0; i < Expr->Get( 2 )->Children.Length(); i++ ) {
-                    OExprPtr NamedFunc = Make_OExprPtr( OExprType::Expr );
-                    NamedFunc->Children.Add( Make_OExprPtr_Data( Expr->Atom, MapFuncName ) );
-                    NamedFunc->Children.Add( Expr->Get( 2 )->Children[ i ] );
-                    Out->Children.Add( EvalNamedFunction( Machine, NamedFunc, Func, EEvalIntrinsicMode::Execute ) );
+            OSequenceCursor Source = Make_OSequenceCursor( Machine, Expr->Get( 2 ) );
+            OApplier Applier = Make_OApplier( Machine, Expr, 1 );
+            if ( Source.IsLazy() ) {
+                shared_ptr<OMapSequence> Sequence = make_shared<OMapSequence>();
+                Sequence->Source = Source;
+                Sequence->Applier = Applier;
+                return Make_OExprPtr_Object( Expr->Atom, Sequence );
+            }
+            OExprPtr Out = Make_OExprPtr( OExprType::Expr );
+            OExprPtr Value{};
+            while ( Source.Next( Value ) ) {
+                Out->Children.Add( Applier.Apply( Value ) );
+            }
+            return Out;
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // sort (sort Seq) or (sort Key Seq) orders the values of Seq, or orders them by (Key Value). Equal keys keep their order.
+        const string Token_Sort = "sort";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Sort;
+        Intrinsic->Function = [Token_Sort, Machine]( const OExprPtr Expr ) {
+            assert( Expr->Children.Length() == 2 || Expr->Children.Length() == 3 );
+            const bool Keyed = Expr->Children.Length() == 3;
+            const OExprPtr Arg = Expr->Get( Keyed ? 2 : 1 );
+            OSequenceCursor Source = Make_OSequenceCursor( Machine, Arg );
+            vector<OExprPtr> Values{};
+            OExprPtr Value{};
+            while ( !Machine->EvalError && Source.Next( Value ) ) {
+                Values.push_back( Source.IsLazy() ? Value : EvalExpr( Machine, Value, EEvalIntrinsicMode::Execute ) );
+            }
+            vector<OExprPtr> Keys = Values;
+            if ( Keyed ) {
+                OApplier Applier = Make_OApplier( Machine, Expr, 1 );
+                for ( size_t i = 0; i < Values.size() && !Machine->EvalError; i++ ) {
+                    Keys[ i ] = Applier.Apply( Values[ i ] );
                 }
-                Machine->Stack.PopStack();
-                return Out;
-            } else {
-                OExprPtr Out = Make_OExprPtr( OExprType::Expr );
-                for ( int i = 0; i < Expr->Get( 2 )->Children.Length(); i++ ) {
-                    OExprPtr Zip = Make_OExprPtr( OExprType::Expr );
-                    Zip->Children.Add( Expr->Get( 1 ) );
-                    Zip->Children.Add( Expr->Get( 2 )->Children[ i ] );
-                    Out->Children.Add( EvalExpr( Machine, Zip, EEvalIntrinsicMode::Execute ) );
+            }
+            if ( Machine->EvalError ) {
+                return Make_OExprPtr_Empty();
+            }
+            vector<OExprPtr> Sorted = SortValues( Values, Keys );
+            // A list sorts into a list, anything else into a vector.
+            if ( AsList( Source.List ) != nullptr ) {
+                OListCellPtr Head{};
+                for ( auto It = Sorted.rbegin(); It != Sorted.rend(); ++It ) {
+                    Head = ListCons( *It, Head )->Head;
                 }
-                return Out;
+                return Make_OExprPtr_Object( Expr->Atom, Make_OList( Head ) );
             }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OVector( std::move( Sorted ) ) );
         };
         Machine->Intrinsics.Add( Intrinsic );
     }
@@ -494,37 +832,18 @@ void BuildIntrinsics( OMachinePtr Machine ) {
         Intrinsic->Token = Token_Reduce;
         Intrinsic->Function = [Token_Reduce, Machine]( const OExprPtr Expr ) {
             assert( Expr->Children.Length() == 3 );
-            // 0: Name, 1: mapfunc, 2: (array)
-            // Goal, build 2-node tuples of each. A zip of func and data, then execute.
-            if ( Expr->Get( 1 )->Children.Length() == 3 ) {
-                Machine->Stack.PushStack();
-                OExprPtr Func = Make_OExprPtr( OExprType::ExprFunc );
-                const string MapFuncName = "_MapFunc";
-                Func->Children.Add( Make_OExprPtr_Data( Expr->Atom, MapFuncName ) );
-                Func->Children.Add( Expr->Get( 1 )->Children[ 0 ] );
-                Func->Children.Add( Expr->Get( 1 )->Children[ 1 ] );
-                Func->Children.Add( Expr->Get( 1 )->Children[ 2 ] );
-                OExprPtr Out = Expr->Get( 2 )->Children[ 0 ];
-                for ( int i = 1; i < Expr->Get( 2 )->Children.Length(); i++ ) {
-                    OExprPtr NamedFunc = Make_OExprPtr( OExprType::Expr );
-                    NamedFunc->Children.Add( Make_OExprPtr_Data( Expr->Atom, MapFuncName ) );
-                    NamedFunc->Children.Add( Out );
-                    NamedFunc->Children.Add( Expr->Get( 2 )->Children[ i ] );
-                    Out = EvalNamedFunction( Machine, NamedFunc, Func, EEvalIntrinsicMode::Execute );
-                }
-                Machine->Stack.PopStack();
-                return Out;
-            } else {
-                OExprPtr Out = Expr->Get( 2 )->Children[ 0 ];
-                for ( int i = 1; i < Expr->Get( 2 )->Children.Length(); i++ ) {
-                    OExprPtr Zip = Make_OExprPtr( OExprType::Expr );
-                    Zip->Children.Add( Expr->Get( 1 ) );
-                    Zip->Children.Add( Out );
-                    Zip->Children.Add( Expr->Get( 2 )->Children[ i ] );
-                    Out = EvalExpr( Machine, Zip, EEvalIntrinsicMode::Execute );
-                }
-                return Out;
+            // 0: Name, 1: reducefunc, 2: (array)
+            OSequenceCursor Source = Make_OSequenceCursor( Machine, Expr->Get( 2 ) );
+            OApplier Applier = Make_OApplier( Machine, Expr, 2 );
+            OExprPtr Out{};
+            if ( !Source.Next( Out ) ) {
+                return Make_OExprPtr_Empty();
+            }
+            OExprPtr Value{};
+            while ( Source.Next( Value ) && !Machine->EvalError ) {
+                Out = Applier.Apply( Out, Value );
             }
+            return Out;
         };
         Machine->Intrinsics.Add( Intrinsic );
     }
@@ -532,99 +851,587 @@ void BuildIntrinsics( OMachinePtr Machine ) {
         const string Token_Return = "return";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
         Intrinsic->Token = Token_Return;
-        Intrinsic->Function = [Token_Return, Machine]( const OExprPtr Expr ) {
+        Intrinsic->StrictFunction = [Token_Return]( const OExprPtr Expr, const OArgs& Args ) {
             assert( Expr->Children.Length() >= 0 );
             OExprPtr Out = Make_OExprPtr( OExprType::Break );
             if ( Expr->Children.Length() == 2 ) {
-                Out->Children.Add( EvalExpr( Machine, Expr->Get( 1 ), EEvalIntrinsicMode::Execute ) );
+                Out->Children.Add( Args[ 0 ] );
             }
             return Out;
         };
+        MakeStrict( Machine, Intrinsic );
         Machine->Intrinsics.Add( Intrinsic );
     }
-    { //loop (loop (T1) (T2) (T3) .. (return T4))
-        const string Token_Loop = "loop";
+    { // range (range End), (range Start End) or (range Start End Step) is a lazy sequence of ints.
+        const string Token_Range = "range";
         OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
-        Intrinsic->Token = Token_Loop;
-        Intrinsic->Function = [Token_Loop, Machine]( const OExprPtr Expr ) {
-            if ( Expr->Children.Length() <= 1 ) {
+        Intrinsic->Token = Token_Range;
+        Intrinsic->StrictFunction = [Token_Range, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() >= 1 && Args.Length() <= 3 );
+            const int Start = Args.Length() >= 2 ? AtomToInt( Args[ 0 ]->Atom ) : 0;
+            const int End = AtomToInt( Args[ Args.Length() >= 2 ? 1 : 0 ]->Atom );
+            const int Step = Args.Length() == 3 ? AtomToInt( Args[ 2 ]->Atom ) : 1;
+            if ( Step == 0 ) {
+                RaiseEvalError( Machine, "range step must not be 0." );
                 return Make_OExprPtr_Empty();
             }
-            while ( true ) {
-                for ( int i = 1; i < Expr->Children.Length(); i++ ) {
+            return Make_OExprPtr_Object( Expr->Atom, Make_ORange( Start, End, Step ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // for (for Name Sequence Body...) binds Name to each value in turn. (return) inside Body breaks out.
+        const string Token_For = "for";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_For;
+        Intrinsic->Function = [Token_For, Machine]( const OExprPtr Expr ) {
+            const shared_ptr<OForLoop> Loop = Make_OForLoop( Machine, Expr );
+            while ( !Machine->EvalError && Loop->Advance( Machine ) ) {
+                for ( int i = 3; i < Expr->Children.Length(); i++ ) {
                     OExprPtr Out = EvalExpr( Machine, Expr->Get( i ), EEvalIntrinsicMode::Execute );
                     if ( Out->Type == OExprType::Break ) {
-                        if ( Out->Children.Length() == 1 ) {
-                            return Out->Get( 0 );
-                        } else {
-                            return Make_OExprPtr_Empty();
-                        }
+                        return Out->Children.Length() == 1 ? Out->Get( 0 ) : Make_OExprPtr_Empty();
                     }
                 }
             }
+            return Make_OExprPtr_Empty();
         };
+        Intrinsic->Form = EIntrinsicForm::For;
         Machine->Intrinsics.Add( Intrinsic );
     }
-}
-
-const OIntrinsicPtr FindIntrinsic( const OMachinePtr Machine, const OExprPtr Expr ) {
-    for ( int i = 0; i < Machine->Intrinsics.Length(); i++ ) {
-        if ( Machine->Intrinsics[ i ]->Token == TopAtom( Expr ).Token.Token ) {
-            return Machine->Intrinsics[ i ];
-        }
+    { // lines (lines Path) is a lazy sequence of the lines of a file.
+        const string Token_Lines = "lines";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Lines;
+        Intrinsic->StrictFunction = [Token_Lines, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            const string Path{ TrimEnclosingQuotesView( AtomView( Args[ 0 ]->Atom ) ) };
+            auto Mapped = MapFile( Path );
+            if ( Mapped.ErrorOccured ) {
+                RaiseEvalError( Machine, Mapped.Error );
+                return Make_OExprPtr_Empty();
+            }
+            shared_ptr<OLineSequence> Sequence = make_shared<OLineSequence>();
+            Sequence->Lines.File = Mapped.Out;
+            Sequence->Path = Path;
+            return Make_OExprPtr_Object( Expr->Atom, Sequence );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
     }
-    return Machine->EmptyIntrinsic;
-}
-
-OExprPtr ConstructRootExpr( const TokenList& Tokens, int StartIndex, int EndIndex ) {
-    if ( StartIndex == EndIndex ) {
-        return Make_OExprPtr_Data( Tokens[ StartIndex ] );
+    { // records (records Path) or (records Path Delimiter) is a lazy sequence of the file's lines split on Delimiter, `,` by default.
+        const string Token_Records = "records";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Records;
+        Intrinsic->StrictFunction = [Token_Records, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 || Args.Length() == 2 );
+            const string Path{ TrimEnclosingQuotesView( AtomView( Args[ 0 ]->Atom ) ) };
+            auto Mapped = MapFile( Path );
+            if ( Mapped.ErrorOccured ) {
+                RaiseEvalError( Machine, Mapped.Error );
+                return Make_OExprPtr_Empty();
+            }
+            shared_ptr<ORecordSequence> Sequence = make_shared<ORecordSequence>();
+            Sequence->Lines.File = Mapped.Out;
+            Sequence->Path = Path;
+            if ( Args.Length() == 2 ) {
+                const string_view Delimiter = TrimEnclosingQuotesView( AtomView( Args[ 1 ]->Atom ) );
+                Sequence->Delimiter = Delimiter.empty() ? ',' : Delimiter[ 0 ];
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Sequence );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
     }
-    // Check if no more expansion is needed.
-    {
-        bool IsLeaf = true;
-        bool InLiteral = false;
-        for ( int i = StartIndex; i <= EndIndex; i++ ) {
-            if ( !InLiteral && Tokens[ i ].Token == StrLit ) {
-                InLiteral = true;
-            } else if ( InLiteral && Tokens[ i ].Token == StrLit ) {
-                InLiteral = false;
-            } else if ( !InLiteral && ( Tokens[ i ].Token == ExpStart || Tokens[ i ].Token == ExpEnd ) ) {
-                IsLeaf = false;
-                break;
+    { // field (field Value Index) is the Index-th field of a record or native struct, counting from 0.
+        const string Token_Field = "field";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Field;
+        Intrinsic->StrictFunction = [Token_Field, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 2 );
+            const shared_ptr<OTuple> Tuple = dynamic_pointer_cast<OTuple>( Args[ 0 ]->Atom.Object );
+            if ( Tuple == nullptr ) {
+                RaiseEvalError( Machine, "field expects a record or a native struct value." );
+                return Make_OExprPtr_Empty();
             }
-        }
-        if ( IsLeaf ) {
-            OExprPtr Root = Make_OExprPtr( OExprType::Expr );
-
-            for ( int i = StartIndex; i <= EndIndex; i++ ) {
-                Root->Children.Add( Make_OExprPtr_Data( Tokens[ i ] ) );
+            const int Index = AtomToInt( Args[ 1 ]->Atom );
+            if ( Index < 0 || Index >= Tuple->FieldCount() ) {
+                return Make_OExprPtr_Empty();
             }
-
-            return Root;
-        }
+            return Tuple->Field( Index );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
     }
-    // Needs more expansion
-    OExprPtr Root = Make_OExprPtr( OExprType::Expr );
-    int InitBracketIndex = 0;
-    int OpenBracketCount = 0;
-    for ( int i = StartIndex; i <= EndIndex; i++ ) {
-        if ( Tokens[ i ].Token == ExpStart ) {
-            if ( OpenBracketCount == 0 ) {
-                InitBracketIndex = i;
+    { // list (list A B ...) is a persistent list of the values. (list) is the empty list.
+        const string Token_List = "list";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_List;
+        Intrinsic->StrictFunction = [Token_List]( const OExprPtr Expr, const OArgs& Args ) {
+            OListPtr List = Make_OList( nullptr );
+            for ( int i = Args.Length() - 1; i >= 0; i-- ) {
+                List = ListCons( Args[ i ], List->Head );
             }
-            OpenBracketCount++;
-        } else if ( Tokens[ i ].Token == ExpEnd ) {
-            OpenBracketCount--;
-            if ( OpenBracketCount == 0 ) {
-                Root->Children.Add( ConstructRootExpr( Tokens, InitBracketIndex + 1, i - 1 ) );
+            return Make_OExprPtr_Object( Expr->Atom, List );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // vec (vec A B ...) is a persistent vector of the values.
+        const string Token_Vec = "vec";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Vec;
+        Intrinsic->StrictFunction = [Token_Vec]( const OExprPtr Expr, const OArgs& Args ) {
+            vector<OExprPtr> Values{};
+            for ( int i = 0; i < Args.Length(); i++ ) {
+                Values.push_back( Args[ i ] );
             }
-        } else if ( OpenBracketCount == 0 ) {
-            Root->Children.Add( Make_OExprPtr_Data( Tokens[ i ] ) );
-        }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OVector( std::move( Values ) ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
     }
-    if ( OpenBracketCount != 0 ) {
-        cout << endl << "[PARSE_ERROR] Bracket mismatch. Count: " << OpenBracketCount << endl;
+    { // cons (cons Value List) is List with Value in front. The two share every cell of List.
+        const string Token_Cons = "cons";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Cons;
+        Intrinsic->StrictFunction = [Token_Cons, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 2 );
+            const OListPtr List = AsList( Args[ 1 ] );
+            if ( List == nullptr && !IsEmptyValue( Args[ 1 ] ) ) {
+                RaiseEvalError( Machine, "cons expects a list from (list ...) or (cons ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            return Make_OExprPtr_Object( Expr->Atom, ListCons( Args[ 0 ], List != nullptr ? List->Head : nullptr ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // conj (conj Coll A B ...) adds each value where it is cheapest: the end of a vector, the front of a list.
+        const string Token_Conj = "conj";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Conj;
+        Intrinsic->StrictFunction = [Token_Conj, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() >= 1 );
+            if ( OVectorPtr Vector = AsVector( Args[ 0 ] ) ) {
+                for ( int i = 1; i < Args.Length(); i++ ) {
+                    Vector = VectorConj( *Vector, Args[ i ] );
+                }
+                return Make_OExprPtr_Object( Expr->Atom, Vector );
+            }
+            OListPtr List = AsList( Args[ 0 ] );
+            if ( List == nullptr && !IsEmptyValue( Args[ 0 ] ) ) {
+                RaiseEvalError( Machine, "conj expects a list or a vector." );
+                return Make_OExprPtr_Empty();
+            }
+            OListCellPtr Head = List != nullptr ? List->Head : nullptr;
+            for ( int i = 1; i < Args.Length(); i++ ) {
+                Head = ListCons( Args[ i ], Head )->Head;
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OList( Head ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // first (first Coll) is the first value of a list, vector or record, or empty when it has none.
+        const string Token_First = "first";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_First;
+        Intrinsic->StrictFunction = [Token_First, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            if ( const OListPtr List = AsList( Args[ 0 ] ) ) {
+                return List->Head != nullptr ? List->Head->Value : Make_OExprPtr_Empty();
+            }
+            if ( const shared_ptr<OTuple> Tuple = dynamic_pointer_cast<OTuple>( Args[ 0 ]->Atom.Object ) ) {
+                return Tuple->FieldCount() > 0 ? Tuple->Field( 0 ) : Make_OExprPtr_Empty();
+            }
+            if ( !IsEmptyValue( Args[ 0 ] ) ) {
+                RaiseEvalError( Machine, "first expects a list, a vector or a record." );
+            }
+            return Make_OExprPtr_Empty();
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // rest (rest Coll) is a list or vector without its first value, sharing the rest of it.
+        const string Token_Rest = "rest";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Rest;
+        Intrinsic->StrictFunction = [Token_Rest, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            if ( const OListPtr List = AsList( Args[ 0 ] ) ) {
+                return Make_OExprPtr_Object( Expr->Atom, Make_OList( List->Head != nullptr ? List->Head->Next : nullptr ) );
+            }
+            if ( const OVectorPtr Vector = AsVector( Args[ 0 ] ) ) {
+                return Make_OExprPtr_Object( Expr->Atom, VectorRest( *Vector ) );
+            }
+            if ( !IsEmptyValue( Args[ 0 ] ) ) {
+                RaiseEvalError( Machine, "rest expects a list or a vector." );
+                return Make_OExprPtr_Empty();
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OList( nullptr ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // nth (nth Coll Index) is the Index-th value counting from 0, or empty past the end.
+        const string Token_Nth = "nth";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Nth;
+        Intrinsic->StrictFunction = [Token_Nth, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 2 );
+            const int Index = AtomToInt( Args[ 1 ]->Atom );
+            if ( const OListPtr List = AsList( Args[ 0 ] ) ) {
+                const OListCell* Cell = Index >= 0 ? List->Head.get() : nullptr;
+                for ( int i = 0; i < Index && Cell != nullptr; i++ ) {
+                    Cell = Cell->Next.get();
+                }
+                return Cell != nullptr ? Cell->Value : Make_OExprPtr_Empty();
+            }
+            const shared_ptr<OTuple> Tuple = dynamic_pointer_cast<OTuple>( Args[ 0 ]->Atom.Object );
+            if ( Tuple == nullptr ) {
+                RaiseEvalError( Machine, "nth expects a list, a vector or a record." );
+                return Make_OExprPtr_Empty();
+            }
+            if ( Index < 0 || Index >= Tuple->FieldCount() ) {
+                return Make_OExprPtr_Empty();
+            }
+            return Tuple->Field( Index );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // count (count Coll) is the number of values in a list, vector or record, or of keys in a map.
+        const string Token_Count = "count";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Count;
+        Intrinsic->StrictFunction = [Token_Count, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            if ( const OListPtr List = AsList( Args[ 0 ] ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, List->Count() );
+            }
+            if ( const shared_ptr<OTuple> Tuple = dynamic_pointer_cast<OTuple>( Args[ 0 ]->Atom.Object ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, Tuple->FieldCount() );
+            }
+            if ( const OHashMapPtr Map = AsHashMap( Args[ 0 ] ) ) {
+                return Make_OExprPtr_Int( Expr->Atom, Map->Count );
+            }
+            if ( !IsEmptyValue( Args[ 0 ] ) ) {
+                RaiseEvalError( Machine, "count expects a list, a vector, a map or a record." );
+            }
+            return Make_OExprPtr_Int( Expr->Atom, 0 );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // hmap (hmap K V ...) is a hash map of the given pairs. (hmap) is the empty map.
+        const string Token_HashMap = "hmap";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_HashMap;
+        Intrinsic->StrictFunction = [Token_HashMap, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            if ( Args.Length() % 2 != 0 ) {
+                RaiseEvalError( Machine, "hmap expects a value for every key." );
+                return Make_OExprPtr_Empty();
+            }
+            OHashMapPtr Map = Make_OHashMap( make_shared<OMapNode>(), 0 );
+            for ( int i = 0; i < Args.Length(); i += 2 ) {
+                Map = MapWith( *Map, Args[ i ], Args[ i + 1 ] );
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Map );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // get (get Map Key) is the value put for Key, or empty. (get Map Key Default) returns Default instead.
+        const string Token_Get = "get";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Get;
+        Intrinsic->StrictFunction = [Token_Get, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 2 || Args.Length() == 3 );
+            const OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr ) {
+                RaiseEvalError( Machine, "get expects a map from (hmap ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            if ( const OExprPtr Value = Map->Get( Args[ 1 ] ) ) {
+                return Value;
+            }
+            return Args.Length() == 3 ? Args[ 2 ] : Make_OExprPtr_Empty();
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // has (has Map Key) is 1 when Key is in Map, else 0.
+        const string Token_Has = "has";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Has;
+        Intrinsic->StrictFunction = [Token_Has, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 2 );
+            const OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr ) {
+                RaiseEvalError( Machine, "has expects a map from (hmap ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            return Make_OExprPtr_Int( Expr->Atom, Map->Get( Args[ 1 ] ) != nullptr );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // put (put Map K V ...) is Map with each key set to its value. Map itself is unchanged.
+        const string Token_Put = "put";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Put;
+        Intrinsic->StrictFunction = [Token_Put, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr || Args.Length() % 2 != 1 ) {
+                RaiseEvalError( Machine, "put expects a map followed by keys and values." );
+                return Make_OExprPtr_Empty();
+            }
+            for ( int i = 1; i < Args.Length(); i += 2 ) {
+                Map = MapWith( *Map, Args[ i ], Args[ i + 1 ] );
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Map );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // del (del Map K ...) is Map without the given keys. Map itself is unchanged.
+        const string Token_Del = "del";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Del;
+        Intrinsic->StrictFunction = [Token_Del, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() >= 1 );
+            OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr ) {
+                RaiseEvalError( Machine, "del expects a map from (hmap ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            for ( int i = 1; i < Args.Length(); i++ ) {
+                Map = MapWithout( *Map, Args[ i ] );
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Map );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // keys (keys Map) is a lazy sequence of the keys of Map.
+        const string Token_Keys = "keys";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Keys;
+        Intrinsic->StrictFunction = [Token_Keys, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            const OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr ) {
+                RaiseEvalError( Machine, "keys expects a map from (hmap ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OMapWalk( Map->Root, false ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // vals (vals Map) is a lazy sequence of the values of Map, in the same order as keys.
+        const string Token_Vals = "vals";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Vals;
+        Intrinsic->StrictFunction = [Token_Vals, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            const OHashMapPtr Map = AsHashMap( Args[ 0 ] );
+            if ( Map == nullptr ) {
+                RaiseEvalError( Machine, "vals expects a map from (hmap ...)." );
+                return Make_OExprPtr_Empty();
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OMapWalk( Map->Root, true ) );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // writer (writer Path) opens Path for buffered writing.
+        const string Token_Writer = "writer";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Writer;
+        Intrinsic->StrictFunction = [Token_Writer, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            auto Opened = OpenFileWriter( string{ TrimEnclosingQuotesView( AtomView( Args[ 0 ]->Atom ) ) } );
+            if ( Opened.ErrorOccured ) {
+                RaiseEvalError( Machine, Opened.Error );
+                return Make_OExprPtr_Empty();
+            }
+            Machine->Writers.Add( Opened.Out );
+            return Make_OExprPtr_Object( Expr->Atom, Opened.Out );
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // write (write Writer A B ...) appends each value to the writer's file, like print.
+        const string Token_Write = "write";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Write;
+        Intrinsic->StrictFunction = [Token_Write, Machine]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() >= 1 );
+            const OFileWriterPtr Writer = dynamic_pointer_cast<OFileWriter>( Args[ 0 ]->Atom.Object );
+            if ( Writer == nullptr || !Writer->IsOpen() ) {
+                RaiseEvalError( Machine, "write expects an open writer from (writer Path)." );
+                return Make_OExprPtr_Empty();
+            }
+            for ( int i = 1; i < Args.Length(); i++ ) {
+                Writer->Writer.Write( TrimEnclosingQuotesView( AtomView( Args[ i ]->Atom ) ) );
+            }
+            return Make_OExprPtr_Empty();
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // close (close Writer) flushes and closes a writer.
+        const string Token_Close = "close";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Close;
+        Intrinsic->StrictFunction = [Token_Close]( const OExprPtr Expr, const OArgs& Args ) {
+            assert( Args.Length() == 1 );
+            if ( const OFileWriterPtr Writer = dynamic_pointer_cast<OFileWriter>( Args[ 0 ]->Atom.Object ) ) {
+                Writer->Close();
+            }
+            return Make_OExprPtr_Empty();
+        };
+        MakeStrict( Machine, Intrinsic );
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // gen (gen Body...) returns a lazy sequence of the values Body yields.
+        const string Token_Gen = "gen";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Gen;
+        Intrinsic->Function = [Token_Gen, Machine]( const OExprPtr Expr ) {
+            OExprPtr Body = Make_OExprPtr( OExprType::Expr );
+            for ( int i = 1; i < Expr->Children.Length(); i++ ) {
+                Body->Children.Add( Expr->Children[ i ] );
+            }
+            return Make_OExprPtr_Object( Expr->Atom, Make_OGenerator( Machine, Body ) );
+        };
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { // yield (yield Value) hands Value to the consumer of the enclosing gen.
+        const string Token_Yield = "yield";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Yield;
+        // Only reached when a native intrinsic evaluates the yield itself.
+        Intrinsic->Function = [Token_Yield, Machine]( const OExprPtr Expr ) {
+            RaiseEvalError( Machine, "yield outside of a generator, or inside the arguments of a native intrinsic." );
+            return Make_OExprPtr_Empty();
+        };
+        Intrinsic->Form = EIntrinsicForm::Yield;
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+    { //loop (loop (T1) (T2) (T3) .. (return T4))
+        const string Token_Loop = "loop";
+        OIntrinsicPtr Intrinsic = Make_OIntriniscPtr( OExprType::NativeFunction );
+        Intrinsic->Token = Token_Loop;
+        Intrinsic->Function = [Token_Loop, Machine]( const OExprPtr Expr ) {
+            if ( Expr->Children.Length() <= 1 ) {
+                return Make_OExprPtr_Empty();
+            }
+            while ( !Machine->EvalError ) {
+                for ( int i = 1; i < Expr->Children.Length(); i++ ) {
+                    OExprPtr Out = EvalExpr( Machine, Expr->Get( i ), EEvalIntrinsicMode::Execute );
+                    if ( Out->Type == OExprType::Break ) {
+                        if ( Out->Children.Length() == 1 ) {
+                            return Out->Get( 0 );
+                        } else {
+                            return Make_OExprPtr_Empty();
+                        }
+                    }
+                }
+            }
+            return Make_OExprPtr_Empty();
+        };
+        Intrinsic->Form = EIntrinsicForm::Loop;
+        Machine->Intrinsics.Add( Intrinsic );
+    }
+}
+
+// Every intrinsic name is interned here, so a token that is not yet a symbol
+// names none. The first intrinsic with a name wins, as in the list.
+void IndexIntrinsics( const OMachinePtr Machine ) {
+    Machine->IntrinsicsBySymbol.clear();
+    for ( int i = 0; i < Machine->Intrinsics.Length(); i++ ) {
+        const OIntrinsicPtr& Intrinsic = Machine->Intrinsics[ i ];
+        Intrinsic->Symbol = GSymbols.Intern( Intrinsic->Token );
+        if ( Intrinsic->Symbol >= static_cast<int>( Machine->IntrinsicsBySymbol.size() ) ) {
+            Machine->IntrinsicsBySymbol.resize( Intrinsic->Symbol + 1 );
+        }
+        if ( Machine->IntrinsicsBySymbol[ Intrinsic->Symbol ] == nullptr ) {
+            Machine->IntrinsicsBySymbol[ Intrinsic->Symbol ] = Intrinsic;
+        }
+    }
+    Machine->IndexedIntrinsics = Machine->Intrinsics.Length();
+}
+
+const OIntrinsicPtr FindIntrinsic( const OMachinePtr Machine, const OExprPtr Expr ) {
+    const uint64 StartNs = GStats.TimeLookups ? NowNs() : 0;
+    GStats.IntrinsicLookups++;
+    if ( Machine->IndexedIntrinsics != Machine->Intrinsics.Length() ) {
+        IndexIntrinsics( Machine );
+    }
+    OIntrinsicPtr Found = Machine->EmptyIntrinsic;
+    const int Symbol = TokenSymbol( TopAtom( Expr ).Token, false );
+    if ( Symbol >= 0 && Symbol < static_cast<int>( Machine->IntrinsicsBySymbol.size() ) && Machine->IntrinsicsBySymbol[ Symbol ] != nullptr ) {
+        Found = Machine->IntrinsicsBySymbol[ Symbol ];
+    }
+    GStats.IntrinsicScanLength++;
+    if ( GStats.TimeLookups ) {
+        GStats.LookupNs += NowNs() - StartNs;
+    }
+    return Found;
+}
+
+OExprPtr ConstructRootExpr( const TokenList& Tokens, int StartIndex, int EndIndex ) {
+    if ( StartIndex == EndIndex ) {
+        return Make_OExprPtr_Data( Tokens[ StartIndex ] );
+    }
+    // Check if no more expansion is needed.
+    {
+        bool IsLeaf = true;
+        bool InLiteral = false;
+        for ( int i = StartIndex; i <= EndIndex; i++ ) {
+            if ( !InLiteral && Tokens[ i ].Token == StrLit ) {
+                InLiteral = true;
+            } else if ( InLiteral && Tokens[ i ].Token == StrLit ) {
+                InLiteral = false;
+            } else if ( !InLiteral && ( Tokens[ i ].Token == ExpStart || Tokens[ i ].Token == ExpEnd ) ) {
+                IsLeaf = false;
+                break;
+            }
+        }
+        if ( IsLeaf ) {
+            OExprPtr Root = Make_OExprPtr( OExprType::Expr );
+
+            for ( int i = StartIndex; i <= EndIndex; i++ ) {
+                Root->Children.Add( Make_OExprPtr_Data( Tokens[ i ] ) );
+            }
+
+            return Root;
+        }
+    }
+    // Needs more expansion
+    OExprPtr Root = Make_OExprPtr( OExprType::Expr );
+    int InitBracketIndex = 0;
+    int OpenBracketCount = 0;
+    for ( int i = StartIndex; i <= EndIndex; i++ ) {
+        if ( Tokens[ i ].Token == ExpStart ) {
+            if ( OpenBracketCount == 0 ) {
+                InitBracketIndex = i;
+            }
+            OpenBracketCount++;
+        } else if ( Tokens[ i ].Token == ExpEnd ) {
+            OpenBracketCount--;
+            if ( OpenBracketCount == 0 ) {
+                Root->Children.Add( ConstructRootExpr( Tokens, InitBracketIndex + 1, i - 1 ) );
+            }
+        } else if ( OpenBracketCount == 0 ) {
+            Root->Children.Add( Make_OExprPtr_Data( Tokens[ i ] ) );
+        }
+    }
+    if ( OpenBracketCount != 0 ) {
+        cout << endl << "[PARSE_ERROR] Bracket mismatch. Count: " << OpenBracketCount << endl;
     }
     return Root;
 }
@@ -633,20 +1440,13 @@ OExprPtr ConstructRootExpr( const TokenList& Tokens ) {
     return ConstructRootExpr( Tokens, 0, Tokens.Length() - 1 );
 }
 
-int CompareTo( const string& LHS, const string& RHS ) {
+int CompareTo( string_view LHS, string_view RHS ) {
     if ( Contains( LHS, StrLit[ 0 ] ) || Contains( RHS, StrLit[ 0 ] ) ) {
         return LHS.compare( RHS );
     }
 
-    stringstream ss{};
-    ss << LHS;
-    float a{};
-    ss >> a;
-
-    ss = {};
-    ss << RHS;
-    float b{};
-    ss >> b;
+    const float a = ParseTokenToPrimitive<float>( LHS );
+    const float b = ParseTokenToPrimitive<float>( RHS );
 
     if ( a < b ) {
         return -1;
@@ -675,6 +1475,94 @@ const OAtom& LastAtom( const OExprPtr Expr ) {
     return Expr->Atom;
 }
 
+string_view AtomView( const OAtom& Atom ) {
+    if ( Atom.Object != nullptr ) {
+        return Atom.Object->View();
+    }
+    return Atom.Token.Token;
+}
+
+// Rewrites the atom as an unboxed int, reusing the token's storage for its text.
+void SetAtomInt( OAtom& Atom, const int Value ) {
+    char Text[ 12 ];
+    const to_chars_result Written = to_chars( Text, Text + sizeof( Text ), Value );
+    Atom.PrimitiveType = OAtomDataPrimitiveType::Int;
+    Atom.PrimitiveData.Int = Value;
+    Atom.Token.Token.assign( Text, Written.ptr - Text );
+    Atom.Token.Symbol = NOT_A_SYMBOL;
+    Atom.Object = {};
+}
+
+bool IsIntAtom( const OAtom& Atom ) {
+    return Atom.PrimitiveType == OAtomDataPrimitiveType::Int && Atom.Object == nullptr;
+}
+
+// An unboxed int, or text that is exactly an int. Such text compares as an int too.
+bool AtomIntValue( const OAtom& Atom, int& Out ) {
+    if ( IsIntAtom( Atom ) ) {
+        Out = Atom.PrimitiveData.Int;
+        return true;
+    }
+    return Atom.Object == nullptr && ParseIntLiteral( Atom.Token.Token, Out );
+}
+
+int AtomToInt( const OAtom& Atom ) {
+    if ( IsIntAtom( Atom ) ) {
+        return Atom.PrimitiveData.Int;
+    }
+    return ParseTokenToPrimitive<int>( AtomView( Atom ) );
+}
+
+bool AtomsEqual( const OAtom& LHS, const OAtom& RHS ) {
+    // Closures, collections and other values are compared by identity, not by
+    // their printed text, which many of them share.
+    if ( ( LHS.Object != nullptr && !IsTextObject( LHS.Object.get() ) ) || ( RHS.Object != nullptr && !IsTextObject( RHS.Object.get() ) ) ) {
+        return LHS.Object == RHS.Object;
+    }
+    // Native strings carry no quotes, so compare them against a literal's contents.
+    if ( LHS.Object != nullptr || RHS.Object != nullptr ) {
+        return TrimEnclosingQuotesView( AtomView( LHS ) ) == TrimEnclosingQuotesView( AtomView( RHS ) );
+    }
+    return LHS.Token.Token == RHS.Token.Token;
+}
+
+const OAtom& ParamAtom( const OExprPtr Param ) {
+    if ( !ParamType( Param ).empty() ) {
+        return Param->Children[ 1 ]->Atom;
+    }
+    return TopAtom( Param );
+}
+
+string_view ParamType( const OExprPtr Param ) {
+    if ( Param->Children.Length() != 2 ) {
+        return {};
+    }
+    const string_view Type = Param->Children[ 0 ]->Atom.Token.Token;
+    if ( Type.size() < 2 || Type.back() != ':' ) {
+        return {};
+    }
+    return Type.substr( 0, Type.size() - 1 );
+}
+
+int TokenSymbol( const OToken& Token, const bool Define ) {
+    if ( Token.Symbol >= 0 ) {
+        return Token.Symbol;
+    }
+    if ( Token.Symbol == NOT_A_SYMBOL ) {
+        return INVALID_SYMBOL;
+    }
+    // Built at runtime rather than by the tokenizer.
+    if ( !IsSymbolToken( Token.Token ) ) {
+        Token.Symbol = NOT_A_SYMBOL;
+        return INVALID_SYMBOL;
+    }
+    const int Symbol = Define ? GSymbols.Intern( Token.Token ) : GSymbols.Find( Token.Token );
+    if ( Symbol != INVALID_SYMBOL ) {
+        Token.Symbol = Symbol;
+    }
+    return Symbol;
+}
+
 void SetFunctionMem( OMachinePtr Machine, const OExprPtr InExpr, const EInExprFuncFormat InExprFuncFormat, const OExprPtr ExprFunc ) {
     // Expr is FUNC VAR1 VAR2 ...
     // Func is NAME VAR1 VAR2 ... BODY
@@ -683,40 +1571,97 @@ void SetFunctionMem( OMachinePtr Machine, const OExprPtr InExpr, const EInExprFu
         if ( ExprIndex >= ExprFunc->Children.Length() - 1 ) {
             break;
         }
-        OExprPtr NewExpr = Make_OExprPtr( OExprType::Expr );
-        NewExpr->Children.Add( ExprFunc->Children[ ExprIndex ] );
-        NewExpr->Children.Add( EvalExpr( Machine, InExpr->Children[ ExprIndex ], EEvalIntrinsicMode::Execute ) );
-        Machine->Stack.PeekStack().SetOrAdd( NewExpr, [&]( const OExprPtr& ExistingExpr ) {
-            if ( ExistingExpr->Children.IsNonEmpty() ) {
-                if ( TopAtom( ExistingExpr ).Token.Token == TopAtom( NewExpr ).Token.Token ) {
-                    return true;
-                }
-            }
-            return false;
-        } );
+        const int Symbol = TokenSymbol( ParamAtom( ExprFunc->Children[ ExprIndex ] ).Token, true );
+        Machine->Stack.Set( Symbol, EvalExpr( Machine, InExpr->Children[ ExprIndex ], EEvalIntrinsicMode::Execute ) );
     }
 }
 
-OExprPtr EvalInMemory( const OMachinePtr Machine, const OExprPtr Expr, EEvalIntrinsicMode EvalIntrinsicMode ) {
-    for ( int StackFrameIndex = Machine->Stack.Length() - 1; StackFrameIndex >= 0; StackFrameIndex-- ) {
-        const OExprList& StackFrame = Machine->Stack[ StackFrameIndex ];
-        for ( int i = 0; i < StackFrame.Length(); i++ ) {
-            if ( StackFrame[ i ]->Type == OExprType::ExprFunc ) {
-                if ( TopAtom( StackFrame[ i ] ).Token.Token == TopAtom( Expr ).Token.Token ) {
-                    return EvalNamedFunction( Machine, Expr, StackFrame[ i ], EvalIntrinsicMode );
-                }
-            } else if ( StackFrame[ i ]->Children.Length() == 1 ) {
-                if ( TopAtom( StackFrame[ i ] ).Token.Token == TopAtom( Expr ).Token.Token ) {
-                    return EvalExpr( Machine, StackFrame[ i ]->Children[ 0 ], EvalIntrinsicMode );
-                }
-            } else if ( StackFrame[ i ]->Children.Length() == 2 ) {
-                if ( TopAtom( StackFrame[ i ] ).Token.Token == TopAtom( Expr ).Token.Token ) {
-                    return EvalExpr( Machine, StackFrame[ i ]->Children[ 1 ], EvalIntrinsicMode );
-                }
-            }
+OExprPtr CalleeOf( const OExprPtr& Value, OClosurePtr& Closure ) {
+    if ( Value->Type == OExprType::ExprFunc ) {
+        Closure = {};
+        return Value;
+    }
+    Closure = Value->Atom.Object != nullptr ? dynamic_pointer_cast<OClosure>( Value->Atom.Object ) : nullptr;
+    return Closure != nullptr ? Closure->Function : nullptr;
+}
+
+void BindCaptured( OMachinePtr Machine, const OClosure& Closure ) {
+    OFrameStack& Stack = Machine->Stack;
+    const int Params = Stack.Slots.Length();
+    for ( int i = 0; i < Closure.Captured.Length(); i++ ) {
+        const OBinding& Binding = Closure.Captured[ i ];
+        int Slot = Stack.FrameStarts.Last();
+        while ( Slot < Params && Stack.Slots[ Slot ].Symbol != Binding.Symbol ) {
+            Slot++;
+        }
+        if ( Slot == Params ) {
+            Stack.Slots.Add( Binding );
         }
     }
-    return Expr;
+}
+
+// The function of a fn site, made on its first evaluation. Evaluating the site
+// as a child of a block writes the closure it returned over the site's atom,
+// and that closure holds the same function, so either one keeps it.
+OExprPtr LambdaFunction( const OExprPtr Site, const OExprPtr Name, const int First ) {
+    if ( const auto Cached = dynamic_cast<OLambdaSite*>( Site->Atom.Object.get() ) ) {
+        return Cached->Function;
+    }
+    if ( const auto Closure = dynamic_cast<OClosure*>( Site->Atom.Object.get() ) ) {
+        return Closure->Function;
+    }
+    shared_ptr<OLambdaSite> Lambda = make_shared<OLambdaSite>();
+    Lambda->Function = Make_OExprPtr( OExprType::ExprFunc );
+    Lambda->Function->Children.Add( Name );
+    for ( int i = First; i < Site->Children.Length(); i++ ) {
+        Lambda->Function->Children.Add( Site->Children[ i ] );
+    }
+    Site->Atom.Object = Lambda;
+    return Lambda->Function;
+}
+
+// Captures the bindings of the current call. Frame 0 holds the globals, which
+// stay visible without a copy.
+OClosurePtr Make_OClosure( OMachinePtr Machine, const OExprPtr Function ) {
+    shared_ptr<OClosure> Closure = make_shared<OClosure>();
+    Closure->Function = Function;
+    const OFrameStack& Stack = Machine->Stack;
+    if ( Stack.Depth() > 1 ) {
+        for ( int i = Stack.FrameStarts[ Stack.Depth() - 1 ]; i < Stack.Slots.Length(); i++ ) {
+            Closure->Captured.Add( Stack.Slots[ i ] );
+        }
+    }
+    return Closure;
+}
+
+// Slot of the binding named by Expr's top atom, or -1.
+int FindMemorySlot( const OMachinePtr Machine, const OExprPtr Expr ) {
+    const uint64 StartNs = GStats.TimeLookups ? NowNs() : 0;
+    GStats.MemoryLookups++;
+    const int Symbol = TokenSymbol( TopAtom( Expr ).Token, false );
+    const int Slot = Symbol == INVALID_SYMBOL ? -1 : Machine->Stack.Find( Symbol, GStats.MemoryScanLength );
+    if ( GStats.TimeLookups ) {
+        GStats.LookupNs += NowNs() - StartNs;
+    }
+    return Slot;
+}
+
+OExprPtr EvalInMemory( const OMachinePtr Machine, const OExprPtr Expr, EEvalIntrinsicMode EvalIntrinsicMode ) {
+    // Find the binding first so lookup time and scan length exclude evaluating it.
+    const int Slot = FindMemorySlot( Machine, Expr );
+    if ( Slot < 0 ) {
+        return Expr;
+    }
+    const OExprPtr Found = Machine->Stack.Slots[ Slot ].Value;
+    if ( Found->Type == OExprType::ExprFunc ) {
+        return EvalNamedFunction( Machine, Expr, Found, EvalIntrinsicMode );
+    }
+    // A name bound to a closure is its value. Only a call form such as (F X) calls it.
+    OClosurePtr Closure{};
+    if ( Expr->Children.IsNonEmpty() && CalleeOf( Found, Closure ) != nullptr ) {
+        return EvalNamedFunction( Machine, Expr, Closure->Function, EvalIntrinsicMode, &*Closure );
+    }
+    return EvalExpr( Machine, Found, EvalIntrinsicMode );
 }
 
 bool AllData( const OExprPtr Expr ) {
@@ -728,29 +1673,59 @@ bool AllData( const OExprPtr Expr ) {
     return true;
 }
 
-OExprPtr EvalExpr( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
-    Expr = EvalInMemory( Machine, Expr, EvalIntrinsicMode );
+OExprPtr EvalIntrinsicTraced( OMachinePtr Machine, const OExprPtr Expr, const OIntrinsicPtr Intrinsic ) {
+    if ( Intrinsic->Symbol == INVALID_SYMBOL ) {
+        Intrinsic->Symbol = GSymbols.Intern( Intrinsic->Token );
+    }
+    const int Line = TopAtom( Expr ).Token.Line;
+    TraceWrite( ETraceEvent::IntrinsicEnter, Intrinsic->Symbol, Line );
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Enter( &*Intrinsic, Intrinsic->Token, 0, true );
+    }
+    OExprPtr Out = Intrinsic->Function( Expr );
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Exit();
+    }
+    TraceWrite( ETraceEvent::IntrinsicExit, Intrinsic->Symbol, Line );
+    return Out;
+}
 
-#if PRINT_EVAL
-    if ( Expr->Children.IsEmpty() ) {
-        std::cout << TopAtom( Expr ).Token << "|";
+OExprPtr EvalExprRecursive( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
+    if ( NativeStackExhausted( Machine ) ) {
+        RaiseEvalError( Machine, "Native stack exhausted. Run with --engine=stack to nest deeper." );
+        return Make_OExprPtr_Empty();
     }
-    for ( int i = 0; i < Expr->Children.Length(); i++ ) {
-        std::cout << TopAtom( Expr->Children[ i ] ).Token << "|";
+    GStats.Evals++;
+    if ( TraceEnabled() ) {
+        const OToken& Token = TopAtom( Expr ).Token;
+        TraceWrite( ETraceEvent::Eval, TokenSymbol( Token, true ), Token.Line );
     }
-    std::cout << std::endl;
-#endif
+    Expr = EvalInMemory( Machine, Expr, EvalIntrinsicMode );
+
 
     // Check if first node is intrinsic.
     if ( EvalIntrinsicMode == EEvalIntrinsicMode::Execute) {
         OIntrinsicPtr Intrinsic = FindIntrinsic( Machine, Expr );
         if ( Intrinsic != Machine->EmptyIntrinsic ) {
+            if ( TraceEnabled() ) {
+                return EvalIntrinsicTraced( Machine, Expr, Intrinsic );
+            }
+            if ( Machine->Profiler != nullptr ) {
+                Machine->Profiler->Enter( &*Intrinsic, Intrinsic->Token, 0, true );
+                OExprPtr Out = Intrinsic->Function( Expr );
+                Machine->Profiler->Exit();
+                return Out;
+            }
             return Intrinsic->Function( Expr );
         }
     }
 
+    OExprPtr LastOut{};
     for ( int i = 0; i < Expr->Children.Length(); i++ ) {
         OExprPtr ExprOut = EvalExpr( Machine, Expr->Children[ i ], EvalIntrinsicMode );
+        if ( Machine->EvalError ) {
+            return ExprOut;
+        }
         Expr->Children[ i ]->Atom = ExprOut->Atom;
         if ( ExprOut->Type == OExprType::Break ) {
             if ( ExprOut->Children.Length() >= 1 ) {
@@ -759,23 +1734,479 @@ OExprPtr EvalExpr( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode
                 return ExprOut;
             }
         }
+        LastOut = ExprOut;
     }
 
-    if ( ReturnMode == EEvalExprReturnMode::LastChild && Expr->Children.IsNonEmpty() ) {
-        return Expr->Children.Last();
+    // The result itself rather than the child it was written into, so callers
+    // (and function returns) can use it without copying.
+    if ( ReturnMode == EEvalExprReturnMode::LastChild && LastOut != nullptr ) {
+        return LastOut;
     }
 
     return Expr;
 }
 
-OExprPtr EvalNamedFunction( OMachinePtr Machine, const OExprPtr Expr, const OExprPtr Function, const EEvalIntrinsicMode EvalIntrinsicMode ) {
+OExprPtr EvalNamedFunction( OMachinePtr Machine, const OExprPtr Expr, const OExprPtr Function, const EEvalIntrinsicMode EvalIntrinsicMode, const OClosure* Closure ) {
     // Params are child [1, (N-2)], body is N-1
-    Machine->Stack.PushStack();
+    GStats.Calls++;
+    const bool Traced = TraceEnabled();
+    const int TraceSymbol = Traced ? TokenSymbol( TopAtom( Function ).Token, true ) : INVALID_SYMBOL;
+    if ( Traced ) {
+        TraceWrite( ETraceEvent::CallEnter, TraceSymbol, TopAtom( Expr ).Token.Line );
+    }
+    if ( Machine->Profiler != nullptr ) {
+        const OAtom& Name = TopAtom( Function );
+        Machine->Profiler->Enter( &*Function, Name.Token.Token, Name.Token.Line, false );
+    }
+    PushFrame( Machine );
     SetFunctionMem( Machine, Expr, EInExprFuncFormat::FirstTokenName, Function );
-    OExprPtr Out = EvalExpr( Machine, Function->Children.Last(), EvalIntrinsicMode );
+    if ( Closure != nullptr ) {
+        BindCaptured( Machine, *Closure );
+    }
+    OExprPtr Out = TrySpecializedCall( Machine, Function );
+    if ( Out == nullptr ) {
+        Out = EvalExpr( Machine, Function->Children.Last(), EvalIntrinsicMode );
+    }
     // We want to remove child nodes because they are structures only of the Function
-    Machine->Stack.PopStack();
-    return Make_OExprPtr_Data( Expr->Atom, Out->Atom.Token.Token);
+    PopFrame( Machine );
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Exit();
+    }
+    if ( Traced ) {
+        TraceWrite( ETraceEvent::CallExit, TraceSymbol, TopAtom( Expr ).Token.Line );
+    }
+    // Plain data can be handed back as is. Anything else is reduced to its atom.
+    if ( Out->Type == OExprType::Data && Out->Children.IsEmpty() ) {
+        return Out;
+    }
+    OExprPtr Result = Make_OExprPtr_Data( Expr->Atom, Out->Atom.Token.Token );
+    Result->Atom.Object = Out->Atom.Object;
+    return Result;
+}
+
+void RaiseEvalError( OMachinePtr Machine, const string& Message ) {
+    if ( Machine->EvalError ) {
+        return;
+    }
+    Machine->EvalError = true;
+    // Output so far goes first, for when both streams share a terminal.
+    Machine->Out.Flush();
+    Machine->Err.Write( "\n[EVAL_ERROR] " );
+    Machine->Err.Write( Message );
+    Machine->Err.Write( '\n' );
+    PrintBacktrace( Machine, 8, Machine->Err );
+    Machine->Err.Flush();
+}
+
+void PrintBacktrace( OMachinePtr Machine, const int MaxFrames, OBufferedWriter& Writer ) {
+    const OEvalState& State = Machine->Eval;
+    stringstream SS;
+    SS << "Continuation frames: " << State.Frames.Length() << ", bindings: " << Machine->Stack.Slots.Length()
+       << ", bytes: " << State.Bytes( Machine->Stack ) << "\n";
+    int Calls = 0;
+    for ( int i = State.Frames.Length() - 1; i >= 0; i-- ) {
+        const OEvalFrame& Frame = State.Frames[ i ];
+        if ( Frame.Callee == nullptr ) {
+            continue;
+        }
+        if ( MaxFrames < 0 || Calls < MaxFrames ) {
+            SS << "  at (" << TopAtom( Frame.Callee ).Token.Token << ") line " << TopAtom( Frame.Expr ).Token.Line << "\n";
+        }
+        Calls++;
+    }
+    if ( MaxFrames >= 0 && Calls > MaxFrames ) {
+        SS << "  ... " << Calls - MaxFrames << " more calls\n";
+    }
+    Writer.Write( SS.str() );
+}
+
+bool PushEvalFrame( OMachinePtr Machine, const OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
+    OEvalState& State = Machine->Eval;
+    if ( State.Bytes( Machine->Stack ) > Machine->EvalBudgetBytes ) {
+        RaiseEvalError( Machine, "Evaluation exceeded its memory budget of " + to_string( Machine->EvalBudgetBytes >> 20 ) + " MB. Raise it with --eval-budget=MB." );
+        return false;
+    }
+    State.Frames.Add( OEvalFrame{ EEvalStep::Start, EvalIntrinsicMode, ReturnMode, false, 0, 0, Expr, {}, {}, {}, {}, {} } );
+    if ( static_cast<uint64>( State.Frames.Length() ) > GStats.PeakEvalFrames ) {
+        GStats.PeakEvalFrames = State.Frames.Length();
+    }
+    return true;
+}
+
+int BeginEval( OMachinePtr Machine, const OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
+    const int Base = Machine->Eval.Frames.Length();
+    PushEvalFrame( Machine, Expr, EvalIntrinsicMode, ReturnMode );
+    return Base;
+}
+
+void EnterIntrinsic( OMachinePtr Machine, OEvalFrame& Frame, const OIntrinsicPtr Intrinsic ) {
+    Frame.Intrinsic = Intrinsic;
+    Frame.Traced = TraceEnabled();
+    if ( Frame.Traced ) {
+        if ( Intrinsic->Symbol == INVALID_SYMBOL ) {
+            Intrinsic->Symbol = GSymbols.Intern( Intrinsic->Token );
+        }
+        TraceWrite( ETraceEvent::IntrinsicEnter, Intrinsic->Symbol, TopAtom( Frame.Expr ).Token.Line );
+    }
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Enter( &*Intrinsic, Intrinsic->Token, 0, true );
+    }
+}
+
+void ExitIntrinsic( OMachinePtr Machine, OEvalFrame& Frame ) {
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Exit();
+    }
+    if ( Frame.Traced ) {
+        TraceWrite( ETraceEvent::IntrinsicExit, Frame.Intrinsic->Symbol, TopAtom( Frame.Expr ).Token.Line );
+    }
+    Frame.Intrinsic = {};
+}
+
+void BeginCall( OMachinePtr Machine, OEvalFrame& Frame, const OExprPtr Function ) {
+    GStats.Calls++;
+    Frame.Callee = Function;
+    Frame.Traced = TraceEnabled();
+    if ( Frame.Traced ) {
+        TraceWrite( ETraceEvent::CallEnter, TokenSymbol( TopAtom( Function ).Token, true ), TopAtom( Frame.Expr ).Token.Line );
+    }
+    if ( Machine->Profiler != nullptr ) {
+        const OAtom& Name = TopAtom( Function );
+        Machine->Profiler->Enter( &*Function, Name.Token.Token, Name.Token.Line, false );
+    }
+    PushFrame( Machine );
+}
+
+void EndCall( OMachinePtr Machine, OEvalFrame& Frame ) {
+    PopFrame( Machine );
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->Exit();
+    }
+    if ( Frame.Traced ) {
+        TraceWrite( ETraceEvent::CallExit, TokenSymbol( TopAtom( Frame.Callee ).Token, true ), TopAtom( Frame.Expr ).Token.Line );
+    }
+    Frame.Callee = {};
+    Frame.Closure = {};
+}
+
+// Pops the top frame, handing Result to the frame below.
+void FinishFrame( OMachinePtr Machine, const OExprPtr Result ) {
+    OEvalState& State = Machine->Eval;
+    if ( State.Frames.Last().Intrinsic != nullptr ) {
+        ExitIntrinsic( Machine, State.Frames.Last() );
+    }
+    State.Result = Result;
+    State.Frames.Arr.pop_back();
+}
+
+void UnwindEval( OMachinePtr Machine, const int Base ) {
+    OEvalState& State = Machine->Eval;
+    while ( State.Frames.Length() > Base ) {
+        OEvalFrame& Frame = State.Frames.Last();
+        if ( Frame.Step == EEvalStep::StrictArg ) {
+            State.Args.Arr.resize( Frame.ArgBase );
+        }
+        if ( Frame.Intrinsic != nullptr ) {
+            ExitIntrinsic( Machine, Frame );
+        }
+        if ( Frame.Callee != nullptr ) {
+            EndCall( Machine, Frame );
+        }
+        State.Frames.Arr.pop_back();
+    }
+    State.Result = Make_OExprPtr_Empty();
+}
+
+// Hands the call's result in State.Result on to the frame's own dispatch.
+void FinishCall( OMachinePtr Machine, OEvalFrame& Frame ) {
+    EndCall( Machine, Frame );
+    // Plain data can be handed back as is. Anything else is reduced to its atom.
+    const OExprPtr Out = Machine->Eval.Result;
+    if ( Out->Type == OExprType::Data && Out->Children.IsEmpty() ) {
+        Frame.Expr = Out;
+    } else {
+        OExprPtr Result = Make_OExprPtr_Data( Frame.Expr->Atom, Out->Atom.Token.Token );
+        Result->Atom.Object = Out->Atom.Object;
+        Frame.Expr = Result;
+    }
+    DispatchEval( Machine );
+}
+
+// Evaluates the next argument of a call, or its body once every parameter is bound.
+void NextCallArg( OMachinePtr Machine, OEvalFrame& Frame ) {
+    if ( Frame.Index < Frame.Expr->Children.Length() && Frame.Index < Frame.Callee->Children.Length() - 1 ) {
+        Frame.Step = EEvalStep::CallArg;
+        PushEvalFrame( Machine, Frame.Expr->Children[ Frame.Index ], EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+        return;
+    }
+    Frame.Step = EEvalStep::CallBody;
+    if ( Frame.Closure != nullptr ) {
+        BindCaptured( Machine, *Frame.Closure );
+    }
+    const OExprPtr Specialized = TrySpecializedCall( Machine, Frame.Callee );
+    // A deep specialized call may have nested a run, so Frame is looked up again.
+    OEvalFrame& Top = Machine->Eval.Frames.Last();
+    if ( Specialized != nullptr ) {
+        Machine->Eval.Result = Specialized;
+        FinishCall( Machine, Top );
+        return;
+    }
+    PushEvalFrame( Machine, Top.Callee->Children.Last(), Top.Mode, EEvalExprReturnMode::LastChild );
+}
+
+void NextStrictArg( OMachinePtr Machine, OEvalFrame& Frame ) {
+    if ( Frame.Index < Frame.Expr->Children.Length() ) {
+        Frame.Step = EEvalStep::StrictArg;
+        PushEvalFrame( Machine, Frame.Expr->Children[ Frame.Index ], EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+        return;
+    }
+    OExprList& Args = Machine->Eval.Args;
+    const OExprPtr Out = Frame.Intrinsic->StrictFunction( Frame.Expr, OArgs{ Args.Arr.data() + Frame.ArgBase, Args.Length() - Frame.ArgBase } );
+    Args.Arr.resize( Frame.ArgBase );
+    FinishFrame( Machine, Out );
+}
+
+// Binds the next value of the top frame's for and starts on its body.
+void NextForIteration( OMachinePtr Machine ) {
+    OEvalState& State = Machine->Eval;
+    const shared_ptr<OForLoop> Loop = static_pointer_cast<OForLoop>( State.Frames.Last().Iterator );
+    const OExprPtr Expr = State.Frames.Last().Expr;
+    // An empty body only runs the counter.
+    while ( Loop->Advance( Machine ) && !Machine->EvalError ) {
+        if ( Expr->Children.Length() > 3 ) {
+            OEvalFrame& Frame = State.Frames.Last();
+            Frame.Step = EEvalStep::ForBody;
+            Frame.Index = 3;
+            PushEvalFrame( Machine, Expr->Get( 3 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+            return;
+        }
+    }
+    FinishFrame( Machine, Make_OExprPtr_Empty() );
+}
+
+// Runs the intrinsic named by the top frame's expression, or starts on its children.
+void DispatchEval( OMachinePtr Machine ) {
+    OEvalState& State = Machine->Eval;
+    OEvalFrame& Frame = State.Frames.Last();
+    if ( Frame.Mode == EEvalIntrinsicMode::Execute ) {
+        const OIntrinsicPtr Intrinsic = FindIntrinsic( Machine, Frame.Expr );
+        if ( Intrinsic != Machine->EmptyIntrinsic ) {
+            EnterIntrinsic( Machine, Frame, Intrinsic );
+            switch ( Intrinsic->Form ) {
+            case EIntrinsicForm::Native: {
+                // May run nested evaluations on top of this frame, so Frame is not used afterwards.
+                const OExprPtr Out = Intrinsic->Function( Frame.Expr );
+                FinishFrame( Machine, Out );
+                return;
+            }
+            case EIntrinsicForm::Strict:
+                Frame.ArgBase = State.Args.Length();
+                Frame.Index = 1;
+                NextStrictArg( Machine, Frame );
+                return;
+            case EIntrinsicForm::Branch:
+                assert( Frame.Expr->Children.Length() >= 3 );
+                Frame.Step = EEvalStep::BranchCond;
+                PushEvalFrame( Machine, Frame.Expr->Get( 1 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+                return;
+            case EIntrinsicForm::Loop:
+                if ( Frame.Expr->Children.Length() <= 1 ) {
+                    FinishFrame( Machine, Make_OExprPtr_Empty() );
+                    return;
+                }
+                Frame.Step = EEvalStep::LoopBody;
+                Frame.Index = 1;
+                PushEvalFrame( Machine, Frame.Expr->Get( 1 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+                return;
+            case EIntrinsicForm::Yield:
+                assert( Frame.Expr->Children.Length() == 2 );
+                Frame.Step = EEvalStep::YieldValue;
+                PushEvalFrame( Machine, Frame.Expr->Get( 1 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+                return;
+            case EIntrinsicForm::For: {
+                // Evaluating the sequence may nest a run, so Frame is looked up again after.
+                const shared_ptr<OForLoop> Loop = Make_OForLoop( Machine, Frame.Expr );
+                State.Frames.Last().Iterator = Loop;
+                NextForIteration( Machine );
+                return;
+            }
+            case EIntrinsicForm::Set:
+                assert( Frame.Expr->Children.Length() == 3 );
+                Frame.Step = EEvalStep::SetValue;
+                PushEvalFrame( Machine, Frame.Expr->Get( 2 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+                return;
+            }
+        }
+    }
+    if ( Frame.Expr->Children.IsEmpty() ) {
+        FinishFrame( Machine, Frame.Expr );
+        return;
+    }
+    Frame.Step = EEvalStep::Children;
+    Frame.Index = 0;
+    Frame.LastOut = {};
+    PushEvalFrame( Machine, Frame.Expr->Get( 0 ), Frame.Mode, EEvalExprReturnMode::LastChild );
+}
+
+EEvalStatus StepEval( OMachinePtr Machine, const int Base, int MaxSteps ) {
+    OEvalState& State = Machine->Eval;
+    while ( State.Frames.Length() > Base ) {
+        if ( Machine->EvalError ) {
+            UnwindEval( Machine, Base );
+            return EEvalStatus::Error;
+        }
+        if ( MaxSteps >= 0 ) {
+            if ( MaxSteps == 0 ) {
+                return EEvalStatus::Running;
+            }
+            MaxSteps--;
+        }
+        OEvalFrame& Frame = State.Frames.Last();
+        switch ( Frame.Step ) {
+        case EEvalStep::Start: {
+            GStats.Evals++;
+            if ( TraceEnabled() ) {
+                const OToken& Token = TopAtom( Frame.Expr ).Token;
+                TraceWrite( ETraceEvent::Eval, TokenSymbol( Token, true ), Token.Line );
+            }
+            const int Slot = FindMemorySlot( Machine, Frame.Expr );
+            if ( Slot < 0 ) {
+                DispatchEval( Machine );
+                break;
+            }
+            const OExprPtr Found = Machine->Stack.Slots[ Slot ].Value;
+            OClosurePtr Closure{};
+            const OExprPtr Function = CalleeOf( Found, Closure );
+            // A name bound to a closure is its value. Only a call form such as (F X) calls it.
+            if ( Function != nullptr && ( Closure == nullptr || Frame.Expr->Children.IsNonEmpty() ) ) {
+                BeginCall( Machine, Frame, Function );
+                Frame.Closure = Closure;
+                Frame.Index = 1;
+                NextCallArg( Machine, Frame );
+            } else {
+                Frame.Step = EEvalStep::Lookup;
+                PushEvalFrame( Machine, Found, Frame.Mode, EEvalExprReturnMode::LastChild );
+            }
+            break;
+        }
+        case EEvalStep::Lookup:
+            Frame.Expr = State.Result;
+            DispatchEval( Machine );
+            break;
+        case EEvalStep::CallArg: {
+            const int Symbol = TokenSymbol( ParamAtom( Frame.Callee->Children[ Frame.Index ] ).Token, true );
+            Machine->Stack.Set( Symbol, State.Result );
+            Frame.Index++;
+            NextCallArg( Machine, Frame );
+            break;
+        }
+        case EEvalStep::CallBody:
+            FinishCall( Machine, Frame );
+            break;
+        case EEvalStep::StrictArg:
+            State.Args.Add( State.Result );
+            Frame.Index++;
+            NextStrictArg( Machine, Frame );
+            break;
+        case EEvalStep::BranchCond:
+            if ( AtomView( State.Result->Atom ) == TOKEN_FALSE ) {
+                if ( Frame.Expr->Children.Length() > 3 ) {
+                    Frame.Step = EEvalStep::BranchTaken;
+                    PushEvalFrame( Machine, Frame.Expr->Get( 3 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+                } else {
+                    FinishFrame( Machine, Make_OExprPtr_Empty() );
+                }
+            } else {
+                Frame.Step = EEvalStep::BranchTaken;
+                PushEvalFrame( Machine, Frame.Expr->Get( 2 ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+            }
+            break;
+        case EEvalStep::BranchTaken:
+            FinishFrame( Machine, State.Result );
+            break;
+        case EEvalStep::LoopBody: {
+            const OExprPtr Out = State.Result;
+            if ( Out->Type == OExprType::Break ) {
+                FinishFrame( Machine, Out->Children.Length() == 1 ? Out->Get( 0 ) : Make_OExprPtr_Empty() );
+                break;
+            }
+            Frame.Index = Frame.Index + 1 < Frame.Expr->Children.Length() ? Frame.Index + 1 : 1;
+            PushEvalFrame( Machine, Frame.Expr->Get( Frame.Index ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+            break;
+        }
+        case EEvalStep::SetValue:
+            Machine->Stack.Set( TokenSymbol( TopAtom( Frame.Expr->Children[ 1 ] ).Token, true ), State.Result );
+            FinishFrame( Machine, Make_OExprPtr_Empty() );
+            break;
+        case EEvalStep::YieldValue:
+            // Only the generator's own run can be suspended, not one nested in a native intrinsic.
+            if ( !State.Generator || Base != 0 ) {
+                RaiseEvalError( Machine, "yield outside of a generator, or inside the arguments of a native intrinsic." );
+                break;
+            }
+            Frame.Step = EEvalStep::YieldResume;
+            return EEvalStatus::Suspended;
+        case EEvalStep::YieldResume:
+            FinishFrame( Machine, Make_OExprPtr_Empty() );
+            break;
+        case EEvalStep::ForBody: {
+            const OExprPtr Out = State.Result;
+            if ( Out->Type == OExprType::Break ) {
+                FinishFrame( Machine, Out->Children.Length() == 1 ? Out->Get( 0 ) : Make_OExprPtr_Empty() );
+                break;
+            }
+            Frame.Index++;
+            if ( Frame.Index < Frame.Expr->Children.Length() ) {
+                PushEvalFrame( Machine, Frame.Expr->Get( Frame.Index ), EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+            } else {
+                NextForIteration( Machine );
+            }
+            break;
+        }
+        case EEvalStep::Children: {
+            const OExprPtr ExprOut = State.Result;
+            Frame.Expr->Children[ Frame.Index ]->Atom = ExprOut->Atom;
+            if ( ExprOut->Type == OExprType::Break ) {
+                FinishFrame( Machine, ExprOut->Children.Length() >= 1 ? ExprOut->Get( 0 ) : ExprOut );
+                break;
+            }
+            Frame.LastOut = ExprOut;
+            Frame.Index++;
+            if ( Frame.Index < Frame.Expr->Children.Length() ) {
+                PushEvalFrame( Machine, Frame.Expr->Get( Frame.Index ), Frame.Mode, EEvalExprReturnMode::LastChild );
+            } else {
+                // The result itself rather than the child it was written into, see EvalExprRecursive.
+                const bool UseLast = Frame.ReturnMode == EEvalExprReturnMode::LastChild && Frame.LastOut != nullptr;
+                FinishFrame( Machine, UseLast ? Frame.LastOut : Frame.Expr );
+            }
+            break;
+        }
+        }
+    }
+    return EEvalStatus::Done;
+}
+
+OExprPtr EvalExprStack( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
+    // A native intrinsic evaluating its arguments nests a run on the native stack.
+    if ( Machine->Eval.Frames.IsNonEmpty() && NativeStackExhausted( Machine ) ) {
+        RaiseEvalError( Machine, "Native stack exhausted by intrinsics nested in each other." );
+        return Make_OExprPtr_Empty();
+    }
+    const int Base = BeginEval( Machine, Expr, EvalIntrinsicMode, ReturnMode );
+    if ( StepEval( Machine, Base, -1 ) != EEvalStatus::Done ) {
+        return Make_OExprPtr_Empty();
+    }
+    return Machine->Eval.Result;
+}
+
+OExprPtr EvalExpr( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode ) {
+    if ( Machine->EvalError ) {
+        return Make_OExprPtr_Empty();
+    }
+    if ( Machine->Engine == EEvalEngine::Recursive ) {
+        return EvalExprRecursive( Machine, Expr, EvalIntrinsicMode, ReturnMode );
+    }
+    return EvalExprStack( Machine, Expr, EvalIntrinsicMode, ReturnMode );
 }
 
 OExprPtr EvalExpr( OMachinePtr Machine, const OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode ) {
@@ -785,26 +2216,56 @@ OExprPtr EvalExpr( OMachinePtr Machine, const OExprPtr Expr, const EEvalIntrinsi
 void ResetMachine( OMachinePtr Machine ) {
     Machine->EmptyIntrinsic = {};
     Machine->Intrinsics.Clear();
+    Machine->IndexedIntrinsics = -1;
     Machine->Stack.Clear();
+    Machine->Stack.Reserve();
+    Machine->Eval.Frames.Clear();
+    Machine->Eval.Frames.Arr.reserve( EVAL_RESERVE_FRAMES );
+    Machine->Eval.Args.Clear();
     Machine->ShouldExit = false;
+    Machine->EvalError = false;
+    Machine->Modules.clear();
     BuildIntrinsics( Machine );
-    Machine->Stack.PushStack();
+    PushFrame( Machine );
+}
+
+void Shutdown( OMachinePtr Machine ) {
+    Machine->Out.Flush();
+    for ( int i = 0; i < Machine->Writers.Length(); i++ ) {
+        if ( const OFileWriterPtr Writer = Machine->Writers[ i ].lock() ) {
+            Writer->Close();
+        }
+    }
+    if ( Machine->Profiler != nullptr ) {
+        Machine->Profiler->WriteReport();
+    }
+    if ( Machine->DumpTraceOnExit ) {
+        TraceDump( GTracer.DumpPath.c_str() );
+    }
+    if ( Machine->PrintStats ) {
+        std::cerr << GStats.ToString();
+    }
+    if ( Machine->Bench.Enabled ) {
+        std::cerr << Machine->Bench.ToJson( GStats.Evals, GStats.Calls, GStats.SpecializedCalls ) << std::endl;
+    }
 }
 
 OExprPtr Execute( OMachinePtr Machine, OExprPtr Program ) {
+    Machine->EvalError = false;
     OExprPtr Ret = EvalExpr( Machine, Program, EEvalIntrinsicMode::Execute );
     return Ret;
 }
 
+// Runs in the global frame, so definitions made at the prompt are indexed like a script's.
 void InterpreterLoop( OMachinePtr Machine ) {
-    Machine->Stack.PushStack();
     while ( !Machine->ShouldExit ) {
         string Input;
         std::getline( std::cin, Input );
         const TokenList Tokens = Tokenize( Input );
         const OExprPtr Program = ConstructRootExpr( Tokens );
         OExprPtr Out = Execute( Machine, Program );
-        cout << Out->Atom.Token.Token<< endl;
+        Machine->Out.Write( AtomView( Out->Atom ) );
+        Machine->Out.Write( '\n' );
+        Machine->Out.Flush();
     }
-    Machine->Stack.PopStack();
 }
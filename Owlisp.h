@@ -3,12 +3,17 @@
 #include "Containers.h"
 #include "Tokenizer.h"
 #include "IO.h"
+#include "Values.h"
+#include "Profiler.h"
+#include "Stats.h"
+#include "Trace.h"
 
 
 struct OExpr;
 struct OAtom;
 struct OMachine;
 struct OIntrinsic;
+struct OModule;
 
 typedef unsigned int uint;
 
@@ -22,12 +27,37 @@ typedef OMachine* OMachinePtr;
 typedef OIntrinsic* OIntrinsicPtr;
 #endif
 
+// True when the caller holds the only reference, so the node can be updated in place.
+bool IsUniquelyOwned( const OExprPtr& Ptr ) {
+#if MANAGE_EXPR_MEM
+    return Ptr.use_count() == 1;
+#else
+    return false;
+#endif
+}
+
 typedef OArray<OExprPtr> OExprList;
-typedef OArray<OExprList> StackFrames;
 typedef OArray<OIntrinsicPtr> OIntrinsics;
 typedef function<OExprPtr( const OExprPtr )> IntrinsicFunction;
 
+// The already evaluated arguments of a strict intrinsic, children [1, N) of its expression.
+struct OArgs {
+    const OExprPtr* Data;
+    int Count;
+
+    int Length() const {
+        return Count;
+    }
+
+    const OExprPtr& operator[]( const int Index ) const {
+        return Data[ Index ];
+    }
+};
+
+typedef function<OExprPtr( const OExprPtr, const OArgs& )> StrictIntrinsicFunction;
+
 const string TOKEN_DEFUNC = "defunc";
+const string TOKEN_IMPORT = "import";
 const string TOKEN_FALSE = "0";
 const string TOKEN_TRUE = "1";
 
@@ -54,10 +84,32 @@ enum class OExprType {
     Break
 };
 
+// How the Stack engine runs an intrinsic. Native intrinsics evaluate their own
+// arguments with EvalExpr; the other forms are driven by the engine itself.
+enum class EIntrinsicForm {
+    Native,
+    // Every argument is evaluated in order, then StrictFunction is called.
+    Strict,
+    // (? Cond Then Else)
+    Branch,
+    // (loop T1 T2 ...)
+    Loop,
+    // (= Name Value)
+    Set,
+    // (yield Value) suspends the generator running it.
+    Yield,
+    // (for Name Sequence Body...)
+    For
+};
+
 struct OIntrinsic {
     OExprType Type;
     string Token;
     IntrinsicFunction Function;
+    EIntrinsicForm Form = EIntrinsicForm::Native;
+    StrictIntrinsicFunction StrictFunction;
+    // Interned on first use by the tracer.
+    int Symbol = INVALID_SYMBOL;
 };
 
 enum class OAtomDataPrimitiveType : char {
@@ -79,6 +131,8 @@ struct OAtom {
     OAtomData PrimitiveData{};
     OAtomDataPrimitiveType PrimitiveType{};
     OToken Token{};
+    // Set for native values, which leave Token empty.
+    OObjectPtr Object{};
 };
 
 struct OExpr {
@@ -92,22 +146,355 @@ struct OExpr {
     }
 };
 
+struct OBinding {
+    int Symbol = INVALID_SYMBOL;
+    // A value, or an ExprFunc for defunc.
+    OExprPtr Value{};
+};
+
+const int FRAME_STACK_RESERVE_SLOTS = 1 << 14;
+const int FRAME_STACK_RESERVE_FRAMES = 1 << 12;
+const int GLOBAL_INDEX_MIN_CAPACITY = 1 << 10;
+
+// Open-addressing index from symbol to slot for the global frame. Global slots
+// are never moved or removed, so a slot stays a stable handle across redefinition.
+struct OGlobalIndex {
+    // Slot + 1 per bucket, 0 when empty. The capacity is a power of two.
+    vector<int> Buckets{};
+    int Count = 0;
+
+    void Clear() {
+        Buckets.clear();
+        Count = 0;
+    }
+
+    int Bucket( const int Symbol ) const {
+        return static_cast<int>( ( static_cast<uint32_t>( Symbol ) * 2654435769u ) & ( Buckets.size() - 1 ) );
+    }
+
+    // Slot bound to Symbol, or -1. Probes counts the buckets visited.
+    int Find( const int Symbol, const OArray<OBinding>& Slots, uint64& Probes ) const {
+        if ( Buckets.empty() ) {
+            return -1;
+        }
+        for ( int i = Bucket( Symbol );; i = ( i + 1 ) & ( Buckets.size() - 1 ) ) {
+            Probes++;
+            const int Entry = Buckets[ i ];
+            if ( Entry == 0 ) {
+                return -1;
+            }
+            if ( Slots[ Entry - 1 ].Symbol == Symbol ) {
+                return Entry - 1;
+            }
+        }
+    }
+
+    void Insert( const int Symbol, const int Slot, const OArray<OBinding>& Slots ) {
+        // Keep the load at or below one half.
+        if ( ( Count + 1 ) * 2 > static_cast<int>( Buckets.size() ) ) {
+            Grow( Slots );
+        }
+        int i = Bucket( Symbol );
+        while ( Buckets[ i ] != 0 ) {
+            i = ( i + 1 ) & ( Buckets.size() - 1 );
+        }
+        Buckets[ i ] = Slot + 1;
+        Count++;
+    }
+
+    void Grow( const OArray<OBinding>& Slots ) {
+        vector<int> Old = std::move( Buckets );
+        Buckets.assign( max<size_t>( GLOBAL_INDEX_MIN_CAPACITY, Old.size() * 2 ), 0 );
+        Count = 0;
+        for ( const int Entry : Old ) {
+            if ( Entry != 0 ) {
+                Insert( Slots[ Entry - 1 ].Symbol, Entry - 1, Slots );
+            }
+        }
+    }
+};
+
+// The bindings of every frame, kept in one contiguous array so pushing a
+// frame and binding parameters do not allocate. Frame 0 holds the globals,
+// which are also indexed by symbol so their number does not slow lookups.
+struct OFrameStack {
+    OArray<OBinding> Slots{};
+    OArray<int> FrameStarts{};
+    OGlobalIndex Globals{};
+
+    void Reserve() {
+        Slots.Arr.reserve( FRAME_STACK_RESERVE_SLOTS );
+        FrameStarts.Arr.reserve( FRAME_STACK_RESERVE_FRAMES );
+    }
+
+    // First slot above the global frame.
+    int LocalsStart() const {
+        return FrameStarts.Length() > 1 ? FrameStarts[ 1 ] : Slots.Length();
+    }
+
+    int Depth() const {
+        return FrameStarts.Length();
+    }
+
+    void Push() {
+        FrameStarts.Add( Slots.Length() );
+    }
+
+    void Pop() {
+        Slots.Arr.resize( FrameStarts.PopStack() );
+        if ( FrameStarts.IsEmpty() ) {
+            Globals.Clear();
+        }
+    }
+
+    void Clear() {
+        Slots.Clear();
+        FrameStarts.Clear();
+        Globals.Clear();
+    }
+
+    // Binds Symbol in the top frame, replacing an existing binding there.
+    void Set( const int Symbol, const OExprPtr& Value ) {
+        if ( FrameStarts.Length() == 1 ) {
+            uint64 Probes = 0;
+            const int Slot = Globals.Find( Symbol, Slots, Probes );
+            if ( Slot >= 0 ) {
+                Slots[ Slot ].Value = Value;
+                return;
+            }
+            Slots.Add( OBinding{ Symbol, Value } );
+            Globals.Insert( Symbol, Slots.Length() - 1, Slots );
+            return;
+        }
+        for ( int i = FrameStarts.Last(); i < Slots.Length(); i++ ) {
+            if ( Slots[ i ].Symbol == Symbol ) {
+                Slots[ i ].Value = Value;
+                return;
+            }
+        }
+        Slots.Add( OBinding{ Symbol, Value } );
+    }
+
+    // Unbinds a global as if it had never been bound. Its slot is kept, empty,
+    // for the next Set of the same symbol.
+    void Unset( const int Symbol ) {
+        uint64 Probes = 0;
+        const int Slot = Globals.Find( Symbol, Slots, Probes );
+        if ( Slot >= 0 ) {
+            Slots[ Slot ].Value = nullptr;
+        }
+    }
+
+    // Moves the frames above Depth into Starts and Bindings, for a generator that is suspending.
+    void Save( const int Depth, OArray<int>& Starts, OArray<OBinding>& Bindings ) {
+        const int FirstSlot = FrameStarts[ Depth ];
+        Starts.Clear();
+        for ( int i = Depth; i < FrameStarts.Length(); i++ ) {
+            Starts.Add( FrameStarts[ i ] - FirstSlot );
+        }
+        Bindings.Clear();
+        for ( int i = FirstSlot; i < Slots.Length(); i++ ) {
+            Bindings.Add( Slots[ i ] );
+        }
+        FrameStarts.Arr.resize( Depth );
+        Slots.Arr.resize( FirstSlot );
+    }
+
+    // Pushes frames saved by Save back on top.
+    void Restore( const OArray<int>& Starts, const OArray<OBinding>& Bindings ) {
+        const int FirstSlot = Slots.Length();
+        for ( int i = 0; i < Starts.Length(); i++ ) {
+            FrameStarts.Add( Starts[ i ] + FirstSlot );
+        }
+        for ( int i = 0; i < Bindings.Length(); i++ ) {
+            Slots.Add( Bindings[ i ] );
+        }
+    }
+
+    // Index of the innermost binding of Symbol, or -1. ScanLength counts the
+    // local slots and global buckets visited.
+    int Find( const int Symbol, uint64& ScanLength ) const {
+        const int Locals = LocalsStart();
+        for ( int i = Slots.Length() - 1; i >= Locals; i-- ) {
+            if ( Slots[ i ].Symbol == Symbol ) {
+                ScanLength += Slots.Length() - i;
+                return i;
+            }
+        }
+        ScanLength += Slots.Length() - Locals;
+        const int Slot = Globals.Find( Symbol, Slots, ScanLength );
+        return Slot >= 0 && Slots[ Slot ].Value == nullptr ? -1 : Slot;
+    }
+};
+
+// (fn Param* Body). Function is made once per fn site and shared by every closure
+// made there, so its params, body and specializations are prepared only once.
+// Captured holds the bindings of the call the closure was made in.
+struct OClosure : OObject {
+    OExprPtr Function{};
+    OArray<OBinding> Captured{};
+
+    string_view View() const override {
+        return "<fn>";
+    }
+};
+
+typedef shared_ptr<OClosure> OClosurePtr;
+
+// Kept on a fn or inline lambda site once its function is made.
+struct OLambdaSite : OObject {
+    OExprPtr Function{};
+
+    string_view View() const override {
+        return "<fn>";
+    }
+};
+
+enum class EEvalEngine {
+    // Iterative, keeps its continuations in OEvalState.
+    Stack,
+    // Recurses on the native stack.
+    Recursive
+};
+
+// What a continuation frame does with the Result of the evaluation it is waiting on.
+enum class EEvalStep : char {
+    Start,
+    Lookup,
+    CallArg,
+    CallBody,
+    StrictArg,
+    BranchCond,
+    BranchTaken,
+    LoopBody,
+    SetValue,
+    Children,
+    YieldValue,
+    YieldResume,
+    ForBody
+};
+
+struct OEvalFrame {
+    EEvalStep Step;
+    EEvalIntrinsicMode Mode;
+    EEvalExprReturnMode ReturnMode;
+    bool Traced;
+    int Index;
+    int ArgBase;
+    OExprPtr Expr;
+    // The defunc being called, for call frames.
+    OExprPtr Callee;
+    // Set when the callee is a closure.
+    OClosurePtr Closure;
+    // The intrinsic being run, if any.
+    OIntrinsicPtr Intrinsic;
+    OExprPtr LastOut;
+    // Iteration state of a for.
+    OObjectPtr Iterator;
+};
+
+const size_t DEFAULT_EVAL_BUDGET_MB = 512;
+// Used when the native stack size is unlimited.
+const size_t NATIVE_STACK_DEFAULT_SIZE = 8 << 20;
+const size_t NATIVE_STACK_MARGIN = 256 << 10;
+// The main thread's stack on Windows unless the linker is told otherwise.
+const size_t NATIVE_STACK_WINDOWS_SIZE = 1 << 20;
+
+// The Stack engine's continuation stack. A native intrinsic that calls EvalExpr
+// starts a nested run on top of the same frames, so the whole evaluation can be
+// inspected with (backtrace) and StepEval can be resumed after any step.
+const int EVAL_RESERVE_FRAMES = 1 << 12;
+
+struct OEvalState {
+    OArray<OEvalFrame> Frames{};
+    // Evaluated arguments of strict intrinsics in progress.
+    OExprList Args{};
+    OExprPtr Result{};
+    // Set on the state of a generator, the only place yield may suspend.
+    bool Generator = false;
+
+    size_t Bytes( const OFrameStack& Stack ) const {
+        return Frames.Length() * sizeof( OEvalFrame ) + Stack.Slots.Length() * sizeof( OBinding );
+    }
+};
+
+enum class EEvalStatus {
+    Done,
+    Running,
+    // A generator yielded. Result holds the value.
+    Suspended,
+    Error
+};
+
 struct OMachine {
     OIntrinsicPtr EmptyIntrinsic;
     OIntrinsics Intrinsics;
-    StackFrames Stack;
+    // Intrinsics by symbol id, built from Intrinsics by FindIntrinsic. A count
+    // that differs from Intrinsics' length marks it stale.
+    vector<OIntrinsicPtr> IntrinsicsBySymbol;
+    int IndexedIntrinsics = -1;
+    OFrameStack Stack;
+    OBufferedWriter Out;
+    // Eval errors and their backtraces. Stderr unless a Sink is set.
+    OBufferedWriter Err{ stderr };
+    // Set by --profile.
+    OProfilerPtr Profiler;
+    OBenchResult Bench;
+    // Set by --stats.
+    bool PrintStats;
+    // Set by --trace.
+    bool DumpTraceOnExit;
     bool ShouldExit;
+    // Set by --engine.
+    EEvalEngine Engine = EEvalEngine::Stack;
+    OEvalState Eval;
+    // Set by --eval-budget. Bounds the continuation frames and bindings of the Stack engine.
+    // Evaluations that native intrinsics start, such as the calls map makes,
+    // nest on the native stack, which the native stack guard bounds instead.
+    size_t EvalBudgetBytes = DEFAULT_EVAL_BUDGET_MB << 20;
+    // Both engines stop before the native stack gets closer than this to its limit.
+    const char* NativeStackBase = nullptr;
+    size_t NativeStackLimit = 0;
+    // Set when evaluation was aborted. Remaining work unwinds without evaluating.
+    bool EvalError;
+    // Files opened by (writer), flushed at exit if still open.
+    OArray<weak_ptr<OFileWriter>> Writers;
+    // Cleared by --no-specialize.
+    bool Specialize = true;
+    // Threads that parse a source, from --parse-threads. Zero picks one per core for large sources.
+    int ParseThreads = 0;
+    // Set by --hash-cons: repeated constants in a parsed source share one node.
+    bool HashCons = false;
+    // Modules loaded by import, by canonical path.
+    unordered_map<string, shared_ptr<OModule>> Modules;
+    // Directory that relative import paths start from: the running script's, or
+    // a module's own while its forms run. Empty is the working directory.
+    string ImportBase{};
 };
 
-OExprPtr EvalNamedFunction( OMachinePtr Machine, const OExprPtr Expr, const OExprPtr Function, const EEvalIntrinsicMode EvalIntrinsicMode );
+OExprPtr EvalNamedFunction( OMachinePtr Machine, const OExprPtr Expr, const OExprPtr Function, const EEvalIntrinsicMode EvalIntrinsicMode, const OClosure* Closure = nullptr );
 
 OExprPtr Make_OExprPtr_Empty();
 OExprPtr Make_OExprPtr( const OExprType Type );
 OExprPtr Make_OExprPtr_Data( const OToken& Token );
 OExprPtr Make_OExprPtr_Data( const OAtom& Atom, const string& Str );
+OExprPtr Make_OExprPtr_Object( const OAtom& Atom, const OObjectPtr& Object );
+// An integer carried unboxed in PrimitiveData, with its decimal text as the token.
+OExprPtr Make_OExprPtr_Int( const OAtom& Atom, const int Value );
 OIntrinsicPtr Make_OIntriniscPtr( const OExprType Type );
 OMachinePtr Make_OMachinePtr();
 
+void PushFrame( OMachinePtr Machine );
+void PopFrame( OMachinePtr Machine );
+void MakeStrict( OMachinePtr Machine, OIntrinsicPtr Intrinsic );
+// StackBase is an address near the bottom of the native stack, such as a local of main.
+void InitNativeStackGuard( OMachinePtr Machine, const char* StackBase );
+// Uses the calling thread's stack bounds instead. False where they are unknown.
+bool InitThreadStackGuard( OMachinePtr Machine );
+// Bytes of native stack between StackBase and the caller, or 0 without a guard.
+size_t NativeStackUsed( const OMachinePtr Machine );
+bool NativeStackExhausted( const OMachinePtr Machine );
+
 OToken Make_OToken( const OAtom& Atom, const string& Str );
 OToken Make_OToken( const string& Str );
 
@@ -115,25 +502,56 @@ OExprPtr ToOExpr_SingleNoEval( const TokenList& Tokens );
 
 OExprPtr ConstructRootExpr( const TokenList& Tokens, int StartIndex, int EndIndex );
 OExprPtr ConstructRootExpr( const TokenList& Tokens );
-int CompareTo( const string& LHS, const string& RHS );
+int CompareTo( string_view LHS, string_view RHS );
 
 enum class EInExprFuncFormat {
     FirstTokenName
 };
 
 void SetFunctionMem( OMachinePtr Machine, const OExprPtr InExpr, const EInExprFuncFormat InExprFuncFormat, const OExprPtr ExprFunc );
+int FindMemorySlot( const OMachinePtr Machine, const OExprPtr Expr );
+const OIntrinsicPtr FindIntrinsic( const OMachinePtr Machine, const OExprPtr Expr );
 OExprPtr EvalInMemory( const OMachinePtr Machine, const OExprPtr Expr, EEvalIntrinsicMode EvalIntrinsicMode );
+// The function Value runs when called: a defunc itself, or the function of a closure, which is put in Closure.
+OExprPtr CalleeOf( const OExprPtr& Value, OClosurePtr& Closure );
+// Binds the captured values of Closure in the top frame, except where a param already is.
+void BindCaptured( OMachinePtr Machine, const OClosure& Closure );
+// The function of a fn or inline lambda site: Name, then the site's children from First on.
+OExprPtr LambdaFunction( const OExprPtr Site, const OExprPtr Name, const int First );
+OClosurePtr Make_OClosure( OMachinePtr Machine, const OExprPtr Function );
 
 OExprPtr EvalExpr( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode );
 OExprPtr EvalExpr( OMachinePtr Machine, OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode );
 
+// Pushes Expr onto the continuation stack. Returns the frame count to run StepEval down to.
+int BeginEval( OMachinePtr Machine, const OExprPtr Expr, const EEvalIntrinsicMode EvalIntrinsicMode, const EEvalExprReturnMode ReturnMode );
+// Runs at most MaxSteps continuation steps (all of them when negative). The result is in Machine->Eval.Result once Done.
+EEvalStatus StepEval( OMachinePtr Machine, const int Base, int MaxSteps );
+// Starts evaluating the top continuation frame's expression.
+void DispatchEval( OMachinePtr Machine );
+void RaiseEvalError( OMachinePtr Machine, const string& Message );
+void PrintBacktrace( OMachinePtr Machine, const int MaxFrames, OBufferedWriter& Writer );
+
 const OAtom& TopAtom( const OExprPtr Expr );
+int TokenSymbol( const OToken& Token, const bool Define );
+// A defunc parameter is a name, or a typed name such as (int: N).
+const OAtom& ParamAtom( const OExprPtr Param );
+// The type of a typed parameter without its colon, or empty.
+string_view ParamType( const OExprPtr Param );
 const OAtom& LastAtom( const OExprPtr Expr );
+string_view AtomView( const OAtom& Atom );
+void SetAtomInt( OAtom& Atom, const int Value );
+bool IsIntAtom( const OAtom& Atom );
+bool AtomIntValue( const OAtom& Atom, int& Out );
+int AtomToInt( const OAtom& Atom );
+bool AtomsEqual( const OAtom& LHS, const OAtom& RHS );
 
 void ResetMachine( OMachinePtr Machine );
 void BuildIntrinsics( OMachinePtr Machine );
 
 OExprPtr Execute( OMachinePtr Machine, OExprPtr Program );
+// Flushes output and writes any reports requested on the command line.
+void Shutdown( OMachinePtr Machine );
 
 void InterpreterLoop( OMachinePtr Machine );
 
@@ -0,0 +1,239 @@
+#pragma once
+
+// Front end for large sources. A structural pass looks at 16 bytes at a time
+// for parens, backticks and newlines, and records every point between two
+// top-level forms. The source is cut at those points into one run per thread.
+// Each run is tokenized and parsed on its own thread, and the trees are joined
+// in source order. Names are interned between the two parallel steps, in
+// source order, so every symbol gets the id a serial parse would give it.
+
+#include "AstPool.h"
+
+#include <bit>
+#include <thread>
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+// Without an explicit thread count, smaller sources are parsed on the calling thread.
+const size_t PARSE_PARALLEL_MIN_BYTES = 1 << 20;
+const int PARSE_BLOCK_BYTES = 16;
+
+// A point just past the closing paren of a top-level form.
+struct OFormBoundary {
+    size_t Offset = 0;
+    int Line = 1;
+    int Indent = 0;
+};
+
+struct OStructuralIndex {
+    vector<OFormBoundary> Boundaries{};
+    // False when the parens or backticks do not pair up. The serial parser reports those.
+    bool Balanced = true;
+};
+
+// One bit per byte of Block in each mask.
+void ScanBlock( const char* Block, unsigned int& Open, unsigned int& Close, unsigned int& Quote, unsigned int& Newline ) {
+#if defined( __SSE2__ )
+    const __m128i Bytes = _mm_loadu_si128( reinterpret_cast<const __m128i*>( Block ) );
+    Open = static_cast<unsigned int>( _mm_movemask_epi8( _mm_cmpeq_epi8( Bytes, _mm_set1_epi8( ExpStart[ 0 ] ) ) ) );
+    Close = static_cast<unsigned int>( _mm_movemask_epi8( _mm_cmpeq_epi8( Bytes, _mm_set1_epi8( ExpEnd[ 0 ] ) ) ) );
+    Quote = static_cast<unsigned int>( _mm_movemask_epi8( _mm_cmpeq_epi8( Bytes, _mm_set1_epi8( StrLit[ 0 ] ) ) ) );
+    Newline = static_cast<unsigned int>( _mm_movemask_epi8( _mm_cmpeq_epi8( Bytes, _mm_set1_epi8( '\n' ) ) ) );
+#else
+    Open = Close = Quote = Newline = 0;
+    for ( int i = 0; i < PARSE_BLOCK_BYTES; i++ ) {
+        Open |= ( Block[ i ] == ExpStart[ 0 ] ) << i;
+        Close |= ( Block[ i ] == ExpEnd[ 0 ] ) << i;
+        Quote |= ( Block[ i ] == StrLit[ 0 ] ) << i;
+        Newline |= ( Block[ i ] == '\n' ) << i;
+    }
+#endif
+}
+
+// Follows the same literal rules as Tokenize: a backtick opens or closes a
+// literal anywhere, and parens inside one are text.
+OStructuralIndex IndexStructure( string_view Source ) {
+    OStructuralIndex Index{};
+    int Depth = 0;
+    bool InLiteral = false;
+    int Line = 1;
+    size_t LineStart = 0;
+    for ( size_t Block = 0; Block < Source.size(); Block += PARSE_BLOCK_BYTES ) {
+        const char* Bytes = Source.data() + Block;
+        // The last block is copied out so the load stays inside the buffer.
+        char Tail[ PARSE_BLOCK_BYTES ]{};
+        if ( Source.size() - Block < PARSE_BLOCK_BYTES ) {
+            memcpy( Tail, Bytes, Source.size() - Block );
+            Bytes = Tail;
+        }
+        unsigned int Open = 0;
+        unsigned int Close = 0;
+        unsigned int Quote = 0;
+        unsigned int Newline = 0;
+        ScanBlock( Bytes, Open, Close, Quote, Newline );
+        for ( unsigned int Pending = Open | Close | Quote; Pending != 0; Pending &= Pending - 1 ) {
+            const unsigned int At = Pending & -Pending;
+            if ( Quote & At ) {
+                InLiteral = !InLiteral;
+            } else if ( InLiteral ) {
+                continue;
+            } else if ( Open & At ) {
+                Depth++;
+            } else if ( --Depth < 0 ) {
+                Index.Balanced = false;
+                return Index;
+            } else if ( Depth == 0 ) {
+                const unsigned int Before = Newline & ( At - 1 );
+                OFormBoundary Boundary{ Block + countr_zero( At ) + 1, Line + popcount( Before ), 0 };
+                const size_t Start = Before != 0 ? Block + ( 31 - countl_zero( Before ) ) + 1 : LineStart;
+                Boundary.Indent = static_cast<int>( Boundary.Offset - Start );
+                Index.Boundaries.push_back( Boundary );
+            }
+        }
+        if ( Newline != 0 ) {
+            Line += popcount( Newline );
+            LineStart = Block + ( 31 - countl_zero( Newline ) ) + 1;
+        }
+    }
+    Index.Balanced = Depth == 0 && !InLiteral;
+    return Index;
+}
+
+// The tree for Tokens, built through an AST pool when the parens nest.
+// AstNodes is the size of that pool, and SharedNodes the occurrences that
+// reuse a node with HashCons.
+OExprPtr ParseTokens( const TokenList& Tokens, const bool HashCons, uint64& AstNodes, uint64& SharedNodes ) {
+    OAstPool Pool{};
+    if ( !BuildAstPool( Tokens, Pool ) ) {
+        return ConstructRootExpr( Tokens );
+    }
+    AstNodes = Pool.NodeCount();
+    OConsTable Cons{};
+    if ( HashCons ) {
+        FindSharedNodes( Pool, Cons );
+    }
+    const OExprPtr Root = MaterializeAst( Pool, Pool.Root, HashCons ? &Cons : nullptr );
+    SharedNodes = Cons.SharedNodes;
+    return Root;
+}
+
+struct OParseRun {
+    OFormBoundary Start{};
+    size_t End = 0;
+    TokenList Tokens{};
+    OTokenNames Names{};
+    // The interned id of each entry of Names.
+    vector<int> Symbols{};
+    OExprPtr Root{};
+    uint64 AstNodes = 0;
+    uint64 SharedNodes = 0;
+    uint64 Allocations[ static_cast<int>( EAllocSite::Count ) ]{};
+};
+
+// Runs Step on every run, each on its own thread.
+template<typename F>
+void ForEachRun( vector<OParseRun>& Runs, F Step ) {
+    vector<thread> Threads{};
+    for ( OParseRun& Run : Runs ) {
+        Threads.emplace_back( [&Run, &Step]() { Step( Run ); } );
+    }
+    for ( thread& Thread : Threads ) {
+        Thread.join();
+    }
+}
+
+// Threads is the number of runs to cut the source into. Zero picks one per core
+// for sources of PARSE_PARALLEL_MIN_BYTES or more. With HashCons each run shares
+// its repeated constants, see OConsTable.
+OExprPtr ParseProgram( const string& Source, int Threads, const bool HashCons, OBenchResult* Bench = nullptr ) {
+    uint64 StartNs = NowNs();
+    if ( Threads <= 0 ) {
+        Threads = Source.size() >= PARSE_PARALLEL_MIN_BYTES ? static_cast<int>( thread::hardware_concurrency() ) : 1;
+    }
+    OStructuralIndex Index{};
+    if ( Threads > 1 ) {
+        Index = IndexStructure( Source );
+    }
+    if ( !Index.Balanced || Index.Boundaries.size() < 2 ) {
+        const TokenList Tokens = Tokenize( Source );
+        if ( Bench != nullptr ) {
+            Bench->TokenizeNs = NowNs() - StartNs;
+            Bench->TokenCount = Tokens.Length();
+            StartNs = NowNs();
+        }
+        uint64 AstNodes = 0;
+        uint64 SharedNodes = 0;
+        const OExprPtr Program = ParseTokens( Tokens, HashCons, AstNodes, SharedNodes );
+        if ( Bench != nullptr ) {
+            Bench->ParseNs = NowNs() - StartNs;
+            Bench->AstNodes = AstNodes;
+            Bench->SharedNodes = SharedNodes;
+        }
+        return Program;
+    }
+    // Each run ends at the first boundary past its share of the bytes.
+    vector<OParseRun> Runs( 1 );
+    for ( int i = 1; i < Threads; i++ ) {
+        const size_t Target = Source.size() * i / Threads;
+        const auto Cut = lower_bound( Index.Boundaries.begin(), Index.Boundaries.end(), Target, []( const OFormBoundary& Boundary, const size_t Offset ) {
+            return Boundary.Offset < Offset;
+        } );
+        if ( Cut == Index.Boundaries.end() || Cut->Offset <= Runs.back().Start.Offset || Cut->Offset >= Source.size() ) {
+            continue;
+        }
+        Runs.back().End = Cut->Offset;
+        Runs.push_back( OParseRun{ *Cut } );
+    }
+    Runs.back().End = Source.size();
+    ForEachRun( Runs, [&Source]( OParseRun& Run ) {
+        const string_view Text = string_view( Source ).substr( Run.Start.Offset, Run.End - Run.Start.Offset );
+        Run.Tokens = Tokenize( Text, Run.Start.Line, Run.Start.Indent, &Run.Names );
+    } );
+    uint64 TokenCount = 0;
+    for ( OParseRun& Run : Runs ) {
+        for ( const string& Name : Run.Names.Names ) {
+            Run.Symbols.push_back( GSymbols.Intern( Name ) );
+        }
+        TokenCount += Run.Tokens.Length();
+    }
+    if ( Bench != nullptr ) {
+        Bench->TokenizeNs = NowNs() - StartNs;
+        Bench->TokenCount = TokenCount;
+        StartNs = NowNs();
+    }
+    ForEachRun( Runs, [HashCons]( OParseRun& Run ) {
+        for ( int i = 0; i < Run.Tokens.Length(); i++ ) {
+            OToken& Token = Run.Tokens[ i ];
+            if ( Token.Symbol >= 0 ) {
+                Token.Symbol = Run.Symbols[ Token.Symbol ];
+            }
+        }
+        Run.Root = ParseTokens( Run.Tokens, HashCons, Run.AstNodes, Run.SharedNodes );
+        memcpy( Run.Allocations, GStats.Allocations, sizeof( Run.Allocations ) );
+    } );
+    OExprPtr Program = Make_OExprPtr( OExprType::Expr );
+    uint64 AstNodes = 0;
+    uint64 SharedNodes = 0;
+    for ( const OParseRun& Run : Runs ) {
+        AstNodes += Run.AstNodes;
+        SharedNodes += Run.SharedNodes;
+        for ( int i = 0; i < static_cast<int>( EAllocSite::Count ); i++ ) {
+            GStats.Allocations[ i ] += Run.Allocations[ i ];
+        }
+        // A run of one token parses to that token rather than a list of it.
+        if ( Run.Root->Type == OExprType::Data ) {
+            Program->Children.Add( Run.Root );
+            continue;
+        }
+        for ( int i = 0; i < Run.Root->Children.Length(); i++ ) {
+            Program->Children.Add( Run.Root->Children[ i ] );
+        }
+    }
+    if ( Bench != nullptr ) {
+        Bench->ParseNs = NowNs() - StartNs;
+        Bench->AstNodes = AstNodes;
+        Bench->SharedNodes = SharedNodes;
+    }
+    return Program;
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+// Immutable collections that share structure between versions. A list is a
+// chain of cells, so cons, first and rest are O(1) and never copy. A vector is
+// a 32-way trie with its last, partly filled leaf kept aside as the tail, so
+// conj copies at most one path and nth walks a few levels. Both are sequences
+// that map, reduce, strjoin and for walk like any other.
+
+#include "Sequences.h"
+
+const int PVEC_BITS = 5;
+const int PVEC_WIDTH = 1 << PVEC_BITS;
+const int PVEC_MASK = PVEC_WIDTH - 1;
+
+struct OListCell {
+    OExprPtr Value{};
+    shared_ptr<OListCell> Next{};
+    int Length = 1;
+
+    // Unlinks the cells this one alone holds one at a time, so dropping a long
+    // list does not recurse once per cell.
+    ~OListCell() {
+        shared_ptr<OListCell> Link = std::move( Next );
+        while ( Link != nullptr && Link.use_count() == 1 ) {
+            Link = std::move( Link->Next );
+        }
+    }
+};
+
+typedef shared_ptr<OListCell> OListCellPtr;
+
+// Text of a collection as it prints: its values separated by spaces in Open and Close.
+template<typename F>
+string CollectionText( const char Open, const char Close, F ForEach ) {
+    string Text( 1, Open );
+    bool First = true;
+    ForEach( [&Text, &First]( const OExprPtr& Value ) {
+        if ( !First ) {
+            Text += ' ';
+        }
+        First = false;
+        Text += TrimEnclosingQuotesView( AtomView( Value->Atom ) );
+    } );
+    Text += Close;
+    return Text;
+}
+
+// (list A B ...) and (cons Value List). An empty list has no cells.
+struct OList : OSequence {
+    OListCellPtr Head{};
+    // Position of a walk over the list.
+    const OListCell* Cursor = nullptr;
+    mutable string Text{};
+    mutable bool HasText = false;
+
+    int Count() const {
+        return Head != nullptr ? Head->Length : 0;
+    }
+
+    bool Next( OExprPtr& Out ) override {
+        if ( Cursor == nullptr ) {
+            return false;
+        }
+        Out = Cursor->Value;
+        Cursor = Cursor->Next.get();
+        return true;
+    }
+
+    OSequencePtr Fresh() const override;
+
+    string_view View() const override {
+        if ( !HasText ) {
+            Text = CollectionText( '(', ')', [this]( auto Add ) {
+                for ( const OListCell* Cell = Head.get(); Cell != nullptr; Cell = Cell->Next.get() ) {
+                    Add( Cell->Value );
+                }
+            } );
+            HasText = true;
+        }
+        return Text;
+    }
+};
+
+typedef shared_ptr<OList> OListPtr;
+
+OListPtr Make_OList( const OListCellPtr& Head ) {
+    OListPtr List = make_shared<OList>();
+    List->Head = Head;
+    List->Cursor = Head.get();
+    return List;
+}
+
+OSequencePtr OList::Fresh() const {
+    return Make_OList( Head );
+}
+
+OListPtr ListCons( const OExprPtr& Value, const OListCellPtr& Tail ) {
+    OListCellPtr Cell = make_shared<OListCell>();
+    Cell->Value = Value;
+    Cell->Next = Tail;
+    Cell->Length = Tail != nullptr ? Tail->Length + 1 : 1;
+    return Make_OList( Cell );
+}
+
+// A trie node. Leaves hold values and inner nodes hold children, up to PVEC_WIDTH of either.
+struct OVectorNode {
+    vector<shared_ptr<const OVectorNode>> Children{};
+    vector<OExprPtr> Values{};
+};
+
+typedef shared_ptr<const OVectorNode> OVectorNodePtr;
+
+// (vec A B ...) and (conj Vector Value). Offset is where the vector starts in the
+// trie, so rest shares the whole trie instead of shifting it.
+struct OVector : OTuple {
+    OVectorNodePtr Root = make_shared<OVectorNode>();
+    shared_ptr<const vector<OExprPtr>> Tail = make_shared<vector<OExprPtr>>();
+    // Values in the trie and tail, including the Offset skipped ones.
+    int Total = 0;
+    int Shift = PVEC_BITS;
+    int Offset = 0;
+    mutable string Text{};
+    mutable bool HasText = false;
+
+    int FieldCount() const override {
+        return Total - Offset;
+    }
+
+    // Index of the first value in the tail.
+    int TailStart() const {
+        return Total < PVEC_WIDTH ? 0 : ( ( Total - 1 ) >> PVEC_BITS ) << PVEC_BITS;
+    }
+
+    OExprPtr Field( const int N ) const override {
+        const int At = Offset + N;
+        if ( At >= TailStart() ) {
+            return ( *Tail )[ At & PVEC_MASK ];
+        }
+        const OVectorNode* Node = Root.get();
+        for ( int Level = Shift; Level > 0; Level -= PVEC_BITS ) {
+            Node = Node->Children[ ( At >> Level ) & PVEC_MASK ].get();
+        }
+        return Node->Values[ At & PVEC_MASK ];
+    }
+
+    OSequencePtr Fresh() const override;
+
+    string_view View() const override {
+        if ( !HasText ) {
+            Text = CollectionText( '[', ']', [this]( auto Add ) {
+                for ( int i = 0; i < FieldCount(); i++ ) {
+                    Add( Field( i ) );
+                }
+            } );
+            HasText = true;
+        }
+        return Text;
+    }
+};
+
+typedef shared_ptr<OVector> OVectorPtr;
+
+// A new version sharing From's trie and tail, without its cached text.
+OVectorPtr VectorFrom( const OVector& From ) {
+    OVectorPtr Vector = make_shared<OVector>();
+    Vector->Root = From.Root;
+    Vector->Tail = From.Tail;
+    Vector->Total = From.Total;
+    Vector->Shift = From.Shift;
+    Vector->Offset = From.Offset;
+    return Vector;
+}
+
+OSequencePtr OVector::Fresh() const {
+    return VectorFrom( *this );
+}
+
+OVectorNodePtr VectorPath( const int Level, const OVectorNodePtr& Leaf ) {
+    if ( Level == 0 ) {
+        return Leaf;
+    }
+    shared_ptr<OVectorNode> Node = make_shared<OVectorNode>();
+    Node->Children.push_back( VectorPath( Level - PVEC_BITS, Leaf ) );
+    return Node;
+}
+
+// A copy of the path from Parent down to the slot of the leaf at Index, with Leaf put there.
+OVectorNodePtr VectorPushLeaf( const int Level, const OVectorNode& Parent, const int Index, const OVectorNodePtr& Leaf ) {
+    shared_ptr<OVectorNode> Node = make_shared<OVectorNode>( Parent );
+    const size_t Slot = ( Index >> Level ) & PVEC_MASK;
+    if ( Level == PVEC_BITS ) {
+        Node->Children.push_back( Leaf );
+    } else if ( Slot < Node->Children.size() ) {
+        Node->Children[ Slot ] = VectorPushLeaf( Level - PVEC_BITS, *Node->Children[ Slot ], Index, Leaf );
+    } else {
+        Node->Children.push_back( VectorPath( Level - PVEC_BITS, Leaf ) );
+    }
+    return Node;
+}
+
+// Puts Leaf into the trie as its last leaf. Vector's Total already counts its values.
+void VectorAddLeaf( OVector& Vector, const OVectorNodePtr& Leaf ) {
+    if ( ( Vector.Total >> PVEC_BITS ) > ( 1 << Vector.Shift ) ) {
+        shared_ptr<OVectorNode> Root = make_shared<OVectorNode>();
+        Root->Children.push_back( Vector.Root );
+        Root->Children.push_back( VectorPath( Vector.Shift, Leaf ) );
+        Vector.Root = Root;
+        Vector.Shift += PVEC_BITS;
+    } else {
+        Vector.Root = VectorPushLeaf( Vector.Shift, *Vector.Root, Vector.Total - 1, Leaf );
+    }
+}
+
+OVectorPtr VectorConj( const OVector& From, const OExprPtr& Value ) {
+    OVectorPtr Vector = VectorFrom( From );
+    if ( From.Total - From.TailStart() < PVEC_WIDTH ) {
+        shared_ptr<vector<OExprPtr>> Tail = make_shared<vector<OExprPtr>>( *From.Tail );
+        Tail->push_back( Value );
+        Vector->Tail = Tail;
+        Vector->Total++;
+        return Vector;
+    }
+    // The tail is full: it becomes a leaf of the trie and a new tail starts.
+    shared_ptr<OVectorNode> Leaf = make_shared<OVectorNode>();
+    Leaf->Values = *From.Tail;
+    VectorAddLeaf( *Vector, Leaf );
+    Vector->Tail = make_shared<vector<OExprPtr>>( 1, Value );
+    Vector->Total++;
+    return Vector;
+}
+
+// A vector of Values, built a leaf at a time.
+OVectorPtr Make_OVector( vector<OExprPtr> Values ) {
+    OVectorPtr Vector = make_shared<OVector>();
+    const int Count = static_cast<int>( Values.size() );
+    const int TailStart = Count < PVEC_WIDTH ? 0 : ( ( Count - 1 ) >> PVEC_BITS ) << PVEC_BITS;
+    for ( int Start = 0; Start < TailStart; Start += PVEC_WIDTH ) {
+        shared_ptr<OVectorNode> Leaf = make_shared<OVectorNode>();
+        Leaf->Values.assign( make_move_iterator( Values.begin() + Start ), make_move_iterator( Values.begin() + Start + PVEC_WIDTH ) );
+        Vector->Total = Start + PVEC_WIDTH;
+        VectorAddLeaf( *Vector, Leaf );
+    }
+    Vector->Tail = make_shared<vector<OExprPtr>>( make_move_iterator( Values.begin() + TailStart ), make_move_iterator( Values.end() ) );
+    Vector->Total = Count;
+    return Vector;
+}
+
+OVectorPtr VectorRest( const OVector& From ) {
+    OVectorPtr Vector = VectorFrom( From );
+    if ( Vector->FieldCount() > 0 ) {
+        Vector->Offset++;
+    }
+    return Vector;
+}
+
+OListPtr AsList( const OExprPtr& Value ) {
+    return dynamic_pointer_cast<OList>( Value->Atom.Object );
+}
+
+OVectorPtr AsVector( const OExprPtr& Value ) {
+    return dynamic_pointer_cast<OVector>( Value->Atom.Object );
+}
+
+// An empty value, such as the result of (), stands for the empty list.
+bool IsEmptyValue( const OExprPtr& Value ) {
+    return Value->Atom.Object == nullptr && Value->Children.IsEmpty() && AtomView( Value->Atom ).empty();
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+typedef unsigned long long uint64;
+
+uint64 NowNs() {
+    return static_cast<uint64>( chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+// One profiled function: a defunc, keyed by its name and the line it was
+// defined on, or an intrinsic, keyed by its name.
+struct OProfileEntry {
+    string Name;
+    int Line{};
+    bool Native{};
+    uint64 Calls{};
+    uint64 InclusiveNs{};
+    uint64 ExclusiveNs{};
+    // Active calls, so recursive calls only count inclusive time once.
+    int Depth{};
+};
+
+// Call tree node, used for the collapsed stack output.
+struct OProfileNode {
+    int Entry{};
+    int Parent{};
+    uint64 ExclusiveNs{};
+    unordered_map<int, int> Children{};
+};
+
+struct OProfileActive {
+    int Node{};
+    uint64 StartNs{};
+    uint64 ChildNs{};
+};
+
+struct OProfiler {
+    string OutputBase = "owlisp-profile";
+    vector<OProfileEntry> Entries{};
+    unordered_map<const void*, int> EntryIndex{};
+    unordered_map<string, int> EntryByName{};
+    vector<OProfileNode> Nodes{ OProfileNode{ -1, -1 } };
+    vector<OProfileActive> Active{};
+
+    // Entries are keyed by name, line and kind. Key, the function's address,
+    // only speeds up finding one: a freed function's address can be reused by
+    // another, so a hit counts only when the entry is the same function.
+    int FindEntry( const void* Key, const string& Name, const int Line, const bool Native ) {
+        auto Found = EntryIndex.find( Key );
+        if ( Found != EntryIndex.end() ) {
+            const OProfileEntry& Entry = Entries[ Found->second ];
+            if ( Entry.Line == Line && Entry.Native == Native && Entry.Name == Name ) {
+                return Found->second;
+            }
+        }
+        // Redefinitions at the same place share an entry.
+        const string FullName = Name + ( Native ? "!" : ":" ) + to_string( Line );
+        auto ByName = EntryByName.find( FullName );
+        int Index = 0;
+        if ( ByName != EntryByName.end() ) {
+            Index = ByName->second;
+        } else {
+            Index = static_cast<int>( Entries.size() );
+            Entries.push_back( { Name, Line, Native } );
+            EntryByName[ FullName ] = Index;
+        }
+        EntryIndex[ Key ] = Index;
+        return Index;
+    }
+
+    void Enter( const void* Key, const string& Name, const int Line, const bool Native ) {
+        const int Entry = FindEntry( Key, Name, Line, Native );
+        const int Parent = Active.empty() ? 0 : Active.back().Node;
+        int Node = 0;
+        auto Child = Nodes[ Parent ].Children.find( Entry );
+        if ( Child != Nodes[ Parent ].Children.end() ) {
+            Node = Child->second;
+        } else {
+            Node = static_cast<int>( Nodes.size() );
+            Nodes[ Parent ].Children[ Entry ] = Node;
+            Nodes.push_back( { Entry, Parent } );
+        }
+        Entries[ Entry ].Calls++;
+        Entries[ Entry ].Depth++;
+        Active.push_back( { Node, NowNs(), 0 } );
+    }
+
+    void Exit() {
+        const OProfileActive Call = Active.back();
+        Active.pop_back();
+        const uint64 ElapsedNs = NowNs() - Call.StartNs;
+        const uint64 SelfNs = ElapsedNs - min( ElapsedNs, Call.ChildNs );
+        OProfileNode& Node = Nodes[ Call.Node ];
+        OProfileEntry& Entry = Entries[ Node.Entry ];
+        Node.ExclusiveNs += SelfNs;
+        Entry.ExclusiveNs += SelfNs;
+        Entry.Depth--;
+        if ( Entry.Depth == 0 ) {
+            Entry.InclusiveNs += ElapsedNs;
+        }
+        if ( !Active.empty() ) {
+            Active.back().ChildNs += ElapsedNs;
+        }
+    }
+
+    // Moves the calls above Depth aside while a generator is suspended.
+    void Suspend( const size_t Depth, vector<OProfileActive>& Saved ) {
+        Saved.assign( Active.begin() + Depth, Active.end() );
+        Active.resize( Depth );
+    }
+
+    void Resume( const vector<OProfileActive>& Saved ) {
+        Active.insert( Active.end(), Saved.begin(), Saved.end() );
+    }
+
+    string EntryLabel( const OProfileEntry& Entry ) const {
+        return Entry.Native ? Entry.Name : Entry.Name + ":" + to_string( Entry.Line );
+    }
+
+    void WriteFolded( ofstream& File, const int NodeIndex, const string& Prefix ) const {
+        const OProfileNode& Node = Nodes[ NodeIndex ];
+        string Stack = Prefix;
+        if ( Node.Entry >= 0 ) {
+            Stack += ( Stack.empty() ? "" : ";" ) + EntryLabel( Entries[ Node.Entry ] );
+            if ( Node.ExclusiveNs > 0 ) {
+                File << Stack << " " << Node.ExclusiveNs << "\n";
+            }
+        }
+        for ( const auto& Child : Node.Children ) {
+            WriteFolded( File, Child.second, Stack );
+        }
+    }
+
+    // Writes <OutputBase>.txt, sorted by exclusive time, and <OutputBase>.folded for flamegraph tools.
+    void WriteReport() const {
+        vector<int> Order( Entries.size() );
+        for ( int i = 0; i < static_cast<int>( Order.size() ); i++ ) {
+            Order[ i ] = i;
+        }
+        sort( Order.begin(), Order.end(), [&]( int L, int R ) {
+            return Entries[ L ].ExclusiveNs > Entries[ R ].ExclusiveNs;
+        } );
+
+        ofstream Report{ OutputBase + ".txt" };
+        char Line[ 256 ];
+        snprintf( Line, sizeof( Line ), "%12s %14s %14s  %s\n", "Calls", "Inclusive ms", "Exclusive ms", "Function" );
+        Report << Line;
+        for ( const int Index : Order ) {
+            const OProfileEntry& Entry = Entries[ Index ];
+            snprintf( Line, sizeof( Line ), "%12llu %14.3f %14.3f  ", Entry.Calls, Entry.InclusiveNs / 1e6, Entry.ExclusiveNs / 1e6 );
+            Report << Line << Entry.Name;
+            if ( Entry.Native ) {
+                Report << " (intrinsic)\n";
+            } else {
+                Report << " (line " << Entry.Line << ")\n";
+            }
+        }
+
+        ofstream Folded{ OutputBase + ".folded" };
+        WriteFolded( Folded, 0, "" );
+    }
+};
+
+typedef shared_ptr<OProfiler> OProfilerPtr;
+
+// Peak resident set size of this process in kilobytes, 0 where unsupported.
+long PeakRssKb() {
+#if defined(_WIN32)
+    return 0;
+#else
+    rusage Usage{};
+    getrusage( RUSAGE_SELF, &Usage );
+#if defined(__APPLE__)
+    return Usage.ru_maxrss / 1024;
+#else
+    return Usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Phase timings for --bench, reported as one JSON object at exit.
+struct OBenchResult {
+    bool Enabled{};
+    uint64 TokenCount{};
+    uint64 TokenizeNs{};
+    uint64 ParseNs{};
+    uint64 AstNodes{};
+    // Occurrences that reuse an earlier node under --hash-cons.
+    uint64 SharedNodes{};
+    uint64 ExecuteNs{};
+
+    // Specialized bodies skip the evaluator, so ns_per_call is the cost to compare
+    // across engines; ns_per_eval only covers the generic path.
+    string ToJson( const uint64 EvalCount, const uint64 CallCount, const uint64 SpecializedCount ) const {
+        const double ExecuteSec = ExecuteNs / 1e9;
+        stringstream SS;
+        SS << "{\"tokens\": " << TokenCount
+           << ", \"tokens_per_sec\": " << ( TokenizeNs > 0 ? TokenCount / ( TokenizeNs / 1e9 ) : 0.0 )
+           << ", \"tokenize_ms\": " << TokenizeNs / 1e6
+           << ", \"parse_ms\": " << ParseNs / 1e6
+           << ", \"ast_nodes\": " << AstNodes
+           << ", \"ast_shared_nodes\": " << SharedNodes
+           << ", \"execute_ms\": " << ExecuteNs / 1e6
+           << ", \"evals\": " << EvalCount
+           << ", \"ns_per_eval\": " << ( EvalCount > 0 ? static_cast<double>( ExecuteNs ) / EvalCount : 0.0 )
+           << ", \"calls\": " << CallCount
+           << ", \"calls_per_sec\": " << ( ExecuteSec > 0 ? CallCount / ExecuteSec : 0.0 )
+           << ", \"ns_per_call\": " << ( CallCount > 0 ? static_cast<double>( ExecuteNs ) / CallCount : 0.0 )
+           << ", \"specialized_calls\": " << SpecializedCount
+           << ", \"peak_rss_kb\": " << PeakRssKb()
+           << "}";
+        return SS.str();
+    }
+};
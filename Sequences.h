@@ -0,0 +1,478 @@
+#pragma once
+
+#include "Owlisp.h"
+
+// A lazily produced, single pass sequence of values.
+struct OSequence : OObject {
+    // Fills Out with the next value. Returns false once the sequence is exhausted.
+    virtual bool Next( OExprPtr& Out ) = 0;
+
+    string_view View() const override {
+        return "<sequence>";
+    }
+
+    // A new pass from the start, for sequences that can be walked more than once.
+    virtual shared_ptr<OSequence> Fresh() const {
+        return nullptr;
+    }
+};
+
+typedef shared_ptr<OSequence> OSequencePtr;
+
+OSequencePtr AsSequence( const OExprPtr Value ) {
+    return dynamic_pointer_cast<OSequence>( Value->Atom.Object );
+}
+
+// Walks the input of map, reduce and strjoin: a lazy sequence, or the children of a list.
+struct OSequenceCursor {
+    OSequencePtr Sequence{};
+    OExprPtr List{};
+    int Index = 0;
+
+    bool IsLazy() const {
+        return Sequence != nullptr;
+    }
+
+    bool Next( OExprPtr& Out ) {
+        if ( Sequence != nullptr ) {
+            return Sequence->Next( Out );
+        }
+        if ( Index >= List->Children.Length() ) {
+            return false;
+        }
+        Out = List->Children[ Index++ ];
+        return true;
+    }
+};
+
+OSequenceCursor Make_OSequenceCursor( const OExprPtr Value ) {
+    OSequenceCursor Cursor{};
+    Cursor.List = Value;
+    Cursor.Sequence = AsSequence( Value );
+    if ( Cursor.Sequence != nullptr ) {
+        if ( OSequencePtr Fresh = Cursor.Sequence->Fresh() ) {
+            Cursor.Sequence = Fresh;
+        }
+    }
+    return Cursor;
+}
+
+// Arguments naming a value or computing one are evaluated. Literal lists such
+// as (1 2 3) are walked as written, with their elements evaluated when used.
+OSequenceCursor Make_OSequenceCursor( OMachinePtr Machine, const OExprPtr Arg ) {
+    bool Computed = Arg->Children.IsEmpty();
+    if ( !Computed ) {
+        const int Slot = FindMemorySlot( Machine, Arg );
+        OClosurePtr Closure{};
+        Computed = Slot >= 0 ? CalleeOf( Machine->Stack.Slots[ Slot ].Value, Closure ) != nullptr : FindIntrinsic( Machine, Arg ) != Machine->EmptyIntrinsic;
+    }
+    return Make_OSequenceCursor( Computed ? EvalExpr( Machine, Arg, EEvalIntrinsicMode::Execute, EEvalExprReturnMode::TopExpr ) : Arg );
+}
+
+// Applies the function argument of map or reduce: a defunc or intrinsic name, a
+// closure, or an inline (Param* Body). The call expression is built once and reused.
+struct OApplier {
+    OMachinePtr Machine{};
+    // Set for inline functions and closures.
+    OExprPtr Func{};
+    OClosurePtr Closure{};
+    OExprPtr Call{};
+
+    OExprPtr Apply( const OExprPtr A ) {
+        Call->Children[ 1 ] = A;
+        return Invoke();
+    }
+
+    OExprPtr Apply( const OExprPtr A, const OExprPtr B ) {
+        Call->Children[ 1 ] = A;
+        Call->Children[ 2 ] = B;
+        return Invoke();
+    }
+
+    OExprPtr Invoke() {
+        if ( Func != nullptr ) {
+            return EvalNamedFunction( Machine, Call, Func, EEvalIntrinsicMode::Execute, Closure.get() );
+        }
+        return EvalExpr( Machine, Call, EEvalIntrinsicMode::Execute );
+    }
+};
+
+OApplier Make_OApplier( OMachinePtr Machine, const OExprPtr Expr, const int Arity ) {
+    OApplier Applier{};
+    Applier.Machine = Machine;
+    Applier.Call = Make_OExprPtr( OExprType::Expr );
+    const OExprPtr FuncArg = Expr->Get( 1 );
+    const int Slot = FindMemorySlot( Machine, FuncArg );
+    OClosurePtr Closure{};
+    const bool Callable = Slot >= 0 && CalleeOf( Machine->Stack.Slots[ Slot ].Value, Closure ) != nullptr;
+    // A call form such as (fn X Body) is run once, and a closure it makes or a
+    // name holds is called directly rather than looked up for every value.
+    OExprPtr Func = FuncArg;
+    if ( FuncArg->Children.IsNonEmpty() && ( Callable || FindIntrinsic( Machine, FuncArg ) != Machine->EmptyIntrinsic ) ) {
+        Func = EvalExpr( Machine, FuncArg, EEvalIntrinsicMode::Execute );
+        CalleeOf( Func, Closure );
+    }
+    if ( Closure != nullptr ) {
+        Applier.Func = Closure->Function;
+        Applier.Closure = Closure;
+        Applier.Call->Children.Add( FuncArg );
+    } else if ( Func == FuncArg && FuncArg->Children.Length() == Arity + 1 ) {
+        // Inline functions are made once per site, and close over the bindings
+        // of the call they appear in, as fn does, since a lazy map may run later.
+        const string MapFuncName = "_MapFunc";
+        Applier.Func = LambdaFunction( FuncArg, Make_OExprPtr_Data( TopAtom( Expr ), MapFuncName ), 0 );
+        Applier.Closure = Make_OClosure( Machine, Applier.Func );
+        Applier.Call->Children.Add( Make_OExprPtr_Data( TopAtom( Expr ), MapFuncName ) );
+    } else if ( Func != FuncArg ) {
+        Applier.Call->Children.Add( Func );
+    } else {
+        Applier.Call->Children.Add( FuncArg );
+    }
+    for ( int i = 0; i < Arity; i++ ) {
+        Applier.Call->Children.Add( Make_OExprPtr_Empty() );
+    }
+    return Applier;
+}
+
+// (map F Seq) over a lazy sequence. Each value is computed when it is pulled.
+struct OMapSequence : OSequence {
+    OSequenceCursor Source{};
+    OApplier Applier{};
+    bool Started = false;
+
+    bool Next( OExprPtr& Out ) override {
+        OExprPtr Value{};
+        Started = true;
+        if ( !Source.Next( Value ) ) {
+            return false;
+        }
+        Out = Applier.Apply( Value );
+        return true;
+    }
+
+    // Maps a new pass of the source. Over a source that cannot restart, such as
+    // a generator, only the first walk sees values.
+    OSequencePtr Fresh() const override {
+        OSequencePtr Restarted = Source.Sequence->Fresh();
+        if ( Restarted == nullptr ) {
+            if ( Started ) {
+                RaiseEvalError( Applier.Machine, "A map over a single pass sequence can only be walked once." );
+            }
+            return nullptr;
+        }
+        shared_ptr<OMapSequence> Map = make_shared<OMapSequence>();
+        Map->Source.Sequence = Restarted;
+        Map->Applier = Applier;
+        // Its own call, so two walks can be interleaved.
+        Map->Applier.Call = Make_OExprPtr( OExprType::Expr );
+        for ( int i = 0; i < Applier.Call->Children.Length(); i++ ) {
+            Map->Applier.Call->Children.Add( Applier.Call->Children[ i ] );
+        }
+        return Map;
+    }
+};
+
+// (range End), (range Start End) or (range Start End Step): the integers from Start
+// up to, but not including, End. Every walk over a range starts again from Start.
+struct ORange : OSequence {
+    int Start = 0;
+    int End = 0;
+    int Step = 1;
+    int Current = 0;
+    string Text{};
+
+    bool NextInt( int& Out ) {
+        if ( Step > 0 ? Current >= End : Current <= End ) {
+            return false;
+        }
+        Out = Current;
+        Current += Step;
+        return true;
+    }
+
+    bool Next( OExprPtr& Out ) override {
+        int Value = 0;
+        if ( !NextInt( Value ) ) {
+            return false;
+        }
+        Out = Make_OExprPtr_Int( {}, Value );
+        return true;
+    }
+
+    OSequencePtr Fresh() const override {
+        shared_ptr<ORange> Range = make_shared<ORange>( *this );
+        Range->Current = Start;
+        return Range;
+    }
+
+    string_view View() const override {
+        return Text;
+    }
+};
+
+shared_ptr<ORange> Make_ORange( const int Start, const int End, const int Step ) {
+    shared_ptr<ORange> Range = make_shared<ORange>();
+    Range->Start = Start;
+    Range->End = End;
+    Range->Step = Step;
+    Range->Current = Start;
+    Range->Text = "<range " + to_string( Start ) + " " + to_string( End ) + " " + to_string( Step ) + ">";
+    return Range;
+}
+
+// State of (for Name Sequence Body...). Over a range the counter stays unboxed in
+// the range and is written into the binding's node in place while nothing else holds it.
+struct OForLoop : OObject {
+    OSequenceCursor Cursor{};
+    shared_ptr<ORange> Range{};
+    int Symbol = INVALID_SYMBOL;
+    // Slot of the binding in the frame the loop runs in, once made.
+    int Slot = -1;
+
+    string_view View() const override {
+        return "<for>";
+    }
+
+    // Binds the next value. Returns false once the sequence is exhausted.
+    bool Advance( OMachinePtr Machine ) {
+        if ( Range != nullptr ) {
+            int Value = 0;
+            if ( !Range->NextInt( Value ) ) {
+                return false;
+            }
+            BindInt( Machine, Value );
+            return true;
+        }
+        OExprPtr Value{};
+        if ( !Cursor.Next( Value ) ) {
+            return false;
+        }
+        if ( !Cursor.IsLazy() ) {
+            Value = EvalExpr( Machine, Value, EEvalIntrinsicMode::Execute );
+        }
+        Machine->Stack.Set( Symbol, Value );
+        return true;
+    }
+
+    void BindInt( OMachinePtr Machine, const int Value ) {
+        OFrameStack& Stack = Machine->Stack;
+        if ( Slot >= 0 && Slot < Stack.Slots.Length() && Stack.Slots[ Slot ].Symbol == Symbol ) {
+            OExprPtr& Bound = Stack.Slots[ Slot ].Value;
+            if ( IsUniquelyOwned( Bound ) && Bound->Type == OExprType::Data && Bound->Children.IsEmpty() ) {
+                SetAtomInt( Bound->Atom, Value );
+            } else {
+                Bound = Make_OExprPtr_Int( {}, Value );
+            }
+            return;
+        }
+        Stack.Set( Symbol, Make_OExprPtr_Int( {}, Value ) );
+        uint64 ScanLength = 0;
+        Slot = Stack.Find( Symbol, ScanLength );
+    }
+};
+
+shared_ptr<OForLoop> Make_OForLoop( OMachinePtr Machine, const OExprPtr Expr ) {
+    assert( Expr->Children.Length() >= 3 );
+    shared_ptr<OForLoop> Loop = make_shared<OForLoop>();
+    Loop->Symbol = TokenSymbol( TopAtom( Expr->Get( 1 ) ).Token, true );
+    Loop->Cursor = Make_OSequenceCursor( Machine, Expr->Get( 2 ) );
+    Loop->Range = dynamic_pointer_cast<ORange>( Loop->Cursor.Sequence );
+    return Loop;
+}
+
+OExprPtr Make_OExprPtr_View( const OMappedFilePtr& File, string_view Text ) {
+    shared_ptr<OStringView> View = make_shared<OStringView>();
+    View->Owner = File;
+    View->Text = Text;
+    return Make_OExprPtr_Object( {}, View );
+}
+
+// Walks the lines of a mapped file. A trailing \r is dropped, so CRLF files read the same.
+struct OLineCursor {
+    OMappedFilePtr File{};
+    size_t Offset = 0;
+
+    bool Next( string_view& Line ) {
+        const string_view Data = File->View();
+        if ( Offset >= Data.size() ) {
+            return false;
+        }
+        const char* Start = Data.data() + Offset;
+        const char* End = static_cast<const char*>( memchr( Start, '\n', Data.size() - Offset ) );
+        const size_t Length = End != nullptr ? End - Start : Data.size() - Offset;
+        Offset += Length + 1;
+        Line = string_view{ Start, Length };
+        if ( !Line.empty() && Line.back() == '\r' ) {
+            Line.remove_suffix( 1 );
+        }
+        return true;
+    }
+};
+
+// (lines Path) yields each line of the file as a view into its mapping, without copying.
+struct OLineSequence : OSequence {
+    OLineCursor Lines{};
+    string Path{};
+
+    bool Next( OExprPtr& Out ) override {
+        string_view Line{};
+        if ( !Lines.Next( Line ) ) {
+            return false;
+        }
+        Out = Make_OExprPtr_View( Lines.File, Line );
+        return true;
+    }
+
+    OSequencePtr Fresh() const override {
+        shared_ptr<OLineSequence> Sequence = make_shared<OLineSequence>( *this );
+        Sequence->Lines.Offset = 0;
+        return Sequence;
+    }
+
+    string_view View() const override {
+        return Path;
+    }
+};
+
+// A fixed list of values. (field Value N) picks one, and walking it yields them in order.
+struct OTuple : OSequence {
+    int Index = 0;
+
+    virtual int FieldCount() const = 0;
+    virtual OExprPtr Field( const int N ) const = 0;
+
+    bool Next( OExprPtr& Out ) override {
+        if ( Index >= FieldCount() ) {
+            return false;
+        }
+        Out = Field( Index++ );
+        return true;
+    }
+};
+
+// One delimited line. Its value is the whole line.
+struct ORecord : OTuple {
+    OMappedFilePtr File{};
+    string_view Line{};
+    vector<string_view> Fields{};
+
+    int FieldCount() const override {
+        return static_cast<int>( Fields.size() );
+    }
+
+    OExprPtr Field( const int N ) const override {
+        return Make_OExprPtr_View( File, Fields[ N ] );
+    }
+
+    OSequencePtr Fresh() const override {
+        shared_ptr<ORecord> Record = make_shared<ORecord>( *this );
+        Record->Index = 0;
+        return Record;
+    }
+
+    string_view View() const override {
+        return Line;
+    }
+};
+
+// (records Path Delimiter) yields each line of the file split into an ORecord.
+struct ORecordSequence : OSequence {
+    OLineCursor Lines{};
+    string Path{};
+    char Delimiter = ',';
+
+    bool Next( OExprPtr& Out ) override {
+        string_view Line{};
+        if ( !Lines.Next( Line ) ) {
+            return false;
+        }
+        shared_ptr<ORecord> Record = make_shared<ORecord>();
+        Record->File = Lines.File;
+        Record->Line = Line;
+        size_t Start = 0;
+        while ( true ) {
+            const size_t End = Line.find( Delimiter, Start );
+            Record->Fields.push_back( Line.substr( Start, End == string_view::npos ? string_view::npos : End - Start ) );
+            if ( End == string_view::npos ) {
+                break;
+            }
+            Start = End + 1;
+        }
+        Out = Make_OExprPtr_Object( {}, Record );
+        return true;
+    }
+
+    OSequencePtr Fresh() const override {
+        shared_ptr<ORecordSequence> Sequence = make_shared<ORecordSequence>( *this );
+        Sequence->Lines.Offset = 0;
+        return Sequence;
+    }
+
+    string_view View() const override {
+        return Path;
+    }
+};
+
+// (gen Body...) runs Body on its own continuation stack, suspending at each (yield Value).
+// It starts with a copy of the bindings of the defunc call that created it. While
+// suspended its bindings and profiler calls are moved off the machine, and put back
+// on top of the consumer's when it resumes.
+struct OGenerator : OSequence {
+    OMachinePtr Machine{};
+    OExprPtr Body{};
+    OEvalState State{};
+    OArray<int> SavedFrameStarts{};
+    OArray<OBinding> SavedSlots{};
+    vector<OProfileActive> SavedCalls{};
+    bool Started = false;
+    bool Finished = false;
+
+    bool Next( OExprPtr& Out ) override {
+        if ( Finished || Machine->EvalError ) {
+            return false;
+        }
+        const int Depth = Machine->Stack.Depth();
+        const size_t ProfileDepth = Machine->Profiler != nullptr ? Machine->Profiler->Active.size() : 0;
+        swap( Machine->Eval, State );
+        Machine->Stack.Restore( SavedFrameStarts, SavedSlots );
+        if ( !Started ) {
+            Started = true;
+            Machine->Eval.Generator = true;
+            BeginEval( Machine, Body, EEvalIntrinsicMode::Execute, EEvalExprReturnMode::LastChild );
+        } else if ( Machine->Profiler != nullptr ) {
+            Machine->Profiler->Resume( SavedCalls );
+        }
+        const EEvalStatus Status = StepEval( Machine, 0, -1 );
+        if ( Status == EEvalStatus::Suspended ) {
+            Out = Machine->Eval.Result;
+            Machine->Stack.Save( Depth, SavedFrameStarts, SavedSlots );
+            if ( Machine->Profiler != nullptr ) {
+                Machine->Profiler->Suspend( ProfileDepth, SavedCalls );
+            }
+            swap( Machine->Eval, State );
+            return true;
+        }
+        while ( Machine->Stack.Depth() > Depth ) {
+            PopFrame( Machine );
+        }
+        swap( Machine->Eval, State );
+        Finished = true;
+        State = {};
+        return false;
+    }
+};
+
+shared_ptr<OGenerator> Make_OGenerator( OMachinePtr Machine, const OExprPtr Body ) {
+    shared_ptr<OGenerator> Generator = make_shared<OGenerator>();
+    Generator->Machine = Machine;
+    Generator->Body = Body;
+    Generator->SavedFrameStarts.Add( 0 );
+    const OFrameStack& Stack = Machine->Stack;
+    // Frame 0 holds the globals, which stay visible without a copy.
+    if ( Stack.Depth() > 1 ) {
+        for ( int i = Stack.FrameStarts[ Stack.Depth() - 1 ]; i < Stack.Slots.Length(); i++ ) {
+            Generator->SavedSlots.Add( Stack.Slots[ i ] );
+        }
+    }
+    return Generator;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+// Warm-start daemon. `Owlisp --serve=Socket` loads an optional prelude once,
+// then keeps a pool of forked workers waiting on a Unix socket. Each worker is
+// a copy of the warmed machine and serves exactly one request before exiting,
+// so globals defined by one script are never seen by the next. The parent
+// replaces every worker that exits.
+//
+// Protocol: the client sends the script text and shuts down its write side.
+// The server answers with frames:
+//   O <Length>\n<Length bytes of output>
+//   E <Length>\n<Length bytes of eval error>, copied to the client's stderr
+//   X <Code>\n          last frame; 0 on success, 1 after an eval error.
+//
+// A worker gives up on a client that stalls for SERVE_IO_TIMEOUT_SEC while
+// sending the script or reading output. The client waits at most
+// --timeout=Seconds, SERVE_CLIENT_TIMEOUT_SEC by default, between frames.
+//
+// Unix sockets and fork are POSIX only. On Windows both modes report that they
+// are unavailable.
+
+const int SERVE_DEFAULT_WORKERS = 4;
+const int SERVE_BACKLOG = 128;
+const int SERVE_IO_TIMEOUT_SEC = 10;
+const int SERVE_CLIENT_TIMEOUT_SEC = 60;
+
+#if defined(_WIN32)
+
+int Serve( OMachinePtr, const string&, const int ) {
+    std::cerr << "Error: --serve needs Unix sockets, which this platform lacks." << std::endl;
+    return 1;
+}
+
+int RunClient( const string&, const string&, const int ) {
+    std::cerr << "Error: --client needs Unix sockets, which this platform lacks." << std::endl;
+    return 1;
+}
+
+#else
+
+#include <csignal>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+// 0 leaves that direction without a timeout.
+bool SetSocketTimeouts( const int Fd, const int ReceiveSec, const int SendSec ) {
+    const timeval Receive{ ReceiveSec, 0 };
+    const timeval Send{ SendSec, 0 };
+    return setsockopt( Fd, SOL_SOCKET, SO_RCVTIMEO, &Receive, sizeof( Receive ) ) == 0 && setsockopt( Fd, SOL_SOCKET, SO_SNDTIMEO, &Send, sizeof( Send ) ) == 0;
+}
+
+bool WriteAll( const int Fd, string_view Data ) {
+    while ( !Data.empty() ) {
+        const ssize_t Written = write( Fd, Data.data(), Data.size() );
+        if ( Written < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return false;
+        }
+        Data.remove_prefix( static_cast<size_t>( Written ) );
+    }
+    return true;
+}
+
+// Reads to end of file. Complete is set false if a read failed or timed out first.
+string ReadAll( const int Fd, bool* Complete = nullptr ) {
+    string Out{};
+    char Chunk[ 1 << 14 ];
+    for ( ;; ) {
+        const ssize_t Read = read( Fd, Chunk, sizeof( Chunk ) );
+        if ( Read < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( Read <= 0 ) {
+            if ( Complete != nullptr ) {
+                *Complete = Read == 0;
+            }
+            return Out;
+        }
+        Out.append( Chunk, static_cast<size_t>( Read ) );
+    }
+}
+
+bool MakeSocketAddress( const string& Path, sockaddr_un& Address ) {
+    Address = {};
+    Address.sun_family = AF_UNIX;
+    if ( Path.size() >= sizeof( Address.sun_path ) ) {
+        return false;
+    }
+    memcpy( Address.sun_path, Path.data(), Path.size() );
+    return true;
+}
+
+// Runs one script on Machine and streams its output to Connection.
+void ServeRequest( OMachinePtr Machine, const int Connection ) {
+    SetSocketTimeouts( Connection, SERVE_IO_TIMEOUT_SEC, SERVE_IO_TIMEOUT_SEC );
+    bool Complete = false;
+    const string Script = ReadAll( Connection, &Complete );
+    if ( !Complete ) {
+        const string Message = "\n[EVAL_ERROR] Timed out reading the script.\n";
+        WriteAll( Connection, "E " + to_string( Message.size() ) + "\n" + Message + "X 1\n" );
+        return;
+    }
+    // A client that stops reading is cut off, so later frames fail at once
+    // instead of each waiting out the send timeout.
+    const auto SendFrame = [Connection]( const char Kind, string_view Chunk ) {
+        if ( !WriteAll( Connection, string( 1, Kind ) + " " + to_string( Chunk.size() ) + "\n" ) || !WriteAll( Connection, Chunk ) ) {
+            shutdown( Connection, SHUT_RDWR );
+        }
+    };
+    Machine->Out.Sink = [SendFrame]( string_view Chunk ) {
+        SendFrame( 'O', Chunk );
+    };
+    Machine->Err.Sink = [SendFrame]( string_view Chunk ) {
+        SendFrame( 'E', Chunk );
+    };
+    const int Code = RunOwl( Machine, Script );
+    Shutdown( Machine );
+    WriteAll( Connection, "X " + to_string( Code ) + "\n" );
+}
+
+pid_t SpawnServeWorker( OMachinePtr Machine, const int Listener ) {
+    const pid_t Pid = fork();
+    if ( Pid != 0 ) {
+        return Pid;
+    }
+#if defined(__linux__)
+    prctl( PR_SET_PDEATHSIG, SIGTERM );
+#endif
+    int Connection = -1;
+    do {
+        Connection = accept( Listener, nullptr, nullptr );
+    } while ( Connection < 0 && errno == EINTR );
+    if ( Connection >= 0 ) {
+        ServeRequest( Machine, Connection );
+        close( Connection );
+    }
+    _exit( 0 );
+}
+
+int Serve( OMachinePtr Machine, const string& SocketPath, const int Workers ) {
+    sockaddr_un Address{};
+    if ( !MakeSocketAddress( SocketPath, Address ) ) {
+        std::cerr << "Error: Socket path is too long: " << SocketPath << std::endl;
+        return 1;
+    }
+    const int Listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    unlink( SocketPath.c_str() );
+    if ( Listener < 0 || bind( Listener, reinterpret_cast<sockaddr*>( &Address ), sizeof( Address ) ) != 0 || listen( Listener, SERVE_BACKLOG ) != 0 ) {
+        std::cerr << "Error: Cannot listen on " << SocketPath << ": " << strerror( errno ) << std::endl;
+        return 1;
+    }
+    signal( SIGPIPE, SIG_IGN );
+    // Anything buffered before the fork would otherwise be written by every worker.
+    Machine->Out.Flush();
+    std::cout.flush();
+    for ( int i = 0; i < max( Workers, 1 ); i++ ) {
+        SpawnServeWorker( Machine, Listener );
+    }
+    for ( ;; ) {
+        const pid_t Exited = wait( nullptr );
+        if ( Exited > 0 ) {
+            SpawnServeWorker( Machine, Listener );
+        } else if ( errno != EINTR ) {
+            break;
+        }
+    }
+    close( Listener );
+    unlink( SocketPath.c_str() );
+    return 0;
+}
+
+// Sends Script to a server and copies its output to stdout, and its eval
+// errors to stderr, as they arrive. Fails if the server is silent for
+// TimeoutSec, or never with 0.
+// Returns the script's code.
+int RunClient( const string& SocketPath, const string& Script, const int TimeoutSec ) {
+    sockaddr_un Address{};
+    const int Connection = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( !MakeSocketAddress( SocketPath, Address ) || Connection < 0 || connect( Connection, reinterpret_cast<sockaddr*>( &Address ), sizeof( Address ) ) != 0 ) {
+        std::cerr << "Error: Cannot connect to " << SocketPath << ": " << strerror( errno ) << std::endl;
+        return 1;
+    }
+    SetSocketTimeouts( Connection, TimeoutSec, TimeoutSec );
+    if ( !WriteAll( Connection, Script ) ) {
+        std::cerr << "Error: Cannot send the script to " << SocketPath << ": " << strerror( errno ) << std::endl;
+        close( Connection );
+        return 1;
+    }
+    shutdown( Connection, SHUT_WR );
+    string Pending{};
+    // Bytes still owed by the current O or E frame, and where they go.
+    size_t Remaining = 0;
+    FILE* Stream = stdout;
+    char Chunk[ 1 << 14 ];
+    for ( ;; ) {
+        const ssize_t Read = read( Connection, Chunk, sizeof( Chunk ) );
+        if ( Read < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( Read < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+            close( Connection );
+            std::cerr << "Error: Server sent nothing for " << TimeoutSec << " seconds." << std::endl;
+            return 1;
+        }
+        if ( Read <= 0 ) {
+            break;
+        }
+        Pending.append( Chunk, static_cast<size_t>( Read ) );
+        size_t At = 0;
+        for ( ;; ) {
+            if ( Remaining > 0 ) {
+                const size_t Length = min( Remaining, Pending.size() - At );
+                fwrite( Pending.data() + At, 1, Length, Stream );
+                At += Length;
+                Remaining -= Length;
+                if ( Remaining > 0 ) {
+                    break;
+                }
+            }
+            const size_t LineEnd = Pending.find( '\n', At );
+            if ( LineEnd == string::npos || LineEnd < At + 2 ) {
+                break;
+            }
+            const int Value = ParseTokenToPrimitive<int>( string_view( Pending ).substr( At + 2, LineEnd - At - 2 ) );
+            if ( Pending[ At ] == 'X' ) {
+                fflush( stdout );
+                close( Connection );
+                return Value;
+            }
+            Remaining = static_cast<size_t>( Value );
+            Stream = Pending[ At ] == 'E' ? stderr : stdout;
+            At = LineEnd + 1;
+        }
+        Pending.erase( 0, At );
+        fflush( stdout );
+    }
+    close( Connection );
+    std::cerr << "Error: Server closed the connection before the script finished." << std::endl;
+    return 1;
+}
+
+#endif
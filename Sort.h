@@ -0,0 +1,122 @@
+#pragma once
+
+// (sort Seq) and (sort Key Seq). Keys are read once into a flat array typed by
+// what they all are: ints, numbers, or else text. Sorting then compares those
+// directly instead of going through atoms. Large inputs are cut into one run
+// per core, each run is sorted on its own thread, and runs are merged in pairs,
+// also in parallel. Every step is stable, so equal keys keep their input order.
+
+#include "HashMap.h"
+
+#include <cmath>
+#include <thread>
+
+// Smaller inputs are sorted on the calling thread.
+const size_t SORT_PARALLEL_MIN_ITEMS = 1 << 15;
+
+template<typename K>
+struct OSortItem {
+    K Key{};
+    int Index = 0;
+};
+
+template<typename K>
+bool SortItemLess( const OSortItem<K>& LHS, const OSortItem<K>& RHS ) {
+    return LHS.Key < RHS.Key;
+}
+
+// Runs Step( i ) for every i below Count, each on its own thread.
+template<typename F>
+void ForEachSortRun( const int Count, F Step ) {
+    vector<thread> Threads{};
+    for ( int i = 0; i < Count; i++ ) {
+        Threads.emplace_back( [i, &Step]() { Step( i ); } );
+    }
+    for ( thread& Thread : Threads ) {
+        Thread.join();
+    }
+}
+
+template<typename K>
+void StableSortItems( vector<OSortItem<K>>& Items ) {
+    const int Cores = max( 1, static_cast<int>( thread::hardware_concurrency() ) );
+    const int Threads = Items.size() >= SORT_PARALLEL_MIN_ITEMS ? Cores : 1;
+    if ( Threads == 1 ) {
+        stable_sort( Items.begin(), Items.end(), SortItemLess<K> );
+        return;
+    }
+    vector<size_t> Bounds{};
+    for ( int i = 0; i <= Threads; i++ ) {
+        Bounds.push_back( Items.size() * i / Threads );
+    }
+    ForEachSortRun( Threads, [&Items, &Bounds]( const int i ) {
+        stable_sort( Items.begin() + Bounds[ i ], Items.begin() + Bounds[ i + 1 ], SortItemLess<K> );
+    } );
+    // Each round merges neighbouring runs into Merged, left run first on ties.
+    vector<OSortItem<K>> Merged( Items.size() );
+    while ( Bounds.size() > 2 ) {
+        const int Pairs = static_cast<int>( Bounds.size() - 1 ) / 2;
+        ForEachSortRun( Pairs, [&Items, &Merged, &Bounds]( const int i ) {
+            const auto Start = Items.begin() + Bounds[ 2 * i ];
+            const auto Middle = Items.begin() + Bounds[ 2 * i + 1 ];
+            const auto End = Items.begin() + Bounds[ 2 * i + 2 ];
+            merge( Start, Middle, Middle, End, Merged.begin() + Bounds[ 2 * i ], SortItemLess<K> );
+        } );
+        vector<size_t> Next{};
+        for ( size_t i = 0; i < Bounds.size(); i += 2 ) {
+            Next.push_back( Bounds[ i ] );
+        }
+        // An odd run out is carried over as it is.
+        if ( ( Bounds.size() - 1 ) % 2 == 1 ) {
+            copy( Items.begin() + Bounds[ Bounds.size() - 2 ], Items.end(), Merged.begin() + Bounds[ Bounds.size() - 2 ] );
+            Next.push_back( Bounds.back() );
+        }
+        Bounds = std::move( Next );
+        Items.swap( Merged );
+    }
+}
+
+// Values in the order of their keys.
+template<typename K>
+vector<OExprPtr> SortByKeys( const vector<OExprPtr>& Values, vector<OSortItem<K>>& Items ) {
+    StableSortItems( Items );
+    vector<OExprPtr> Sorted{};
+    Sorted.reserve( Items.size() );
+    for ( const OSortItem<K>& Item : Items ) {
+        Sorted.push_back( Values[ Item.Index ] );
+    }
+    return Sorted;
+}
+
+// A number key is text that from_chars reads whole as a double other than NaN,
+// which would not order against anything.
+bool SortNumberKey( string_view Text, double& Out ) {
+    const from_chars_result Result = from_chars( Text.data(), Text.data() + Text.size(), Out );
+    return !Text.empty() && Result.ec == errc{} && Result.ptr == Text.data() + Text.size() && !isnan( Out );
+}
+
+// Keys are compared as ints when every key is one, as numbers when every key
+// reads as one, and otherwise by text without enclosing quotes.
+vector<OExprPtr> SortValues( const vector<OExprPtr>& Values, const vector<OExprPtr>& Keys ) {
+    const int Count = static_cast<int>( Keys.size() );
+    vector<OSortItem<int>> Ints( Count );
+    int i = 0;
+    for ( ; i < Count && AtomIntValue( TopAtom( Keys[ i ] ), Ints[ i ].Key ); i++ ) {
+        Ints[ i ].Index = i;
+    }
+    if ( i == Count ) {
+        return SortByKeys( Values, Ints );
+    }
+    vector<OSortItem<double>> Numbers( Count );
+    for ( i = 0; i < Count && SortNumberKey( MapKeyText( Keys[ i ] ), Numbers[ i ].Key ); i++ ) {
+        Numbers[ i ].Index = i;
+    }
+    if ( i == Count ) {
+        return SortByKeys( Values, Numbers );
+    }
+    vector<OSortItem<string_view>> Texts( Count );
+    for ( i = 0; i < Count; i++ ) {
+        Texts[ i ] = { MapKeyText( Keys[ i ] ), i };
+    }
+    return SortByKeys( Values, Texts );
+}
@@ -0,0 +1,750 @@
+#pragma once
+
+// Type-specialized defuncs. The first call of a function with numeric
+// arguments infers a type for every node of its body from the parameter
+// types, literals and the intrinsics used, and compiles it to a tree of
+// OSpecNode that works on unboxed ints and floats. Later calls with the same
+// argument types run that tree instead of evaluating the body, and only the
+// result is boxed. Parameters annotated (int: N) or (float: X) fix their type.
+// Any other parameter takes the type of its first argument. The numbers a
+// closure captured are read like more parameters, after its own.
+//
+// A body qualifies when it uses only its parameters, number literals, the
+// arithmetic and comparison intrinsics, ? with both branches, and calls to
+// functions that qualify themselves. Such a body has no side effects, so a
+// specialized call that cannot finish can bail out and the generic evaluator
+// runs the call again from the start. This happens on a zero divisor or a
+// result that is not finite. Recursion that has used half of the native stack
+// continues in the generic evaluator, which keeps its frames on the heap.
+//
+// Every number crosses between intrinsics as text in the generic evaluator.
+// Floats are printed with six significant digits and ints are parsed from the
+// front of that text. The specialized operations round through the same text
+// wherever it could change a result, so both paths print the same values.
+
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <climits>
+
+const int SPEC_MAX_PARAMS = 8;
+const int SPEC_MAX_SIGNATURES = 4;
+// A signature that keeps bailing out is left to the generic evaluator.
+const int SPEC_MAX_BAILOUTS = 8;
+
+enum class ESpecType : uint8_t {
+    // An unannotated parameter, typed by its first argument.
+    Unknown,
+    // An int atom, or text that is exactly an int. Every intrinsic treats the two alike.
+    Int,
+    Float,
+    // A parameter annotated with a type that is not a number.
+    Other
+};
+
+enum class ESpecOp : uint8_t {
+    Int,
+    Float,
+    Param,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    IntDiv,
+    Mod,
+    Sqrt,
+    Equal,
+    Less,
+    Greater,
+    Branch,
+    Call,
+    // A list of lists. Every element is evaluated and the last one is the value.
+    Sequence
+};
+
+union OSpecValue {
+    int Int;
+    float Float;
+};
+
+struct OSpecialization;
+
+struct OSpecNode {
+    ESpecOp Op = ESpecOp::Int;
+    ESpecType Type = ESpecType::Int;
+    OSpecValue Value{};
+    int Param = 0;
+    // For Call, the callee and the name it is bound to.
+    OSpecialization* Callee = nullptr;
+    int Symbol = INVALID_SYMBOL;
+    vector<OSpecNode> Args{};
+    // For Call, (caller param, argument) pairs. A generic call binds each parameter
+    // before it evaluates the next argument, so once the argument is computed the
+    // later arguments read it in place of the caller's param of the same name.
+    vector<pair<int, int>> Rebinds{};
+};
+
+// A binding the specialization was compiled against. Function is null for an
+// intrinsic name, which must stay unbound for the intrinsic to be the one called.
+struct OSpecDependency {
+    int Symbol = INVALID_SYMBOL;
+    const OExpr* Function = nullptr;
+};
+
+struct OSpecialization {
+    // Types of the params, then of the captured values.
+    vector<ESpecType> Params{};
+    // Symbols of a closure's captured numbers.
+    vector<int> Captured{};
+    ESpecType Result = ESpecType::Int;
+    OSpecNode Body{};
+    vector<OSpecDependency> Dependencies{};
+    int Bailouts = 0;
+    bool Compiling = false;
+    bool Failed = false;
+};
+
+typedef shared_ptr<OSpecialization> OSpecializationPtr;
+
+// Carried on the ExprFunc node of a defunc, in place of a token.
+struct OFunctionInfo : OObject {
+    const OExpr* Function = nullptr;
+    vector<int> ParamSymbols{};
+    vector<ESpecType> Declared{};
+    bool Specializable = true;
+    vector<OSpecializationPtr> Specializations{};
+
+    string_view View() const override {
+        return {};
+    }
+};
+
+// Text of an int or float as the generic intrinsics would write it.
+int SpecText( const OSpecValue Value, const ESpecType Type, char* Out, const int Size ) {
+    if ( Type == ESpecType::Int ) {
+        return static_cast<int>( to_chars( Out, Out + Size, Value.Int ).ptr - Out );
+    }
+    return snprintf( Out, Size, "%g", static_cast<double>( Value.Float ) );
+}
+
+// Powers of ten a double holds exactly.
+const double SPEC_POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+const int SPEC_POW10_MAX = 22;
+
+// The double strtod reads back from the six-digit text of X > 0, without the
+// text. False for values it cannot do exactly, which then take the text path:
+// those too close to a rounding tie, or outside the exact powers of ten.
+bool SpecRoundDecimal( const double X, double& Out ) {
+    // The binary exponent puts the decimal one at most one too low.
+    int Shift = 5 - static_cast<int>( floor( ilogb( X ) * 0.30102999566398120 ) );
+    double Scaled = 0;
+    for ( int Attempt = 0; Attempt < 2; Attempt++ ) {
+        if ( Shift < -SPEC_POW10_MAX || Shift > SPEC_POW10_MAX ) {
+            return false;
+        }
+        // One rounding here, so a tie is only missed within a tiny fraction of a digit.
+        Scaled = Shift >= 0 ? X * SPEC_POW10[ Shift ] : X / SPEC_POW10[ -Shift ];
+        if ( Scaled < 1e6 ) {
+            break;
+        }
+        Shift--;
+    }
+    if ( Scaled < 100000 || Scaled >= 999999.5 || fabs( Scaled - floor( Scaled ) - 0.5 ) < 1e-6 ) {
+        return false;
+    }
+    const double Digits = nearbyint( Scaled );
+    Out = Shift >= 0 ? Digits / SPEC_POW10[ Shift ] : Digits * SPEC_POW10[ -Shift ];
+    return true;
+}
+
+// A double exactly halfway between two floats, which rounds differently from
+// the decimal it came from when converted again.
+bool SpecFloatMidpoint( const double Value ) {
+    const uint64 Low = bit_cast<uint64>( Value ) & ( ( 1ull << 29 ) - 1 );
+    return Low == 1ull << 28;
+}
+
+// A float after a trip through its six-digit text, as every float result takes.
+bool SpecRoundFloat( const float In, float& Out ) {
+    if ( !std::isfinite( In ) ) {
+        return false;
+    }
+    if ( In == 0 ) {
+        Out = In;
+        return true;
+    }
+    double Rounded = 0;
+    if ( SpecRoundDecimal( fabs( static_cast<double>( In ) ), Rounded ) && !SpecFloatMidpoint( Rounded ) ) {
+        Out = copysign( static_cast<float>( Rounded ), In );
+        return true;
+    }
+    char Text[ 32 ];
+    snprintf( Text, sizeof( Text ), "%g", static_cast<double>( In ) );
+    Out = strtof( Text, nullptr );
+    return true;
+}
+
+int SpecToInt( const OSpecValue Value, const ESpecType Type ) {
+    if ( Type == ESpecType::Int ) {
+        return Value.Int;
+    }
+    // Text without an exponent reads as its whole part.
+    double Rounded = 0;
+    const double Magnitude = fabs( static_cast<double>( Value.Float ) );
+    if ( Magnitude < 1e-4 ? Magnitude == 0 : SpecRoundDecimal( Magnitude, Rounded ) && Rounded < 1e6 ) {
+        const int Whole = static_cast<int>( Rounded );
+        return Value.Float < 0 ? -Whole : Whole;
+    }
+    char Text[ 32 ];
+    const int Length = SpecText( Value, Type, Text, sizeof( Text ) );
+    int Out = 0;
+    from_chars( Text, Text + Length, Out );
+    return Out;
+}
+
+// The double a float result's text reads as, which is not the float widened.
+double SpecToDouble( const OSpecValue Value, const ESpecType Type ) {
+    if ( Type == ESpecType::Int ) {
+        return Value.Int;
+    }
+    double Rounded = 0;
+    if ( Value.Float == 0 || !SpecRoundDecimal( fabs( static_cast<double>( Value.Float ) ), Rounded ) ) {
+        char Text[ 32 ];
+        SpecText( Value, Type, Text, sizeof( Text ) );
+        return strtod( Text, nullptr );
+    }
+    return Value.Float < 0 ? -Rounded : Rounded;
+}
+
+float SpecToFloat( const OSpecValue Value, const ESpecType Type ) {
+    return Type == ESpecType::Int ? static_cast<float>( Value.Int ) : Value.Float;
+}
+
+// The type of unboxed number that atom text behaves exactly like in every intrinsic.
+ESpecType SpecTextType( const string_view Text, OSpecValue& Out ) {
+    if ( ParseIntLiteral( Text, Out.Int ) ) {
+        return ESpecType::Int;
+    }
+    if ( Text.empty() || Text.size() >= 32 || !( isdigit( Text[ 0 ] ) || Text[ 0 ] == '-' || Text[ 0 ] == '.' ) ) {
+        return ESpecType::Other;
+    }
+    char Terminated[ 32 ];
+    memcpy( Terminated, Text.data(), Text.size() );
+    Terminated[ Text.size() ] = 0;
+    char* End = nullptr;
+    const float Parsed = strtof( Terminated, &End );
+    char Canonical[ 32 ];
+    if ( End != Terminated + Text.size() || !std::isfinite( Parsed ) ) {
+        return ESpecType::Other;
+    }
+    // Only text the float intrinsics could have written, so == sees the same text.
+    Out.Float = Parsed;
+    const int Length = SpecText( Out, ESpecType::Float, Canonical, sizeof( Canonical ) );
+    return string_view( Canonical, Length ) == Text ? ESpecType::Float : ESpecType::Other;
+}
+
+// The type of a value that behaves exactly like an unboxed number in every intrinsic.
+ESpecType SpecTypeOf( const OExprPtr& Value, OSpecValue& Out ) {
+    const OAtom& Atom = Value->Atom;
+    if ( !Value->Children.IsEmpty() || Atom.Object != nullptr ) {
+        return ESpecType::Other;
+    }
+    if ( IsIntAtom( Atom ) ) {
+        Out.Int = Atom.PrimitiveData.Int;
+        return ESpecType::Int;
+    }
+    return SpecTextType( Atom.Token.Token, Out );
+}
+
+OFunctionInfo& GetFunctionInfo( const OExprPtr Function ) {
+    if ( const auto Info = dynamic_cast<OFunctionInfo*>( Function->Atom.Object.get() ) ) {
+        return *Info;
+    }
+    shared_ptr<OFunctionInfo> Info = make_shared<OFunctionInfo>();
+    Info->Function = &*Function;
+    // Params are child [1, (N-2)], body is N-1
+    const int ParamCount = Function->Children.Length() - 2;
+    Info->Specializable = ParamCount <= SPEC_MAX_PARAMS;
+    for ( int i = 1; i <= ParamCount; i++ ) {
+        const OExprPtr Param = Function->Children[ i ];
+        Info->ParamSymbols.push_back( TokenSymbol( ParamAtom( Param ).Token, true ) );
+        const string_view Type = ParamType( Param );
+        Info->Declared.push_back( Type.empty() ? ESpecType::Unknown : Type == "int" ? ESpecType::Int : Type == "float" ? ESpecType::Float : ESpecType::Other );
+        Info->Specializable = Info->Specializable && Info->Declared.back() != ESpecType::Other;
+    }
+    Function->Atom.Object = Info;
+    return *Info;
+}
+
+OSpecialization* GetSpecialization( OMachinePtr Machine, const OExprPtr Function, const vector<ESpecType>& Params, const vector<int>& Captured );
+
+struct OSpecCompiler {
+    OMachinePtr Machine;
+    const OExprPtr Function;
+    OFunctionInfo& Info;
+    OSpecialization& Spec;
+    bool CallsSelf = false;
+    bool Failed = false;
+
+    OSpecNode Fail() {
+        Failed = true;
+        return {};
+    }
+
+    int ParamSymbol( const int Param ) const {
+        const int Count = static_cast<int>( Info.ParamSymbols.size() );
+        return Param < Count ? Info.ParamSymbols[ Param ] : Spec.Captured[ Param - Count ];
+    }
+
+    // Index of Symbol among the params and captured values, or -1.
+    int ParamIndex( const int Symbol ) const {
+        for ( int i = 0; i < static_cast<int>( Spec.Params.size() ); i++ ) {
+            if ( ParamSymbol( i ) == Symbol ) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void Depend( const int Symbol, const OExpr* Callee ) {
+        for ( const OSpecDependency& Dependency : Spec.Dependencies ) {
+            if ( Dependency.Symbol == Symbol ) {
+                return;
+            }
+        }
+        Spec.Dependencies.push_back( OSpecDependency{ Symbol, Callee } );
+    }
+
+    // Intrinsic names are checked against the bindings the same way the evaluators do,
+    // memory first, so a defunc of the same name would be called instead.
+    bool IsUnboundIntrinsic( const OExprPtr Expr, const string_view Name ) {
+        const OIntrinsicPtr Intrinsic = FindIntrinsic( Machine, Expr );
+        if ( Intrinsic == Machine->EmptyIntrinsic || Intrinsic->Token != Name ) {
+            return false;
+        }
+        Depend( GSymbols.Intern( Name ), nullptr );
+        return true;
+    }
+
+    OSpecNode Compile( const OExprPtr Expr ) {
+        if ( Expr->Children.IsEmpty() ) {
+            return CompileLeaf( Expr );
+        }
+        const OExprPtr Head = Expr->Children[ 0 ];
+        if ( !Head->Children.IsEmpty() ) {
+            if ( FindIntrinsic( Machine, Expr ) != Machine->EmptyIntrinsic || FindMemorySlot( Machine, Expr ) >= 0 ) {
+                return Fail();
+            }
+            OSpecNode Node{ ESpecOp::Sequence };
+            for ( int i = 0; i < Expr->Children.Length() && !Failed; i++ ) {
+                Node.Args.push_back( Compile( Expr->Children[ i ] ) );
+            }
+            Node.Type = Node.Args.back().Type;
+            return Node;
+        }
+        const OToken& Token = Head->Atom.Token;
+        const int Symbol = TokenSymbol( Token, false );
+        if ( Symbol != INVALID_SYMBOL && ParamIndex( Symbol ) >= 0 ) {
+            return Fail();
+        }
+        uint64 ScanLength = 0;
+        const int Slot = Symbol == INVALID_SYMBOL ? -1 : Machine->Stack.Find( Symbol, ScanLength );
+        if ( Slot >= 0 ) {
+            return CompileCall( Expr, Symbol, Machine->Stack.Slots[ Slot ].Value );
+        }
+        static const pair<const char*, ESpecOp> Ops[] = {
+            { "+", ESpecOp::Add }, { "-", ESpecOp::Sub }, { "*", ESpecOp::Mul }, { "/", ESpecOp::Div },
+            { "//", ESpecOp::IntDiv }, { "modi", ESpecOp::Mod }, { "sqrt", ESpecOp::Sqrt },
+            { "==", ESpecOp::Equal }, { "<", ESpecOp::Less }, { ">", ESpecOp::Greater }, { "?", ESpecOp::Branch },
+        };
+        for ( const auto& [ Name, Op ] : Ops ) {
+            if ( Token.Token == Name && IsUnboundIntrinsic( Expr, Name ) ) {
+                return CompileIntrinsic( Expr, Op );
+            }
+        }
+        return Fail();
+    }
+
+    OSpecNode CompileLeaf( const OExprPtr Expr ) {
+        const int Symbol = TokenSymbol( Expr->Atom.Token, false );
+        const int Param = Symbol != INVALID_SYMBOL ? ParamIndex( Symbol ) : -1;
+        if ( Param >= 0 ) {
+            OSpecNode Node{ ESpecOp::Param, Spec.Params[ Param ] };
+            Node.Param = Param;
+            return Node;
+        }
+        OSpecNode Node{};
+        Node.Type = SpecTypeOf( Expr, Node.Value );
+        if ( Node.Type == ESpecType::Other || ( Symbol != INVALID_SYMBOL && FindMemorySlot( Machine, Expr ) >= 0 ) ) {
+            return Fail();
+        }
+        Node.Op = Node.Type == ESpecType::Int ? ESpecOp::Int : ESpecOp::Float;
+        return Node;
+    }
+
+    OSpecNode CompileIntrinsic( const OExprPtr Expr, const ESpecOp Op ) {
+        const int ArgCount = Expr->Children.Length() - 1;
+        if ( ( Op == ESpecOp::Mod || Op == ESpecOp::Equal || Op == ESpecOp::Less || Op == ESpecOp::Greater ) && ArgCount != 2 ) {
+            return Fail();
+        }
+        // A ? without an else branch returns an empty value, which is not a number.
+        if ( ( Op == ESpecOp::Sqrt && ArgCount != 1 ) || ( Op == ESpecOp::Branch && ArgCount != 3 ) ) {
+            return Fail();
+        }
+        OSpecNode Node{ Op };
+        for ( int i = 1; i < Expr->Children.Length() && !Failed; i++ ) {
+            Node.Args.push_back( Compile( Expr->Children[ i ] ) );
+        }
+        if ( Failed ) {
+            return {};
+        }
+        switch ( Op ) {
+        case ESpecOp::Mul:
+        case ESpecOp::Div:
+        case ESpecOp::Sqrt:
+            Node.Type = ESpecType::Float;
+            break;
+        case ESpecOp::Branch:
+            if ( Node.Args[ 1 ].Type != Node.Args[ 2 ].Type ) {
+                return Fail();
+            }
+            Node.Type = Node.Args[ 1 ].Type;
+            break;
+        default:
+            Node.Type = ESpecType::Int;
+            break;
+        }
+        return Node;
+    }
+
+    OSpecNode CompileCall( const OExprPtr Expr, const int Symbol, const OExprPtr Callee ) {
+        const int ArgCount = Expr->Children.Length() - 1;
+        if ( Callee->Type != OExprType::ExprFunc || ArgCount != Callee->Children.Length() - 2 ) {
+            return Fail();
+        }
+        OSpecNode Node{ ESpecOp::Call };
+        vector<ESpecType> Signature{};
+        for ( int i = 1; i < Expr->Children.Length() && !Failed; i++ ) {
+            Node.Args.push_back( Compile( Expr->Children[ i ] ) );
+            Signature.push_back( Node.Args.back().Type );
+        }
+        if ( Failed ) {
+            return {};
+        }
+        const vector<int>& CalleeParams = GetFunctionInfo( Callee ).ParamSymbols;
+        for ( int Arg = 0; Arg + 1 < ArgCount; Arg++ ) {
+            for ( int Param = 0; Param < static_cast<int>( Spec.Params.size() ); Param++ ) {
+                if ( ParamSymbol( Param ) != CalleeParams[ Arg ] ) {
+                    continue;
+                }
+                if ( Signature[ Arg ] != Spec.Params[ Param ] ) {
+                    return Fail();
+                }
+                Node.Rebinds.emplace_back( Param, Arg );
+            }
+        }
+        if ( &*Callee == Info.Function && Signature == Spec.Params ) {
+            CallsSelf = true;
+            Node.Callee = &Spec;
+        } else {
+            Node.Callee = GetSpecialization( Machine, Callee, Signature, {} );
+            // Mutual recursion would need the callee's result type before it is known.
+            if ( Node.Callee == nullptr || Node.Callee->Compiling ) {
+                return Fail();
+            }
+            for ( const OSpecDependency& Dependency : Node.Callee->Dependencies ) {
+                Depend( Dependency.Symbol, Dependency.Function );
+            }
+        }
+        Depend( Symbol, &*Callee );
+        Node.Symbol = Symbol;
+        Node.Type = Node.Callee->Result;
+        return Node;
+    }
+};
+
+// Finds or compiles the specialization of Function for Params, whose last
+// values are the Captured ones. Null when the body does not qualify or the
+// argument types do not match the annotations.
+OSpecialization* GetSpecialization( OMachinePtr Machine, const OExprPtr Function, const vector<ESpecType>& Params, const vector<int>& Captured ) {
+    OFunctionInfo& Info = GetFunctionInfo( Function );
+    if ( !Info.Specializable ) {
+        return nullptr;
+    }
+    for ( int i = 0; i < static_cast<int>( Params.size() ); i++ ) {
+        const ESpecType Declared = i < static_cast<int>( Info.Declared.size() ) ? Info.Declared[ i ] : ESpecType::Unknown;
+        const bool Matches = Declared == ESpecType::Unknown || Declared == Params[ i ];
+        if ( Params[ i ] == ESpecType::Other || !Matches ) {
+            return nullptr;
+        }
+    }
+    for ( const OSpecializationPtr& Spec : Info.Specializations ) {
+        if ( Spec->Params == Params && Spec->Captured == Captured ) {
+            return Spec->Failed ? nullptr : &*Spec;
+        }
+    }
+    if ( static_cast<int>( Info.Specializations.size() ) >= SPEC_MAX_SIGNATURES ) {
+        return nullptr;
+    }
+    OSpecializationPtr Spec = make_shared<OSpecialization>();
+    Spec->Params = Params;
+    Spec->Captured = Captured;
+    Spec->Compiling = true;
+    Info.Specializations.push_back( Spec );
+    // A recursive call's type is the result type being inferred, so try each until one is consistent.
+    Spec->Failed = true;
+    for ( const ESpecType Result : { ESpecType::Int, ESpecType::Float } ) {
+        Spec->Result = Result;
+        Spec->Dependencies.clear();
+        OSpecCompiler Compiler{ Machine, Function, Info, *Spec };
+        Spec->Body = Compiler.Compile( Function->Children.Last() );
+        if ( Compiler.Failed ) {
+            break;
+        }
+        if ( !Compiler.CallsSelf || Spec->Body.Type == Result ) {
+            Spec->Result = Spec->Body.Type;
+            Spec->Failed = false;
+            break;
+        }
+    }
+    Spec->Compiling = false;
+    return Spec->Failed ? nullptr : &*Spec;
+}
+
+bool SpecStackDeep( const OMachinePtr Machine ) {
+    return NativeStackUsed( Machine ) > Machine->NativeStackLimit / 2;
+}
+
+OExprPtr BoxSpecialized( const OSpecValue Value, const ESpecType Type ) {
+    if ( Type == ESpecType::Int ) {
+        return Make_OExprPtr_Int( {}, Value.Int );
+    }
+    char Text[ 32 ];
+    const int Length = SpecText( Value, Type, Text, sizeof( Text ) );
+    return Make_OExprPtr_Data( {}, string( Text, Length ) );
+}
+
+// Evaluates the body of the function bound to Symbol generically, with Args bound to its parameters.
+bool CallGeneric( OMachinePtr Machine, const int Symbol, const OSpecialization& Callee, const OSpecValue* Args, OSpecValue& Out ) {
+    uint64 ScanLength = 0;
+    const OExprPtr Function = Machine->Stack.Slots[ Machine->Stack.Find( Symbol, ScanLength ) ].Value;
+    const OFunctionInfo& Info = GetFunctionInfo( Function );
+    PushFrame( Machine );
+    for ( int i = 0; i < static_cast<int>( Info.ParamSymbols.size() ); i++ ) {
+        Machine->Stack.Set( Info.ParamSymbols[ i ], BoxSpecialized( Args[ i ], Callee.Params[ i ] ) );
+    }
+    const OExprPtr Result = EvalExpr( Machine, Function->Children.Last(), EEvalIntrinsicMode::Execute );
+    PopFrame( Machine );
+    return !Machine->EvalError && SpecTypeOf( Result, Out ) == Callee.Result;
+}
+
+struct OSpecRun {
+    OMachinePtr Machine;
+    bool Bailed = false;
+};
+
+OSpecValue RunSpecialized( const OSpecNode& Node, const OSpecValue* Params, OSpecRun& Run );
+
+OSpecValue RunSpecializedArg( const OSpecNode& Node, const int Index, const OSpecValue* Params, OSpecRun& Run, ESpecType& Type ) {
+    Type = Node.Args[ Index ].Type;
+    return RunSpecialized( Node.Args[ Index ], Params, Run );
+}
+
+int RunSpecializedInt( const OSpecNode& Node, const OSpecValue* Params, OSpecRun& Run ) {
+    return SpecToInt( RunSpecialized( Node, Params, Run ), Node.Type );
+}
+
+float RunSpecializedFloat( const OSpecNode& Node, const OSpecValue* Params, OSpecRun& Run ) {
+    return SpecToFloat( RunSpecialized( Node, Params, Run ), Node.Type );
+}
+
+OSpecValue RunSpecialized( const OSpecNode& Node, const OSpecValue* Params, OSpecRun& Run ) {
+    OSpecValue Out{};
+    ESpecType Type{};
+    ESpecType RHSType{};
+    const int ArgCount = static_cast<int>( Node.Args.size() );
+    switch ( Node.Op ) {
+    case ESpecOp::Int:
+    case ESpecOp::Float:
+        return Node.Value;
+    case ESpecOp::Param:
+        return Params[ Node.Param ];
+    case ESpecOp::Add:
+    case ESpecOp::Sub: {
+        // Wraps like the generic int arithmetic rather than overflowing.
+        unsigned int Sum = 0;
+        for ( int i = 0; i < ArgCount; i++ ) {
+            const unsigned int Arg = static_cast<unsigned int>( RunSpecializedInt( Node.Args[ i ], Params, Run ) );
+            Sum = ( i == 0 || Node.Op == ESpecOp::Add ) ? Sum + Arg : Sum - Arg;
+        }
+        Out.Int = static_cast<int>( Sum );
+        return Out;
+    }
+    case ESpecOp::Mul:
+    case ESpecOp::Div: {
+        float Sum = 0;
+        for ( int i = 0; i < ArgCount; i++ ) {
+            const float Arg = RunSpecializedFloat( Node.Args[ i ], Params, Run );
+            Sum = i == 0 ? Arg : Node.Op == ESpecOp::Mul ? Sum * Arg : Sum / Arg;
+        }
+        Run.Bailed |= !SpecRoundFloat( Sum, Out.Float );
+        return Out;
+    }
+    case ESpecOp::IntDiv:
+    case ESpecOp::Mod: {
+        int Sum = 0;
+        for ( int i = 0; i < ArgCount && !Run.Bailed; i++ ) {
+            const int Arg = RunSpecializedInt( Node.Args[ i ], Params, Run );
+            if ( i > 0 && ( Arg == 0 || ( Sum == INT_MIN && Arg == -1 ) ) ) {
+                Run.Bailed = true;
+                break;
+            }
+            Sum = i == 0 ? Arg : Node.Op == ESpecOp::IntDiv ? Sum / Arg : Sum % Arg;
+        }
+        Out.Int = Sum;
+        return Out;
+    }
+    case ESpecOp::Sqrt:
+        Run.Bailed |= !SpecRoundFloat( sqrtf( RunSpecializedFloat( Node.Args[ 0 ], Params, Run ) ), Out.Float );
+        return Out;
+    case ESpecOp::Equal: {
+        const OSpecValue LHS = RunSpecializedArg( Node, 0, Params, Run, Type );
+        const OSpecValue RHS = RunSpecializedArg( Node, 1, Params, Run, RHSType );
+        if ( Type == ESpecType::Int && RHSType == ESpecType::Int ) {
+            Out.Int = LHS.Int == RHS.Int;
+            return Out;
+        }
+        char LHSText[ 32 ];
+        char RHSText[ 32 ];
+        const int LHSLength = SpecText( LHS, Type, LHSText, sizeof( LHSText ) );
+        const int RHSLength = SpecText( RHS, RHSType, RHSText, sizeof( RHSText ) );
+        Out.Int = string_view( LHSText, LHSLength ) == string_view( RHSText, RHSLength );
+        return Out;
+    }
+    case ESpecOp::Less:
+    case ESpecOp::Greater: {
+        const OSpecValue LHS = RunSpecializedArg( Node, 0, Params, Run, Type );
+        const OSpecValue RHS = RunSpecializedArg( Node, 1, Params, Run, RHSType );
+        if ( Type == ESpecType::Int && RHSType == ESpecType::Int ) {
+            Out.Int = Node.Op == ESpecOp::Less ? LHS.Int < RHS.Int : LHS.Int > RHS.Int;
+            return Out;
+        }
+        const float L = SpecToFloat( LHS, Type );
+        const float R = SpecToFloat( RHS, RHSType );
+        Out.Int = Node.Op == ESpecOp::Less ? L < R : L > R;
+        return Out;
+    }
+    case ESpecOp::Branch: {
+        const OSpecValue Cond = RunSpecializedArg( Node, 0, Params, Run, Type );
+        // False is exactly the text 0, so a float -0 is true.
+        const bool IsFalse = Type == ESpecType::Int ? Cond.Int == 0 : ( Cond.Float == 0 && !signbit( Cond.Float ) );
+        return RunSpecialized( Node.Args[ IsFalse ? 2 : 1 ], Params, Run );
+    }
+    case ESpecOp::Call: {
+        if ( Run.Bailed ) {
+            return Out;
+        }
+        OSpecValue Args[ SPEC_MAX_PARAMS ];
+        OSpecValue Scope[ SPEC_MAX_PARAMS ];
+        const OSpecValue* ArgParams = Params;
+        size_t Rebind = 0;
+        for ( int i = 0; i < ArgCount; i++ ) {
+            Args[ i ] = RunSpecialized( Node.Args[ i ], ArgParams, Run );
+            for ( ; Rebind < Node.Rebinds.size() && Node.Rebinds[ Rebind ].second == i; Rebind++ ) {
+                if ( ArgParams == Params ) {
+                    memcpy( Scope, Params, sizeof( Scope ) );
+                    ArgParams = Scope;
+                }
+                Scope[ Node.Rebinds[ Rebind ].first ] = Args[ i ];
+            }
+        }
+        GStats.Calls++;
+        if ( SpecStackDeep( Run.Machine ) ) {
+            Run.Bailed |= !CallGeneric( Run.Machine, Node.Symbol, *Node.Callee, Args, Out );
+            return Out;
+        }
+        return RunSpecialized( Node.Callee->Body, Args, Run );
+    }
+    case ESpecOp::Sequence:
+        for ( int i = 0; i < ArgCount; i++ ) {
+            Out = RunSpecialized( Node.Args[ i ], Params, Run );
+        }
+        return Out;
+    }
+    return Out;
+}
+
+// True while every name Spec was compiled against is still bound as it was.
+bool SpecDependenciesHold( const OMachinePtr Machine, const OSpecialization& Spec ) {
+    for ( const OSpecDependency& Dependency : Spec.Dependencies ) {
+        uint64 ScanLength = 0;
+        const int Slot = Machine->Stack.Find( Dependency.Symbol, ScanLength );
+        if ( Slot < 0 ? Dependency.Function != nullptr : &*Machine->Stack.Slots[ Slot ].Value != Dependency.Function ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs Function's specialized body on the arguments bound in the top frame.
+// Returns null when the generic body has to be evaluated instead.
+OExprPtr TrySpecializedCall( OMachinePtr Machine, const OExprPtr Function ) {
+    if ( !Machine->Specialize || Machine->Profiler != nullptr || TraceEnabled() || SpecStackDeep( Machine ) ) {
+        return nullptr;
+    }
+    OFunctionInfo& Info = GetFunctionInfo( Function );
+    const OFrameStack& Stack = Machine->Stack;
+    const int First = Stack.FrameStarts[ Stack.Depth() - 1 ];
+    const int Count = static_cast<int>( Info.ParamSymbols.size() );
+    if ( !Info.Specializable || Stack.Slots.Length() - First < Count ) {
+        return nullptr;
+    }
+    OSpecValue Args[ SPEC_MAX_PARAMS ];
+    vector<ESpecType> Signature( Count );
+    for ( int i = 0; i < Count; i++ ) {
+        const OBinding& Binding = Stack.Slots[ First + i ];
+        if ( Binding.Symbol != Info.ParamSymbols[ i ] ) {
+            return nullptr;
+        }
+        Signature[ i ] = SpecTypeOf( Binding.Value, Args[ i ] );
+        // An int argument behaves the same as a float with the same text.
+        if ( Signature[ i ] == ESpecType::Int && Info.Declared[ i ] == ESpecType::Float ) {
+            Signature[ i ] = ESpecType::Float;
+            Args[ i ].Float = static_cast<float>( Args[ i ].Int );
+        }
+    }
+    // Bindings after the params are a closure's captured values. Those that are
+    // numbers are passed on like params, and the body may not use the others.
+    vector<int> Captured{};
+    for ( int i = First + Count; i < Stack.Slots.Length(); i++ ) {
+        OSpecValue Value{};
+        const ESpecType Type = SpecTypeOf( Stack.Slots[ i ].Value, Value );
+        if ( Type == ESpecType::Other ) {
+            continue;
+        }
+        if ( static_cast<int>( Signature.size() ) == SPEC_MAX_PARAMS ) {
+            return nullptr;
+        }
+        Args[ Signature.size() ] = Value;
+        Signature.push_back( Type );
+        Captured.push_back( Stack.Slots[ i ].Symbol );
+    }
+    OSpecialization* Spec = GetSpecialization( Machine, Function, Signature, Captured );
+    if ( Spec == nullptr || Spec->Bailouts >= SPEC_MAX_BAILOUTS ) {
+        return nullptr;
+    }
+    if ( !SpecDependenciesHold( Machine, *Spec ) ) {
+        return nullptr;
+    }
+    OSpecRun Run{ Machine };
+    const OSpecValue Result = RunSpecialized( Spec->Body, Args, Run );
+    if ( Run.Bailed ) {
+        Spec->Bailouts++;
+        return nullptr;
+    }
+    GStats.SpecializedCalls++;
+    return BoxSpecialized( Result, Spec->Result );
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+// Which Make_OExprPtr* factory allocated a node.
+enum class EAllocSite : int {
+    Empty,
+    Typed,
+    DataToken,
+    DataAtom,
+    Object,
+    Int,
+    Intrinsic,
+    Machine,
+    Count
+};
+
+const char* const AllocSiteNames[] = { "Make_OExprPtr_Empty", "Make_OExprPtr", "Make_OExprPtr_Data(Token)", "Make_OExprPtr_Data(Atom)", "Make_OExprPtr_Object", "Make_OExprPtr_Int", "Make_OIntriniscPtr", "Make_OMachinePtr" };
+
+// Always-on evaluator counters. Plain per-thread increments, no atomics.
+// Lookup timing costs two clock reads per lookup, so it only runs when TimeLookups is set (--stats).
+struct OStats {
+    uint64 Allocations[ static_cast<int>( EAllocSite::Count ) ]{};
+    uint64 Evals{};
+    uint64 Calls{};
+    // Calls that ran a type-specialized body, counted once per entry from the evaluator.
+    uint64 SpecializedCalls{};
+    uint64 FramesPushed{};
+    uint64 PeakStackDepth{};
+    uint64 PeakEvalFrames{};
+    uint64 IntrinsicLookups{};
+    uint64 IntrinsicScanLength{};
+    uint64 MemoryLookups{};
+    uint64 MemoryScanLength{};
+    uint64 LookupNs{};
+    bool TimeLookups{};
+
+    uint64 TotalAllocations() const {
+        uint64 Total = 0;
+        for ( const uint64 Count : Allocations ) {
+            Total += Count;
+        }
+        return Total;
+    }
+
+    string ToString() const {
+        stringstream SS;
+        SS << "Evaluations: " << Evals << "\n";
+        SS << "Calls: " << Calls << ", specialized entries: " << SpecializedCalls << "\n";
+        SS << "Frames pushed: " << FramesPushed << ", peak stack depth: " << PeakStackDepth << "\n";
+        SS << "Peak continuation frames: " << PeakEvalFrames << "\n";
+        SS << "Intrinsic lookups: " << IntrinsicLookups << ", entries scanned: " << IntrinsicScanLength
+           << ", avg scan: " << ( IntrinsicLookups > 0 ? static_cast<double>( IntrinsicScanLength ) / IntrinsicLookups : 0.0 ) << "\n";
+        SS << "Memory lookups: " << MemoryLookups << ", entries scanned: " << MemoryScanLength
+           << ", avg scan: " << ( MemoryLookups > 0 ? static_cast<double>( MemoryScanLength ) / MemoryLookups : 0.0 ) << "\n";
+        if ( TimeLookups ) {
+            SS << "Lookup time: " << LookupNs / 1e6 << " ms\n";
+        }
+        SS << "Allocations: " << TotalAllocations() << "\n";
+        for ( int i = 0; i < static_cast<int>( EAllocSite::Count ); i++ ) {
+            if ( Allocations[ i ] > 0 ) {
+                SS << "  " << AllocSiteNames[ i ] << ": " << Allocations[ i ] << "\n";
+            }
+        }
+        return SS.str();
+    }
+};
+
+thread_local OStats GStats{};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+using namespace std;
+
+const int INVALID_SYMBOL = -1;
+// Token symbol cache states, see OToken::Symbol.
+const int UNRESOLVED_SYMBOL = -2;
+const int NOT_A_SYMBOL = -3;
+
+// Interns identifier names into dense integer ids shared by the whole process.
+struct OSymbolTable {
+    vector<string> Names{};
+    unordered_map<string, int> Ids{};
+    mutable mutex Lock{};
+
+    int Intern( string_view Name ) {
+        lock_guard<mutex> Guard{ Lock };
+        auto Found = Ids.find( string( Name ) );
+        if ( Found != Ids.end() ) {
+            return Found->second;
+        }
+        const int Id = static_cast<int>( Names.size() );
+        Names.emplace_back( Name );
+        Ids.emplace( Names.back(), Id );
+        return Id;
+    }
+
+    // Returns INVALID_SYMBOL without interning when Name was never seen.
+    int Find( string_view Name ) const {
+        lock_guard<mutex> Guard{ Lock };
+        auto Found = Ids.find( string( Name ) );
+        return Found != Ids.end() ? Found->second : INVALID_SYMBOL;
+    }
+
+    string Name( const int Id ) const {
+        lock_guard<mutex> Guard{ Lock };
+        return Id >= 0 && Id < static_cast<int>( Names.size() ) ? Names[ Id ] : string{};
+    }
+
+    int Length() const {
+        lock_guard<mutex> Guard{ Lock };
+        return static_cast<int>( Names.size() );
+    }
+};
+
+OSymbolTable GSymbols{};
+
+// Identifiers and operators, as opposed to numbers and string literals.
+bool IsSymbolToken( string_view Token ) {
+    if ( Token.empty() || Token[ 0 ] == '`' ) {
+        return false;
+    }
+    const char First = Token[ 0 ];
+    if ( First >= '0' && First <= '9' ) {
+        return false;
+    }
+    if ( ( First == '-' || First == '+' || First == '.' ) && Token.size() > 1 && Token[ 1 ] >= '0' && Token[ 1 ] <= '9' ) {
+        return false;
+    }
+    return true;
+}
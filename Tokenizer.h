@@ -1,12 +1,17 @@
 #pragma once
 
 #include "Containers.h"
+#include "Symbols.h"
 
 #include <string>
 #include <assert.h>
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <string_view>
+#include <charconv>
+#include <cctype>
+#include <unordered_map>
 
 using namespace std;
 
@@ -20,6 +25,8 @@ struct OToken {
     int Line{};
     int Indent{};
     string Token{};
+    // Cached id from GSymbols, see TokenSymbol().
+    mutable int Symbol = UNRESOLVED_SYMBOL;
 };
 
 OToken Make_OToken(const int Line, const int Indent, const string& Str ) {
@@ -51,6 +58,14 @@ bool Contains( const string& Input, char Token ) {
     return IndexOf( Input, Token ) != -1;
 }
 
+bool Contains( string_view Input, char Token ) {
+    return Input.find( Token ) != string_view::npos;
+}
+
+bool IsWhiteSpace( const char Char ) {
+    return Char == ' ' || Char == '\t' || Char == '\n' || Char == '\r';
+}
+
 bool IsWhiteSpace( const string& Token ) {
     for ( const auto& WS : WhitespaceTokens ) {
         if ( Token == WS )
@@ -60,59 +75,113 @@ bool IsWhiteSpace( const string& Token ) {
 }
 
 template <typename T>
-T ParseTokenToPrimitive( const string& Token ) {
+T ParseTokenToPrimitive( string_view Token ) {
     T Out{};
+    // Plain integers skip the stringstream. Anything it can't take whole falls through.
+    if constexpr ( is_same_v<T, int> ) {
+        const from_chars_result Result = from_chars( Token.data(), Token.data() + Token.size(), Out );
+        if ( Result.ec == errc{} && Result.ptr != Token.data() ) {
+            return Out;
+        }
+        Out = {};
+    }
 	stringstream SS;
 	SS << Token;
     SS >> Out;
     return Out;
 }
 
-TokenList Tokenize( const string& Input ) {
+// True when Token is exactly the decimal text of an int, as to_chars would write it.
+bool ParseIntLiteral( string_view Token, int& Out ) {
+    if ( Token.empty() || Token.size() > 11 || !( isdigit( Token[ 0 ] ) || Token[ 0 ] == '-' ) ) {
+        return false;
+    }
+    const from_chars_result Result = from_chars( Token.data(), Token.data() + Token.size(), Out );
+    if ( Result.ec != errc{} || Result.ptr != Token.data() + Token.size() ) {
+        return false;
+    }
+    char Text[ 12 ];
+    const to_chars_result Written = to_chars( Text, Text + sizeof( Text ), Out );
+    return string_view( Text, Written.ptr - Text ) == Token;
+}
+
+void StrReplaceAll( string& str, const string& from, const string& to ) {
+    if ( from.empty() )
+        return;
+    size_t start_pos = 0;
+    while ( ( start_pos = str.find( from, start_pos ) ) != string::npos ) {
+        str.replace( start_pos, from.length(), to );
+        start_pos += to.length(); // In case 'to' contains 'from', like replacing 'x' with 'yx'
+    }
+}
+
+// Literals are unescaped once here, so printing only has to drop the quotes.
+void UnescapeStrLiteral( string& Literal ) {
+    StrReplaceAll( Literal, "\\n", "\n" );
+}
+
+// Names met by a tokenizer that runs off the main thread, with ids local to it in
+// order of first use. They are interned later, in source order.
+struct OTokenNames {
+    vector<string> Names{};
+    unordered_map<string, int> Ids{};
+
+    int Add( const string& Name ) {
+        auto Found = Ids.find( Name );
+        if ( Found != Ids.end() ) {
+            return Found->second;
+        }
+        const int Id = static_cast<int>( Names.size() );
+        Names.push_back( Name );
+        Ids.emplace( Name, Id );
+        return Id;
+    }
+};
+
+// Identifiers are interned up front so evaluation compares ids instead of strings.
+void AddToken( TokenList& Tokens, const int Line, const int Indent, const string& Token, OTokenNames* Names ) {
+    const bool IsSymbol = Token != ExpStart && Token != ExpEnd && IsSymbolToken( Token );
+    const int Symbol = !IsSymbol ? NOT_A_SYMBOL : Names != nullptr ? Names->Add( Token ) : GSymbols.Intern( Token );
+    Tokens.Add( OToken{ Line, Indent, Token, Symbol } );
+}
+
+// Line and Indent give the position of Input's first character. With Names, the
+// symbol of each token is an id into Names until the caller remaps it.
+TokenList Tokenize( string_view Input, int Line = 1, int Indent = 0, OTokenNames* Names = nullptr ) {
     TokenList Tokens{};
     string Token{};
     bool WithinStrLiteral = false;
-    int Line = 1;
-    int Indent = 0;
 
-    for ( char RawChar : Input ) {
-        const string Char{ RawChar };
-        if ( !WithinStrLiteral && Char == StrLit ) {
+    for ( const char Char : Input ) {
+        if ( !WithinStrLiteral && Char == StrLit[ 0 ] ) {
             WithinStrLiteral = true;
             Token += Char;
-        } else if ( WithinStrLiteral && Char == StrLit ) {
+        } else if ( WithinStrLiteral && Char == StrLit[ 0 ] ) {
             WithinStrLiteral = false;
             Token += Char;
-            Tokens.Add( OToken{ Line, Indent, Token } );
+            UnescapeStrLiteral( Token );
+            AddToken( Tokens, Line, Indent, Token, Names );
             Token = "";
         } else if ( WithinStrLiteral ) {
             Token += Char;
-        } else if ( Char == ExpStart ) {
-            if ( Token.size() > 0 ) {
-                Tokens.Add( OToken{ Line, Indent, Token } );
-                Token = "";
-            }
-            Token += Char;
-            Tokens.Add( OToken{ Line, Indent, Token } );
-            Token = "";
-        } else if ( Char == ExpEnd ) {
+        } else if ( Char == ExpStart[ 0 ] || Char == ExpEnd[ 0 ] ) {
             if ( Token.size() > 0 ) {
-                Tokens.Add( OToken{ Line, Indent, Token } );
+                AddToken( Tokens, Line, Indent, Token, Names );
                 Token = "";
             }
             Token += Char;
-            Tokens.Add( OToken{ Line, Indent, Token } );
+            AddToken( Tokens, Line, Indent, Token, Names );
             Token = "";
         } else if ( IsWhiteSpace( Char ) ) {
             if ( Token.size() > 0 ) {
-                Tokens.Add( OToken{ Line, Indent, Token } );
+                AddToken( Tokens, Line, Indent, Token, Names );
                 Token = "";
             }
         } else {
             Token += Char;
         }
 
-        if ( Char == "\n" ) {
+        if ( Char == '\n' ) {
             Line++;
             Indent = 0;
         } else {
@@ -136,18 +205,13 @@ string TrimEnclosingQuotes( const string& In ) {
     return In;
 }
 
-void StrReplaceAll( string& str, const string& from, const string& to ) {
-    if ( from.empty() )
-        return;
-    size_t start_pos = 0;
-    while ( ( start_pos = str.find( from, start_pos ) ) != string::npos ) {
-        str.replace( start_pos, from.length(), to );
-        start_pos += to.length(); // In case 'to' contains 'from', like replacing 'x' with 'yx'
+string_view TrimEnclosingQuotesView( string_view In ) {
+    if ( In.size() >= 2 && In[ 0 ] == StrLit[ 0 ] && In[ In.size() - 1 ] == StrLit[ 0 ] ) {
+        return In.substr( 1, In.size() - 2 );
     }
+    return In;
 }
 
 string FilterRawStringForPrinting( const string& from ) {
-    string Out = TrimEnclosingQuotes( from );
-    StrReplaceAll( Out, "\\n", "\n" );
-    return Out;
+    return string( TrimEnclosingQuotesView( from ) );
 }
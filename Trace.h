@@ -0,0 +1,184 @@
+#pragma once
+
+#include "Symbols.h"
+#include "Profiler.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cstdint>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+enum class ETraceEvent : uint32_t {
+    Eval,
+    IntrinsicEnter,
+    IntrinsicExit,
+    CallEnter,
+    CallExit
+};
+
+const char* const TraceEventNames[] = { "eval", "intrinsic-enter", "intrinsic-exit", "call-enter", "call-exit" };
+
+// Fixed-size trace record, written as-is to the dump file.
+struct OTraceRecord {
+    uint64_t TimestampNs;
+    int32_t Symbol;
+    int32_t Line;
+    uint32_t Event;
+    uint32_t Reserved;
+};
+
+static_assert( sizeof( OTraceRecord ) == 24, "Trace records are a fixed 24 bytes." );
+
+const char TRACE_MAGIC[ 8 ] = { 'O', 'W', 'L', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t TRACE_VERSION = 1;
+const uint64_t TRACE_RING_SIZE = 1 << 16;
+
+// Single-producer ring owned by one thread. Only the owner writes records.
+// Head is published with release ordering so a dump from another thread or
+// a signal handler sees complete records.
+struct OTraceRing {
+    uint32_t ThreadIndex{};
+    atomic<uint64_t> Head{ 0 };
+    OTraceRecord Records[ TRACE_RING_SIZE ]{};
+
+    void Write( const ETraceEvent Event, const int Symbol, const int Line ) {
+        const uint64_t Index = Head.load( memory_order_relaxed );
+        OTraceRecord& Record = Records[ Index & ( TRACE_RING_SIZE - 1 ) ];
+        Record.TimestampNs = NowNs();
+        Record.Symbol = Symbol;
+        Record.Line = Line;
+        Record.Event = static_cast<uint32_t>( Event );
+        Head.store( Index + 1, memory_order_release );
+    }
+};
+
+struct OTracer {
+    atomic<bool> Enabled{ false };
+    string DumpPath = "owlisp.trace";
+    mutex RingsLock{};
+    vector<unique_ptr<OTraceRing>> Rings{};
+
+    OTraceRing* RegisterThread() {
+        lock_guard<mutex> Guard{ RingsLock };
+        Rings.push_back( make_unique<OTraceRing>() );
+        Rings.back()->ThreadIndex = static_cast<uint32_t>( Rings.size() - 1 );
+        return Rings.back().get();
+    }
+};
+
+OTracer GTracer{};
+thread_local OTraceRing* GTraceRing = nullptr;
+
+inline bool TraceEnabled() {
+    return GTracer.Enabled.load( memory_order_relaxed );
+}
+
+void TraceWrite( const ETraceEvent Event, const int Symbol, const int Line ) {
+    if ( GTraceRing == nullptr ) {
+        GTraceRing = GTracer.RegisterThread();
+    }
+    GTraceRing->Write( Event, Symbol, Line );
+}
+
+// Writes with plain file descriptors so the same code can run from a crash handler.
+bool TraceWriteAll( const int File, const void* Data, size_t Size ) {
+#if defined(_WIN32)
+    return false;
+#else
+    const char* Bytes = static_cast<const char*>( Data );
+    while ( Size > 0 ) {
+        const ssize_t Written = write( File, Bytes, Size );
+        if ( Written <= 0 ) {
+            return false;
+        }
+        Bytes += Written;
+        Size -= static_cast<size_t>( Written );
+    }
+    return true;
+#endif
+}
+
+// File layout: magic, version, record size, symbol count, symbols as
+// (u32 length, bytes), ring count, then per ring (u32 thread index,
+// u32 record count, records oldest first).
+bool TraceDump( const char* Path ) {
+#if defined(_WIN32)
+    return false;
+#else
+    const int File = open( Path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( File < 0 ) {
+        return false;
+    }
+    const uint32_t Header[] = { TRACE_VERSION, sizeof( OTraceRecord ), static_cast<uint32_t>( GSymbols.Names.size() ) };
+    bool Good = TraceWriteAll( File, TRACE_MAGIC, sizeof( TRACE_MAGIC ) ) && TraceWriteAll( File, Header, sizeof( Header ) );
+    for ( const string& Name : GSymbols.Names ) {
+        const uint32_t Length = static_cast<uint32_t>( Name.size() );
+        Good = Good && TraceWriteAll( File, &Length, sizeof( Length ) ) && TraceWriteAll( File, Name.data(), Name.size() );
+    }
+    const uint32_t RingCount = static_cast<uint32_t>( GTracer.Rings.size() );
+    Good = Good && TraceWriteAll( File, &RingCount, sizeof( RingCount ) );
+    for ( const auto& Ring : GTracer.Rings ) {
+        const uint64_t Head = Ring->Head.load( memory_order_acquire );
+        const uint64_t Count = Head < TRACE_RING_SIZE ? Head : TRACE_RING_SIZE;
+        const uint32_t RingHeader[] = { Ring->ThreadIndex, static_cast<uint32_t>( Count ) };
+        Good = Good && TraceWriteAll( File, RingHeader, sizeof( RingHeader ) );
+        for ( uint64_t i = Head - Count; i < Head && Good; i++ ) {
+            Good = TraceWriteAll( File, &Ring->Records[ i & ( TRACE_RING_SIZE - 1 ) ], sizeof( OTraceRecord ) );
+        }
+    }
+    close( File );
+    return Good;
+#endif
+}
+
+void TraceCrashHandler( int Signal ) {
+    // Best effort: the symbol table may be mid-update if the crash happened while interning.
+    TraceDump( GTracer.DumpPath.c_str() );
+    signal( Signal, SIG_DFL );
+    raise( Signal );
+}
+
+void TraceDumpSignalHandler( int ) {
+    TraceDump( GTracer.DumpPath.c_str() );
+}
+
+// Dumps on a crash, and on SIGUSR1 so a running process can be inspected.
+// Runs on its own stack so a native stack overflow can still be dumped.
+void TraceInstallSignalHandlers() {
+#if !defined(_WIN32)
+    static vector<char> AltStack( 1 << 16 );
+    stack_t Stack{};
+    Stack.ss_sp = AltStack.data();
+    Stack.ss_size = AltStack.size();
+    sigaltstack( &Stack, nullptr );
+
+    struct sigaction Action{};
+    Action.sa_handler = TraceCrashHandler;
+    Action.sa_flags = SA_ONSTACK;
+    sigemptyset( &Action.sa_mask );
+    for ( const int Signal : { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL } ) {
+        sigaction( Signal, &Action, nullptr );
+    }
+    Action.sa_handler = TraceDumpSignalHandler;
+    sigaction( SIGUSR1, &Action, nullptr );
+#endif
+}
+
+void TraceEnable( const bool Enable ) {
+    if ( Enable ) {
+        TraceInstallSignalHandlers();
+    }
+    GTracer.Enabled.store( Enable, memory_order_relaxed );
+}
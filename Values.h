@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// A native runtime value carried on an atom in place of a token.
+struct OObject {
+    virtual ~OObject() = default;
+    // Text of the value, used when it is printed or compared.
+    virtual string_view View() const = 0;
+};
+
+typedef shared_ptr<OObject> OObjectPtr;
+
+// Immutable string value backed by a shared, append-only buffer.
+// Each value owns the first Length bytes. Appending to the value that ends
+// at the buffer tip extends the buffer in place, so repeated appends are
+// amortized O(1). Appending to an older value copies its prefix first.
+struct OStringBuilder : OObject {
+    shared_ptr<string> Buffer;
+    size_t Length = 0;
+
+    string_view View() const override {
+        return string_view{ Buffer->data(), Length };
+    }
+};
+
+typedef shared_ptr<OStringBuilder> OStringBuilderPtr;
+
+// A string that points into memory kept alive by Owner, such as a mapped file.
+struct OStringView : OObject {
+    shared_ptr<const void> Owner;
+    string_view Text;
+
+    string_view View() const override {
+        return Text;
+    }
+};
+
+// Strings compare by text. Every other object is equal only to itself.
+bool IsTextObject( const OObject* Object ) {
+    return dynamic_cast<const OStringBuilder*>( Object ) != nullptr || dynamic_cast<const OStringView*>( Object ) != nullptr;
+}
+
+OStringBuilderPtr Make_OStringBuilder( string_view Initial ) {
+    OStringBuilderPtr Builder = make_shared<OStringBuilder>();
+    Builder->Buffer = make_shared<string>( Initial );
+    Builder->Length = Initial.size();
+    return Builder;
+}
+
+OStringBuilderPtr StringBuilderAppend( const OStringBuilderPtr& From, string_view Str ) {
+    OStringBuilderPtr Builder = make_shared<OStringBuilder>();
+    if ( From->Length == From->Buffer->size() ) {
+        Builder->Buffer = From->Buffer;
+    } else {
+        Builder->Buffer = make_shared<string>( From->View() );
+    }
+    Builder->Buffer->append( Str );
+    Builder->Length = Builder->Buffer->size();
+    return Builder;
+}
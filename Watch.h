@@ -0,0 +1,296 @@
+#pragma once
+
+// Live reload. `Owlisp --watch File` runs the file, then polls it and applies
+// each saved version to the same machine. The structural pass cuts a version
+// into its top-level forms, and a form whose text is unchanged keeps its
+// tokens, its names and the fact that it ran, wherever it moved to. Only new
+// forms are tokenized. Of the rest, a form runs again when it comes after a
+// form that ran and names something that form binds. Function bodies look
+// names up when called, so a function that names a rebound name counts as
+// rebound too, and its defunc is not run again. A name whose definition was
+// removed is unbound, and every form that still binds or names it runs again.
+
+#include "Parse.h"
+
+#include <filesystem>
+#include <set>
+#include <thread>
+#include <unordered_set>
+
+const int WATCH_POLL_MS = 100;
+
+struct OWatchForm {
+    // From the first character that is not white space.
+    string Text{};
+    uint64 Hash = 0;
+    int Line = 1;
+    int Indent = 0;
+    // Until the form runs.
+    TokenList Tokens{};
+    // Names bound with = or defunc outside of any function body.
+    vector<int> Defines{};
+    // Every name in the form, the ones it binds included.
+    vector<int> Names{};
+    // A defunc, or an = of a fn: running it again would bind the same function.
+    bool DefinesFunction = false;
+    // Cleared when the form raised an error or was not reached.
+    bool Ran = false;
+    // Index in the version last applied.
+    int Position = -1;
+    // The reload that last found the form's text.
+    int Version = 0;
+};
+
+struct OWatchState {
+    // By id. Removed forms are left empty.
+    vector<OWatchForm> Forms{};
+    // Form ids in source order.
+    vector<int> Order{};
+    unordered_map<uint64, vector<int>> ByHash{};
+    // Forms naming each symbol.
+    unordered_map<int, unordered_set<int>> Users{};
+    int Version = 0;
+};
+
+// Reads what the forms in Tokens[ Begin, End ) bind and name. Names bound
+// inside a defunc or fn body are locals and not counted. The names linked by
+// an import are bound like an =.
+void ScanBindings( const TokenList& Tokens, const int Begin, const int End, vector<int>& Defines, vector<int>& Names, bool& DefinesFunction ) {
+    int Depth = 0;
+    // Depth of the defunc or fn being skipped over, or 0.
+    int FunctionDepth = 0;
+    // Depth of the import being read, or 0.
+    int ImportDepth = 0;
+    for ( int i = Begin; i < End; i++ ) {
+        const OToken& Token = Tokens[ i ];
+        if ( Token.Token == ExpStart ) {
+            Depth++;
+            if ( FunctionDepth == 0 && i + 2 < End ) {
+                const string& Head = Tokens[ i + 1 ].Token;
+                if ( ( Head == "=" || Head == TOKEN_DEFUNC ) && Tokens[ i + 2 ].Symbol >= 0 ) {
+                    Defines.push_back( Tokens[ i + 2 ].Symbol );
+                }
+                if ( Head == TOKEN_DEFUNC || Head == "fn" ) {
+                    FunctionDepth = Depth;
+                }
+                if ( Head == TOKEN_IMPORT ) {
+                    ImportDepth = Depth;
+                    i++;
+                }
+            }
+        } else if ( Token.Token == ExpEnd ) {
+            if ( Depth == FunctionDepth ) {
+                FunctionDepth = 0;
+            }
+            if ( Depth == ImportDepth ) {
+                ImportDepth = 0;
+            }
+            Depth--;
+        } else if ( Token.Symbol >= 0 ) {
+            Names.push_back( Token.Symbol );
+            if ( Depth == ImportDepth ) {
+                Defines.push_back( Token.Symbol );
+            }
+        }
+    }
+    sort( Names.begin(), Names.end() );
+    Names.erase( unique( Names.begin(), Names.end() ), Names.end() );
+    const auto TokenIs = [&Tokens, Begin, End]( const int i, const string& Text ) {
+        return Begin + i < End && Tokens[ Begin + i ].Token == Text;
+    };
+    DefinesFunction = TokenIs( 0, ExpStart ) && ( TokenIs( 1, TOKEN_DEFUNC ) || ( TokenIs( 1, "=" ) && TokenIs( 3, ExpStart ) && TokenIs( 4, "fn" ) ) );
+}
+
+// Runs one form on the global frame. Returns false after an eval error.
+bool RunWatchForm( OMachinePtr Machine, OWatchForm& Form ) {
+    if ( Form.Tokens.IsEmpty() ) {
+        Form.Tokens = Tokenize( Form.Text, Form.Line, Form.Indent );
+    }
+    // Evaluation writes results into the tree, so every run parses afresh. Like
+    // the prompt, forms skip the AST pool, whose tables grow with the symbol count.
+    Execute( Machine, ConstructRootExpr( Form.Tokens ) );
+    Form.Tokens.Clear();
+    Form.Ran = !Machine->EvalError;
+    return Form.Ran;
+}
+
+// Applies Source as the next version of the script. Returns the number of forms run.
+int WatchReload( OMachinePtr Machine, OWatchState& State, const string& Source, const string& FileName ) {
+    const OStructuralIndex Index = IndexStructure( Source );
+    if ( !Index.Balanced ) {
+        std::cerr << "[watch] " << FileName << ": parens or backticks do not pair up, keeping the previous version." << std::endl;
+        return 0;
+    }
+    // The text between two boundaries is one form. Anything after the last is one more.
+    vector<OFormBoundary> Starts{ OFormBoundary{} };
+    Starts.insert( Starts.end(), Index.Boundaries.begin(), Index.Boundaries.end() );
+    vector<int> Order{};
+    vector<int> Dirty{};
+    State.Version++;
+    // Unchanged forms mostly come in the same order, so the old form at Cursor is tried first.
+    size_t Cursor = 0;
+    for ( size_t i = 0; i < Starts.size(); i++ ) {
+        const size_t End = i + 1 < Starts.size() ? Starts[ i + 1 ].Offset : Source.size();
+        string_view Text = string_view( Source ).substr( Starts[ i ].Offset, End - Starts[ i ].Offset );
+        const size_t First = Text.find_first_not_of( " \t\r\n" );
+        if ( First == string_view::npos ) {
+            continue;
+        }
+        int Line = Starts[ i ].Line;
+        int Indent = Starts[ i ].Indent;
+        for ( const char Char : Text.substr( 0, First ) ) {
+            Line += Char == '\n';
+            Indent = Char == '\n' ? 0 : Indent + 1;
+        }
+        Text.remove_prefix( First );
+        int Id = -1;
+        uint64 Hash = 0;
+        const auto Matches = [&State, &Hash, Text]( const int Candidate ) {
+            const OWatchForm& Form = State.Forms[ Candidate ];
+            return Form.Version != State.Version && Form.Hash == Hash && Form.Text == Text;
+        };
+        if ( Cursor < State.Order.size() && State.Forms[ State.Order[ Cursor ] ].Version != State.Version && State.Forms[ State.Order[ Cursor ] ].Text == Text ) {
+            Id = State.Order[ Cursor++ ];
+        } else if ( Hash = MapKeyHash( Text ); State.ByHash.count( Hash ) ) {
+            const vector<int>& Found = State.ByHash[ Hash ];
+            const auto Candidate = find_if( Found.begin(), Found.end(), Matches );
+            if ( Candidate != Found.end() ) {
+                Id = *Candidate;
+                Cursor = State.Forms[ Id ].Position + 1;
+            }
+        }
+        if ( Id < 0 ) {
+            Id = static_cast<int>( State.Forms.size() );
+            OWatchForm& Form = State.Forms.emplace_back();
+            Form.Text = string( Text );
+            Form.Hash = Hash;
+            Form.Line = Line;
+            Form.Indent = Indent;
+            Form.Tokens = Tokenize( Form.Text, Form.Line, Form.Indent );
+            ScanBindings( Form.Tokens, 0, Form.Tokens.Length(), Form.Defines, Form.Names, Form.DefinesFunction );
+            State.ByHash[ Hash ].push_back( Id );
+            for ( const int Name : Form.Names ) {
+                State.Users[ Name ].insert( Id );
+            }
+        } else {
+            // Moved text keeps its form, but errors should point at where it is now.
+            OWatchForm& Form = State.Forms[ Id ];
+            if ( Form.Line != Line || Form.Indent != Indent ) {
+                Form.Line = Line;
+                Form.Indent = Indent;
+                Form.Tokens.Clear();
+            }
+        }
+        OWatchForm& Form = State.Forms[ Id ];
+        Form.Version = State.Version;
+        Form.Position = static_cast<int>( Order.size() );
+        Order.push_back( Id );
+        if ( !Form.Ran ) {
+            Dirty.push_back( Form.Position );
+        }
+    }
+    vector<int> Removed{};
+    for ( const int Id : State.Order ) {
+        OWatchForm& Form = State.Forms[ Id ];
+        if ( Form.Version == State.Version ) {
+            continue;
+        }
+        Removed.insert( Removed.end(), Form.Defines.begin(), Form.Defines.end() );
+        for ( const int Name : Form.Names ) {
+            State.Users[ Name ].erase( Id );
+        }
+        vector<int>& SameHash = State.ByHash[ Form.Hash ];
+        SameHash.erase( find( SameHash.begin(), SameHash.end(), Id ) );
+        Form = OWatchForm{};
+    }
+    State.Order = std::move( Order );
+    set<int> Pending( Dirty.begin(), Dirty.end() );
+    unordered_set<int> Rebound{};
+    // Queues the forms after From that name one of Names, following functions that name them.
+    const auto Rebind = [&State, &Pending, &Rebound]( vector<int> Names, const int From ) {
+        // A later function of the same name still has to win.
+        for ( const int Name : Names ) {
+            for ( const int Id : State.Users[ Name ] ) {
+                const OWatchForm& Form = State.Forms[ Id ];
+                if ( Form.Position > From && find( Form.Defines.begin(), Form.Defines.end(), Name ) != Form.Defines.end() ) {
+                    Pending.insert( Form.Position );
+                }
+            }
+        }
+        while ( !Names.empty() ) {
+            const int Name = Names.back();
+            Names.pop_back();
+            if ( !Rebound.insert( Name ).second ) {
+                continue;
+            }
+            for ( const int Id : State.Users[ Name ] ) {
+                const OWatchForm& Form = State.Forms[ Id ];
+                if ( !Form.DefinesFunction ) {
+                    if ( Form.Position > From ) {
+                        Pending.insert( Form.Position );
+                    }
+                    continue;
+                }
+                Names.insert( Names.end(), Form.Defines.begin(), Form.Defines.end() );
+            }
+        }
+    };
+    // Removed names are unbound first, so forms that still bind or name them
+    // run again from the state a fresh run of the new text would see.
+    for ( const int Name : Removed ) {
+        Machine->Stack.Unset( Name );
+    }
+    Rebind( Removed, -1 );
+    int Runs = 0;
+    while ( !Pending.empty() && !Machine->ShouldExit ) {
+        const int At = *Pending.begin();
+        Pending.erase( Pending.begin() );
+        OWatchForm& Form = State.Forms[ State.Order[ At ] ];
+        Runs++;
+        if ( !RunWatchForm( Machine, Form ) ) {
+            // Forms not reached run with the next version.
+            for ( const int Skipped : Pending ) {
+                State.Forms[ State.Order[ Skipped ] ].Ran = false;
+            }
+            break;
+        }
+        Rebind( Form.Defines, At );
+    }
+    Machine->Out.Flush();
+    return Runs;
+}
+
+// Runs FileName and then every version of it saved, until the script exits.
+int Watch( OMachinePtr Machine, const string& FileName ) {
+    OWatchState State{};
+    filesystem::file_time_type Seen{};
+    uintmax_t SeenSize = 0;
+    bool First = true;
+    while ( !Machine->ShouldExit ) {
+        error_code Code{};
+        const filesystem::file_time_type Now = filesystem::last_write_time( FileName, Code );
+        const uintmax_t Size = Code ? 0 : filesystem::file_size( FileName, Code );
+        const bool Changed = !Code && ( First || Now != Seen || Size != SeenSize );
+        if ( !Changed ) {
+            if ( First ) {
+                std::cerr << "Error: Cannot read " << FileName << std::endl;
+                return 1;
+            }
+            this_thread::sleep_for( chrono::milliseconds( WATCH_POLL_MS ) );
+            continue;
+        }
+        Seen = Now;
+        SeenSize = Size;
+        auto InputRet = ReadFileIntoString( FileName );
+        if ( InputRet.ErrorOccured ) {
+            std::cerr << InputRet.Error << std::endl;
+            continue;
+        }
+        const uint64 StartNs = NowNs();
+        const int Runs = WatchReload( Machine, State, InputRet.Out, FileName );
+        std::cerr << "[watch] " << FileName << ": ran " << Runs << " of " << State.Order.size() << " forms in " << ( NowNs() - StartNs ) / 1000 << " us" << std::endl;
+        First = false;
+    }
+    Shutdown( Machine );
+    return 0;
+}
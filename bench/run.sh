@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs every bench/*.owl script once per engine mode and writes the
+# results as a JSON array to bench_results.json (or $1).
+# Each mode is "name:flags".
+
+cd "$(dirname "$0")/.." || exit 1
+
+OUTPUT="${1:-bench_results.json}"
+MODES="stack:--engine=stack recursive:--engine=recursive unbuffered:--unbuffered"
+OWLISP=./Owlisp
+
+echo "[" > "$OUTPUT"
+FIRST=1
+for MODE in $MODES; do
+    NAME="${MODE%%:*}"
+    FLAGS="${MODE#*:}"
+    for SCRIPT in bench/*.owl; do
+        BENCH="$(basename "$SCRIPT" .owl)"
+        # The interpreter prints its measurements as the last line on stderr.
+        RESULT="$($OWLISP --bench $FLAGS "$SCRIPT" 2>&1 >/dev/null | tail -n 1)"
+        case "$RESULT" in
+            "{"*) ;;
+            *) echo "bench: $BENCH ($NAME) failed: $RESULT" >&2; exit 1 ;;
+        esac
+        if [ $FIRST -eq 0 ]; then
+            echo "," >> "$OUTPUT"
+        fi
+        FIRST=0
+        printf '  {"benchmark": "%s", "mode": "%s", %s' "$BENCH" "$NAME" "${RESULT#\{}" >> "$OUTPUT"
+        echo "$BENCH ($NAME): $RESULT"
+    done
+done
+printf '\n]\n' >> "$OUTPUT"
+echo "Wrote $OUTPUT"
@@ -0,0 +1,74 @@
+// Embeds the interpreter in a host program through OwlEmbed.h.
+// Usage: embed_example
+//   Registers typed native functions, runs a script that uses them and calls
+//   back into an Owl function with a native struct argument. An eval error is
+//   captured through the machine's error sink, and batch calls are checked row
+//   by row against single calls.
+
+#define OWL_EMBEDDED 1
+#include "../Owlisp.cpp"
+
+#include <cmath>
+
+struct OVec2 {
+    float X;
+    float Y;
+};
+
+template<>
+struct OMarshal<OVec2> : OStructMarshal<OVec2> {
+    static constexpr auto Fields = OwlFields( &OVec2::X, &OVec2::Y );
+};
+
+int main( int argc, char* argv[] ) {
+    OMachinePtr Machine = Make_OwlMachine();
+    RegisterNative( Machine, "vec2", []( float X, float Y ) { return OVec2{ X, Y }; } );
+    RegisterNative( Machine, "vlen", []( const OVec2& V ) { return std::sqrt( V.X * V.X + V.Y * V.Y ); } );
+    RegisterNative( Machine, "repeat", []( const string& Text, int Count ) {
+        string Out{};
+        for ( int i = 0; i < Count; i++ ) {
+            Out += Text;
+        }
+        return Out;
+    } );
+    RunOwl( Machine, R"(
+        (defunc Scale V K (vec2 (* (field V 0) K) (* (field V 1) K)))
+        (defunc Fib N (? (< N 2) N (+ (Fib (- N 1)) (Fib (- N 2)))))
+        (print (vlen (vec2 3 4)) `\n`)
+        (print (repeat `ab` 3) `\n`)
+    )" );
+    const OVec2 Scaled = CallOwl<OVec2>( Machine, "Scale", OVec2{ 1.5f, 2 }, 2 );
+    std::cout << "Scale: " << Scaled.X << " " << Scaled.Y << std::endl;
+    std::cout << "Fib 20: " << CallOwl<int>( Machine, "Fib", 20 ) << std::endl;
+    // Eval errors go to stderr unless the host takes them.
+    string Errors{};
+    Machine->Err.Sink = [&Errors]( string_view Chunk ) { Errors += Chunk; };
+    CallOwl<int>( Machine, "Missing", 1 );
+    Machine->Err.Sink = nullptr;
+    const size_t Start = Errors.find( "] " ) + 2;
+    std::cout << "Missing raised an error: " << Machine->EvalError << ", " << Errors.substr( Start, Errors.find( '\n', Start ) - Start ) << std::endl;
+    std::vector<int> Ids{ 1, 2, 3, 4 };
+    std::vector<double> Prices{ 10, 20, 30, 40 };
+    std::vector<float> Scores( Ids.size() );
+    RunOwl( Machine, "(defunc Score Id Price (* Price (+ 1 (modi Id 3))))" );
+    CallOwlBatch( Machine, "Score", { Make_OBatchColumn( Ids.data() ), Make_OBatchColumn( Prices.data() ) }, Make_OBatchOutput( Scores.data() ), Ids.size() );
+    std::cout << "Scores:";
+    for ( const float Score : Scores ) {
+        std::cout << " " << Score;
+    }
+    std::cout << std::endl;
+    // Every batch row gets the result a single call with that row would.
+    std::vector<double> Values{ 1234567.0, 0.1234565, 0.123457, 2.5, -0.0, 1e-05, 3, 1e30, 16777217 };
+    RunOwl( Machine, "(defunc Same X (+ X 0)) (defunc Near X (== X 0.123457)) (defunc Half X (/ X 2))" );
+    bool Matches = true;
+    for ( const char* Name : { "Same", "Near", "Half" } ) {
+        std::vector<double> Batched( Values.size() );
+        CallOwlBatch( Machine, Name, { Make_OBatchColumn( Values.data() ) }, Make_OBatchOutput( Batched.data() ), Values.size() );
+        for ( size_t i = 0; i < Values.size(); i++ ) {
+            Matches = Matches && Batched[ i ] == CallOwl<double>( Machine, Name, Values[ i ] );
+        }
+    }
+    std::cout << "Batch matches CallOwl: " << Matches << std::endl;
+    Shutdown( Machine );
+    return 0;
+}
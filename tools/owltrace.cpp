@@ -0,0 +1,87 @@
+// Decodes a binary trace written by `Owlisp --trace`, (tracedump), SIGUSR1 or a crash.
+// Usage: owltrace [-s] trace-file
+//   Prints one line per record, oldest first per thread.
+//   -s prints per-symbol event counts instead.
+
+#include "../Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <map>
+
+template<typename T>
+bool ReadValue( ifstream& File, T& Out ) {
+    return static_cast<bool>( File.read( reinterpret_cast<char*>( &Out ), sizeof( T ) ) );
+}
+
+int main( int argc, char* argv[] ) {
+    bool Summary = false;
+    string Path{};
+    for ( int i = 1; i < argc; i++ ) {
+        const string Arg{ argv[ i ] };
+        if ( Arg == "-s" ) {
+            Summary = true;
+        } else {
+            Path = Arg;
+        }
+    }
+    if ( Path.empty() ) {
+        cerr << "Usage: owltrace [-s] trace-file" << endl;
+        return 1;
+    }
+
+    ifstream File{ Path, ios::binary };
+    char Magic[ sizeof( TRACE_MAGIC ) ]{};
+    uint32_t Version = 0;
+    uint32_t RecordSize = 0;
+    uint32_t SymbolCount = 0;
+    if ( !File.read( Magic, sizeof( Magic ) ) || memcmp( Magic, TRACE_MAGIC, sizeof( Magic ) ) != 0 ) {
+        cerr << "Error: Not an Owlisp trace." << endl;
+        return 1;
+    }
+    if ( !ReadValue( File, Version ) || Version != TRACE_VERSION || !ReadValue( File, RecordSize ) || RecordSize != sizeof( OTraceRecord ) ) {
+        cerr << "Error: Unsupported trace version." << endl;
+        return 1;
+    }
+    ReadValue( File, SymbolCount );
+    vector<string> Symbols( SymbolCount );
+    for ( string& Symbol : Symbols ) {
+        uint32_t Length = 0;
+        ReadValue( File, Length );
+        Symbol.resize( Length );
+        File.read( Symbol.data(), Length );
+    }
+
+    uint32_t RingCount = 0;
+    ReadValue( File, RingCount );
+    map<pair<string, string>, uint64_t> Counts{};
+    for ( uint32_t Ring = 0; Ring < RingCount && File; Ring++ ) {
+        uint32_t ThreadIndex = 0;
+        uint32_t RecordCount = 0;
+        ReadValue( File, ThreadIndex );
+        ReadValue( File, RecordCount );
+        uint64_t FirstNs = 0;
+        for ( uint32_t i = 0; i < RecordCount; i++ ) {
+            OTraceRecord Record{};
+            if ( !ReadValue( File, Record ) ) {
+                cerr << "Error: Truncated trace." << endl;
+                return 1;
+            }
+            if ( i == 0 ) {
+                FirstNs = Record.TimestampNs;
+            }
+            const string Event = Record.Event < sizeof( TraceEventNames ) / sizeof( TraceEventNames[ 0 ] ) ? TraceEventNames[ Record.Event ] : "unknown";
+            // Parens end a token, so no symbol is spelled like this.
+            const string Symbol = Record.Symbol >= 0 && Record.Symbol < static_cast<int32_t>( Symbols.size() ) ? Symbols[ Record.Symbol ] : "(none)";
+            if ( Summary ) {
+                Counts[ { Symbol, Event } ]++;
+            } else {
+                cout << ThreadIndex << " " << ( Record.TimestampNs - FirstNs ) << "ns " << Event << " " << Symbol << " line " << Record.Line << "\n";
+            }
+        }
+    }
+    for ( const auto& Count : Counts ) {
+        cout << Count.second << " " << Count.first.second << " " << Count.first.first << "\n";
+    }
+    return 0;
+}